@@ -0,0 +1,715 @@
+/*
+ * bench.c
+ *
+ * Microbenchmarks for the hot decode paths. Each benchmark runs on a
+ * recorded stream when a file is given, or on a synthetic one.
+ *
+ *      bench framer [capture]    frame decoding of the GPS stream
+ *      bench batches             protocol version 2 decoding, against version 1
+ *      bench crc                 CRC-32C throughput, table against sse4.2
+ *      bench blocks              compressed track block coding
+ *      bench tpv [capture]       TPV extraction from gpsd JSON output
+ *      bench nmea [capture]      fixes read off the receiver, against tpv
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: yiding
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+#include <stdarg.h>
+
+#include "framer.h"
+#include "crc32c.h"
+#include "trackblock.h"
+#include "tpv.h"
+#include "nmea.h"
+
+#define BENCH_BYTES	(64 << 20)	/* size of a synthetic stream */
+#define BENCH_ROUNDS 5
+
+static double now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint32_t lcg = 12345;
+
+static uint32_t random32(void) {
+	lcg = lcg * 1103515245 + 12345;
+	return lcg >> 8;
+}
+
+/* read a whole capture file into memory */
+static unsigned char * loadFile(const char * path, size_t * len) {
+	FILE * fp = fopen(path, "rb");
+	unsigned char * buf;
+	long n;
+
+	if (fp == NULL) {
+		perror(path);
+		exit(1);
+	}
+	fseek(fp, 0, SEEK_END);
+	n = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+	buf = (unsigned char *) malloc((size_t) n + 1);
+	if (buf == NULL || fread(buf, 1, (size_t) n, fp) != (size_t) n) {
+		fprintf(stderr, "bench: cannot read %s\n", path);
+		exit(1);
+	}
+	fclose(fp);
+	buf[n] = '\0';
+	*len = (size_t) n;
+	return buf;
+}
+
+/*
+ * A gateway-like GPS stream: mostly back-to-back fixes, some no-fix
+ * frames and the odd run of line noise between frames.
+ */
+static unsigned char * syntheticFrames(size_t * len) {
+	unsigned char * buf = (unsigned char *) malloc(BENCH_BYTES);
+	struct gps_package gps = { 40.0f, -74.0f, 10.0f, 5.0f, 90.0f };
+	size_t n = 0;
+
+	if (buf == NULL) {
+		printf("Fail to allocate memory space\n");
+		exit(1);
+	}
+	while (n + 64 < BENCH_BYTES) {
+		uint32_t r = random32() % 100;
+
+		if (r < 3) {
+			unsigned k = 1 + random32() % 40;
+			while (k--) {
+				unsigned char c = (unsigned char) random32();
+				buf[n++] = c == DELIMITER_BYTE ? 0 : c;
+			}
+		}
+		else if (r < 8) {
+			buf[n++] = DELIMITER_BYTE;
+			buf[n++] = NOFIX_BYTE;
+		}
+		else {
+			gps.lat += 0.0001f;
+			gps.lon -= 0.0001f;
+			buf[n++] = DELIMITER_BYTE;
+			buf[n++] = GPS_BYTE;
+			memcpy(buf + n, &gps, sizeof gps);
+			n += sizeof gps;
+		}
+	}
+	*len = n;
+	return buf;
+}
+
+/*
+ * The per-byte state machine the server used before the framer,
+ * minus its socket reads: frames are decoded within one read buffer.
+ */
+typedef enum {
+	INIT, TYPE, NOFIXFOUND, GPSFOUND
+} State_t;
+
+static unsigned long legacyDecode(const unsigned char * buff, int readcount, volatile float * sink) {
+	struct gps_package gps;
+	State_t state = INIT;
+	int foundType = INIT;
+	unsigned long frames = 0;
+	int i = 0;
+
+	while (i < readcount) {
+		switch (state) {
+		case INIT:
+			if (buff[i] == DELIMITER_BYTE)
+				state = TYPE;
+			++i;
+			break;
+		case TYPE:
+			if (buff[i] == NOFIX_BYTE) {
+				state = NOFIXFOUND;
+				foundType = NOFIXFOUND;
+			}
+			else if (buff[i] == GPS_BYTE) {
+				state = GPSFOUND;
+				foundType = GPSFOUND;
+			}
+			else
+				state = INIT;
+			++i;
+			break;
+		case NOFIXFOUND:
+			state = INIT;
+			break;
+		case GPSFOUND:
+			if (foundType == GPSFOUND && i + (int) sizeof(struct gps_package) <= readcount) {
+				memcpy(&gps, buff + i, sizeof gps);
+				*sink = gps.lat;
+				frames++;
+				i += sizeof(struct gps_package);
+			}
+			else
+				i = readcount;
+			state = INIT;
+			break;
+		}
+	}
+	return frames;
+}
+
+static void report(const char * name, size_t bytes, unsigned long frames, double secs) {
+	printf("%-18s %8.1f MB/s %8.2f ns/frame %10lu frames\n", name,
+			bytes / secs / 1e6, secs * 1e9 / (frames ? frames : 1), frames);
+}
+
+static void benchFramer(const unsigned char * stream, size_t len) {
+	static const framerScan scans[] = { FRAMER_SCAN_SCALAR, FRAMER_SCAN_SSE2, FRAMER_SCAN_AVX2 };
+	struct gps_package fixes[32];
+	volatile float sink;
+	unsigned long frames = 0;
+	double best, t;
+	size_t off;
+	int round, s, n;
+
+	/* the old state machine, fed one read-sized buffer at a time */
+	best = 1e9;
+	for (round = 0; round < BENCH_ROUNDS; round++) {
+		t = now();
+		frames = 0;
+		for (off = 0; off < len; off += MAX_MSG)
+			frames += legacyDecode(stream + off, len - off < MAX_MSG ? (int) (len - off) : MAX_MSG, &sink);
+		t = now() - t;
+		if (t < best)
+			best = t;
+	}
+	report("state machine", len, frames, best);
+
+	for (s = 0; s < 3; s++) {
+		const char * name = framerSelect(scans[s]);
+		char label[32];
+		GpsFramer framer;
+
+		best = 1e9;
+		for (round = 0; round < BENCH_ROUNDS; round++) {
+			framerInit(&framer);
+			t = now();
+			for (off = 0; off < len; ) {
+				off += framerPush(&framer, stream + off, len - off < MAX_MSG ? len - off : MAX_MSG);
+				while ((n = framerDecode(&framer, fixes, NULL, NULL, 32)) > 0)
+					sink = fixes[n - 1].lat;
+			}
+			t = now() - t;
+			if (t < best)
+				best = t;
+		}
+		snprintf(label, sizeof label, "framer %s", name);
+		report(label, len, framer.frames, best);
+	}
+}
+
+/*
+ * The same kind of fixes as version 2 batches of COM_BATCH_MAX, and
+ * as the version 1 frames they replace
+ */
+static unsigned char * syntheticBatches(size_t * len, unsigned char ** v1, size_t * v1len) {
+	unsigned char * buf = (unsigned char *) malloc(BENCH_BYTES);
+	unsigned char * old = (unsigned char *) malloc(BENCH_BYTES);
+	struct gps_package gps = { 40.0f, -74.0f, 10.0f, 5.0f, 90.0f };
+	comBatch batch;
+	size_t n = 0, m = 0;
+	int i;
+
+	if (buf == NULL || old == NULL) {
+		printf("Fail to allocate memory space\n");
+		exit(1);
+	}
+	memset(&batch, 0, sizeof batch);
+	batch.header.protocolId = PROTOCOL;
+	batch.version = COM_VERSION_2;
+	batch.flags = COM_BATCH_CRC;
+	batch.count = COM_BATCH_MAX;
+	batch.length = COM_BATCH_MAX * COM_FIX_SIZE;
+	batch.time = 1792224000000LL;
+	while (n + COM_BATCH_SIZE + batch.length + COM_CRC_SIZE < BENCH_BYTES) {
+		size_t start = n;
+
+		batch.header.packageId++;
+		comEncodeBatch(&batch, buf + n);
+		n += COM_BATCH_SIZE;
+		for (i = 0; i < COM_BATCH_MAX; i++) {
+			gps.lat += 0.0001f;
+			gps.lon -= 0.0001f;
+			comEncodeFix(&gps, i * 1000, buf + n);
+			n += COM_FIX_SIZE;
+			old[m++] = DELIMITER_BYTE;
+			old[m++] = GPS_BYTE;
+			memcpy(old + m, &gps, sizeof gps);
+			m += sizeof gps;
+		}
+		comPut32(buf + n, crc32c(0, buf + start, n - start));
+		n += COM_CRC_SIZE;
+	}
+	*len = n;
+	*v1 = old;
+	*v1len = m;
+	return buf;
+}
+
+/* decode a whole stream read-sized piece by piece, best of BENCH_ROUNDS */
+static double framerRun(const unsigned char * stream, size_t len, GpsFramer * framer) {
+	struct gps_package fixes[32];
+	uint32_t ages[32];
+	int64_t sent[32];
+	volatile float sink;
+	double best = 1e9, t;
+	size_t off;
+	int round, n;
+
+	for (round = 0; round < BENCH_ROUNDS; round++) {
+		framerInit(framer);
+		t = now();
+		for (off = 0; off < len; ) {
+			off += framerPush(framer, stream + off, len - off < MAX_MSG ? len - off : MAX_MSG);
+			while ((n = framerDecode(framer, fixes, ages, sent, 32)) > 0)
+				sink = fixes[n - 1].lat;
+		}
+		t = now() - t;
+		if (t < best)
+			best = t;
+	}
+	(void) sink;
+	return best;
+}
+
+static void benchBatches(void) {
+	unsigned char * v1;
+	size_t len, v1len, off;
+	unsigned char * v2 = syntheticBatches(&len, &v1, &v1len);
+	GpsFramer framer;
+	volatile uint32_t sink = 0;
+	double t, crc = 1e9, c;
+	int round;
+
+	printf("framer %s, crc32c %s\n", framerSelect(FRAMER_SCAN_AUTO), crc32cSelect(CRC32C_AUTO));
+	t = framerRun(v1, v1len, &framer);
+	report("version 1 frames", v1len, framer.frames, t);
+	printf("%.1f bytes per fix\n", (double) v1len / framer.frames);
+	t = framerRun(v2, len, &framer);
+	report("version 2 batches", len, framer.frames, t);
+	printf("%.1f bytes per fix, %lu batches, %lu rejected\n", (double) len / framer.frames,
+			framer.batches, framer.rejects);
+
+	/*
+	 * The share of that spent on the CRC. The framer checks a batch it
+	 * has just copied into its ring, so from cache: one batch as often.
+	 */
+	for (round = 0; round < BENCH_ROUNDS; round++) {
+		c = now();
+		for (off = 0; off < framer.batches; off++)
+			sink ^= crc32c(0, v2, COM_BATCH_SIZE + COM_BATCH_MAX * COM_FIX_SIZE);
+		c = now() - c;
+		if (c < crc)
+			crc = c;
+	}
+	(void) sink;
+	printf("crc %.2f ns per fix, %.1f%% of decoding\n", crc / framer.frames * 1e9, 100 * crc / t);
+	free(v1);
+	free(v2);
+}
+
+/* checksum a synthetic stream the way each implementation would */
+static void benchCrc(void) {
+	static const crc32cImpl impls[] = { CRC32C_TABLE, CRC32C_SSE42 };
+	unsigned char * buf = (unsigned char *) malloc(BENCH_BYTES);
+	size_t sizes[] = { COM_BATCH_SIZE + COM_BATCH_MAX * COM_FIX_SIZE, BENCH_BYTES };
+	size_t i, j, off;
+	int round, k;
+
+	if (buf == NULL) {
+		printf("Fail to allocate memory space\n");
+		exit(1);
+	}
+	for (i = 0; i < BENCH_BYTES; i++)
+		buf[i] = (unsigned char) random32();
+	for (k = 0; k < 2; k++) {
+		const char * name = crc32cSelect(impls[k]);
+
+		if ((impls[k] == CRC32C_TABLE) != (strcmp(name, "table") == 0))
+			continue;	/* not on this CPU */
+		for (j = 0; j < 2; j++) {
+			double best = 1e9, t;
+			volatile uint32_t sink = 0;
+
+			for (round = 0; round < BENCH_ROUNDS; round++) {
+				t = now();
+				/* a batch at a time is checked in cache, the stream from memory */
+				for (off = 0; off + sizes[j] <= BENCH_BYTES; off += sizes[j])
+					sink ^= crc32c(0, buf + (j == 0 ? 0 : off), sizes[j]);
+				t = now() - t;
+				if (t < best)
+					best = t;
+			}
+			printf("%-13s %8zu byte blocks: %8.1f MB/s\n", name, sizes[j],
+					BENCH_BYTES / best / 1e6);
+			(void) sink;
+		}
+	}
+	crc32cSelect(CRC32C_AUTO);
+	free(buf);
+}
+
+/*
+ * A fleet at 1 Hz: each vehicle drives with slowly changing speed and
+ * heading, so consecutive fixes differ by a few metres.
+ */
+#define BENCH_VEHICLES	64
+#define BENCH_FIXES		(1 << 20)
+#define BENCH_BLOCK		256		/* fixes per block */
+
+static TrackRecord * syntheticTracks(unsigned n) {
+	TrackRecord * recs = (TrackRecord *) malloc(n * sizeof(TrackRecord));
+	unsigned per = n / BENCH_VEHICLES, v, i;
+
+	if (recs == NULL) {
+		printf("Fail to allocate memory space\n");
+		exit(1);
+	}
+	/* grouped by vehicle, the way blocks are built */
+	for (v = 0; v < BENCH_VEHICLES; v++) {
+		TrackRecord r = { v + 1, 0, 1700000000000000000LL, { 40.0f + v * 0.01f, -74.0f, 10.0f, 12.0f, 90.0f }, 0 };
+
+		for (i = 0; i < per; i++) {
+			recs[v * per + i] = r;
+			r.received += 1000000000LL + (random32() % 5) * 1000000LL;
+			r.fix.speed += ((int) (random32() % 21) - 10) * 0.05f;
+			if (r.fix.speed < 0)
+				r.fix.speed = 0;
+			r.fix.heading += ((int) (random32() % 11) - 5) * 0.5f;
+			if (r.fix.heading >= 360.0f)
+				r.fix.heading -= 360.0f;
+			if (r.fix.heading < 0)
+				r.fix.heading += 360.0f;
+			r.fix.lat += r.fix.speed * 9e-6f * cosf(r.fix.heading * 0.0174533f);
+			r.fix.lon += r.fix.speed * 9e-6f * sinf(r.fix.heading * 0.0174533f);
+			r.fix.alt += ((int) (random32() % 3) - 1) * 0.1f;
+		}
+	}
+	return recs;
+}
+
+static void benchBlocks(void) {
+	unsigned n = BENCH_FIXES / BENCH_VEHICLES * BENCH_VEHICLES;
+	TrackRecord * recs = syntheticTracks(n);
+	TrackRecord out[BENCH_BLOCK];
+	unsigned char * blocks = (unsigned char *) malloc(TRACK_BLOCK_BOUND(BENCH_BLOCK) * (n / BENCH_BLOCK + 1));
+	size_t size = 0, off;
+	volatile float sink;
+	double best, t;
+	unsigned i, k;
+	int round, got;
+
+	if (blocks == NULL) {
+		printf("Fail to allocate memory space\n");
+		exit(1);
+	}
+
+	best = 1e9;
+	for (round = 0; round < BENCH_ROUNDS; round++) {
+		t = now();
+		for (i = 0, size = 0; i < n; i += BENCH_BLOCK)
+			size += trackBlockEncode(recs + i, BENCH_BLOCK, blocks + size, TRACK_BLOCK_BOUND(BENCH_BLOCK));
+		t = now() - t;
+		if (t < best)
+			best = t;
+	}
+	report("block encode", (size_t) n * sizeof(TrackRecord), n, best);
+
+	/* the baseline: touching every field of the raw records */
+	best = 1e9;
+	for (round = 0; round < BENCH_ROUNDS; round++) {
+		float acc = 0;
+
+		t = now();
+		for (i = 0; i < n; i++)
+			acc += recs[i].fix.lat + recs[i].fix.speed;
+		sink = acc;
+		t = now() - t;
+		if (t < best)
+			best = t;
+	}
+	report("raw scan", (size_t) n * sizeof(TrackRecord), n, best);
+
+	best = 1e9;
+	for (round = 0; round < BENCH_ROUNDS; round++) {
+		float acc = 0;
+
+		t = now();
+		for (off = 0; off < size; ) {
+			TrackBlockInfo info;
+
+			trackBlockInfo(blocks + off, size - off, &info);
+			got = trackBlockDecode(blocks + off, size - off, out, BENCH_BLOCK);
+			for (k = 0; k < (unsigned) got; k++)
+				acc += out[k].fix.lat + out[k].fix.speed;
+			off += info.size;
+		}
+		sink = acc;
+		t = now() - t;
+		if (t < best)
+			best = t;
+	}
+	(void) sink;
+	report("block decode", size, n, best);
+	printf("%.2f bytes/fix compressed, %zu raw: %.1fx smaller, decoded at %.0f MB/s of raw records\n",
+			(double) size / n, sizeof(TrackRecord), (double) n * sizeof(TrackRecord) / size,
+			n * sizeof(TrackRecord) / best / 1e6);
+
+	free(blocks);
+	free(recs);
+}
+
+/*
+ * A gpsd watch stream at 1 Hz: a TPV report every second, a SKY report
+ * with a dozen satellites every five, now and then a DEVICE report.
+ */
+static unsigned char * syntheticReports(size_t * len) {
+	unsigned char * buf = (unsigned char *) malloc(BENCH_BYTES);
+	double lat = 40.0, lon = -74.0;
+	size_t n = 0;
+	unsigned sec = 0, s;
+
+	if (buf == NULL) {
+		printf("Fail to allocate memory space\n");
+		exit(1);
+	}
+	while (n + 2048 < BENCH_BYTES) {
+		lat += 0.00001 * (random32() % 10);
+		lon -= 0.00001 * (random32() % 10);
+		n += (size_t) sprintf((char *) buf + n, "{\"class\":\"TPV\",\"device\":\"/dev/ttyUSB0\","
+				"\"mode\":3,\"time\":\"2026-10-17T%02u:%02u:%02u.000Z\",\"ept\":0.005,"
+				"\"lat\":%.9f,\"lon\":%.9f,\"alt\":%.3f,\"epx\":3.412,\"epy\":4.871,"
+				"\"epv\":11.270,\"track\":%.4f,\"speed\":%.3f,\"climb\":0.021,"
+				"\"eps\":9.74,\"epc\":22.54}\r\n", sec / 3600 % 24, sec / 60 % 60, sec % 60,
+				lat, lon, 10.0 + random32() % 100 / 10.0, random32() % 3600 / 10.0,
+				random32() % 3000 / 100.0);
+		if (sec % 5 == 0) {
+			n += (size_t) sprintf((char *) buf + n, "{\"class\":\"SKY\",\"device\":\"/dev/ttyUSB0\","
+					"\"xdop\":0.61,\"ydop\":0.85,\"vdop\":1.32,\"tdop\":0.94,\"hdop\":1.05,"
+					"\"gdop\":1.92,\"pdop\":1.69,\"satellites\":[");
+			for (s = 0; s < 12; s++)
+				n += (size_t) sprintf((char *) buf + n, "%s{\"PRN\":%u,\"el\":%u,\"az\":%u,"
+						"\"ss\":%u,\"used\":%s}", s ? "," : "", s * 3 + 1, random32() % 90,
+						random32() % 360, 20 + random32() % 30, s % 3 ? "true" : "false");
+			n += (size_t) sprintf((char *) buf + n, "]}\r\n");
+		}
+		if (sec % 60 == 0)
+			n += (size_t) sprintf((char *) buf + n, "{\"class\":\"DEVICE\",\"path\":\"/dev/ttyUSB0\","
+					"\"activated\":\"2026-10-17T00:00:00.000Z\",\"driver\":\"NMEA0183\","
+					"\"native\":0,\"bps\":4800,\"parity\":\"N\",\"stopbits\":1,\"cycle\":1.00}\r\n");
+		sec++;
+	}
+	*len = n;
+	return buf;
+}
+
+/*
+ * Offsets of the lines of stream, and of its end; the lines are split
+ * first so that only the extraction is timed.
+ */
+static size_t * splitLines(const unsigned char * stream, size_t len, size_t * nlines) {
+	size_t * lines, n = 0, cap = 1024, off;
+
+	if ((lines = (size_t *) malloc(cap * sizeof(size_t))) == NULL) {
+		printf("Fail to allocate memory space\n");
+		exit(1);
+	}
+	lines[n++] = 0;
+	for (off = 0; off < len; off++)
+		if (stream[off] == '\n') {
+			if (n == cap && (lines = (size_t *) realloc(lines, (cap *= 2) * sizeof(size_t))) == NULL) {
+				printf("Fail to allocate memory space\n");
+				exit(1);
+			}
+			lines[n++] = off + 1;
+		}
+	*nlines = n - 1;
+	return lines;
+}
+
+static void benchTpv(const unsigned char * stream, size_t len) {
+	size_t * lines, nlines, i;
+	struct gps_package fix;
+	TpvReport report;
+	unsigned long tpv = 0, fixes = 0;
+	volatile float sink = 0;
+	double best, t;
+	int round;
+
+	lines = splitLines(stream, len, &nlines);
+
+	best = 1e9;
+	for (round = 0; round < BENCH_ROUNDS; round++) {
+		t = now();
+		tpv = fixes = 0;
+		for (i = 0; i < nlines; i++)
+			if (tpvParse((const char *) stream + lines[i], lines[i + 1] - lines[i], &report) == TPV_OK) {
+				tpv++;
+				if (tpvFix(&report, &fix) == SUCCESS) {
+					sink = fix.lat;
+					fixes++;
+				}
+			}
+		t = now() - t;
+		if (t < best)
+			best = t;
+	}
+	(void) sink;
+	printf("%-18s %8.1f MB/s %8.2f ns/line %10zu lines\n", "tpv extract",
+			len / best / 1e6, best * 1e9 / (nlines ? nlines : 1), nlines);
+	printf("%lu TPV reports, %lu whole fixes, %.2f ns and %.0f bytes per fix\n", tpv, fixes,
+			best * 1e9 / (fixes ? fixes : 1), (double) len / (fixes ? fixes : 1));
+	free(lines);
+}
+
+/* append the NMEA sentence of the body in fmt, with its $, checksum and CRLF */
+static size_t sentence(char * out, const char * fmt, ...) {
+	unsigned char sum = 0;
+	va_list ap;
+	int n, i;
+
+	out[0] = '$';
+	va_start(ap, fmt);
+	n = vsprintf(out + 1, fmt, ap);
+	va_end(ap);
+	for (i = 1; i <= n; i++)
+		sum ^= (unsigned char) out[i];
+	return (size_t) (1 + n + sprintf(out + 1 + n, "*%02X\r\n", sum));
+}
+
+/*
+ * A receiver at 1 Hz: GGA, GSA, three GSV with a dozen satellites,
+ * RMC and VTG every second, what gpsd turns into syntheticReports().
+ */
+static unsigned char * syntheticSentences(size_t * len) {
+	unsigned char * buf = (unsigned char *) malloc(BENCH_BYTES);
+	double lat = 4000.0, lon = 7400.0;
+	size_t n = 0;
+	unsigned sec = 0, s;
+
+	if (buf == NULL) {
+		printf("Fail to allocate memory space\n");
+		exit(1);
+	}
+	while (n + 2048 < BENCH_BYTES) {
+		char * out = (char *) buf;
+		char hms[16];
+		double track = random32() % 3600 / 10.0, knots = random32() % 3000 / 100.0 / 0.514444;
+
+		lat += 0.0006 * (random32() % 10);
+		lon += 0.0006 * (random32() % 10);
+		sprintf(hms, "%02u%02u%02u.00", sec / 3600 % 24, sec / 60 % 60, sec % 60);
+		n += sentence(out + n, "GPGGA,%s,%.5f,N,%.5f,W,1,08,1.05,%.1f,M,-34.2,M,,", hms,
+				lat, lon, 10.0 + random32() % 100 / 10.0);
+		n += sentence(out + n, "GPGSA,A,3,01,04,07,10,13,16,19,22,,,,,1.69,1.05,1.32");
+		for (s = 0; s < 3; s++)
+			n += sentence(out + n, "GPGSV,3,%u,12,%02u,%02u,%03u,%02u,%02u,%02u,%03u,%02u,"
+					"%02u,%02u,%03u,%02u,%02u,%02u,%03u,%02u", s + 1,
+					s * 12 + 1, random32() % 90, random32() % 360, 20 + random32() % 30,
+					s * 12 + 4, random32() % 90, random32() % 360, 20 + random32() % 30,
+					s * 12 + 7, random32() % 90, random32() % 360, 20 + random32() % 30,
+					s * 12 + 10, random32() % 90, random32() % 360, 20 + random32() % 30);
+		n += sentence(out + n, "GPRMC,%s,A,%.5f,N,%.5f,W,%.3f,%.1f,171026,,,A", hms,
+				lat, lon, knots, track);
+		n += sentence(out + n, "GPVTG,%.1f,T,,M,%.3f,N,%.3f,K,A", track, knots, knots * 1.852);
+		sec++;
+	}
+	*len = n;
+	return buf;
+}
+
+static void benchNmea(const unsigned char * stream, size_t len) {
+	size_t * lines, nlines, i;
+	struct gps_package fix;
+	NmeaState state;
+	unsigned long fixes = 0;
+	volatile float sink = 0;
+	double best, t;
+	int round;
+
+	lines = splitLines(stream, len, &nlines);
+
+	best = 1e9;
+	for (round = 0; round < BENCH_ROUNDS; round++) {
+		t = now();
+		nmeaInit(&state);
+		fixes = 0;
+		for (i = 0; i < nlines; i++)
+			if (nmeaParse(&state, (const char *) stream + lines[i], lines[i + 1] - lines[i]) == NMEA_OK
+					&& nmeaFix(&state, &fix) == SUCCESS) {
+				sink = fix.lat;
+				fixes++;
+			}
+		t = now() - t;
+		if (t < best)
+			best = t;
+	}
+	(void) sink;
+	printf("%-18s %8.1f MB/s %8.2f ns/line %10zu lines\n", "nmea extract",
+			len / best / 1e6, best * 1e9 / (nlines ? nlines : 1), nlines);
+	printf("%lu sentences used, %lu rejected, %lu whole fixes, %.2f ns and %.0f bytes per fix\n",
+			state.sentences, state.bad, fixes, best * 1e9 / (fixes ? fixes : 1),
+			(double) len / (fixes ? fixes : 1));
+	free(lines);
+}
+
+static void usage(void) {
+	fprintf(stderr, "Usage: bench framer [capture]\n");
+	fprintf(stderr, "       bench batches\n");
+	fprintf(stderr, "       bench crc\n");
+	fprintf(stderr, "       bench blocks\n");
+	fprintf(stderr, "       bench tpv [capture]\n");
+	fprintf(stderr, "       bench nmea [capture]\n");
+	exit(1);
+}
+
+int main(int argc, char ** argv) {
+	unsigned char * stream = NULL;
+	size_t len;
+
+	if (argc < 2)
+		usage();
+
+	if (!strcmp(argv[1], "framer")) {
+		stream = argc > 2 ? loadFile(argv[2], &len) : syntheticFrames(&len);
+		benchFramer(stream, len);
+	}
+	else if (!strcmp(argv[1], "batches"))
+		benchBatches();
+	else if (!strcmp(argv[1], "crc"))
+		benchCrc();
+	else if (!strcmp(argv[1], "blocks"))
+		benchBlocks();
+	else if (!strcmp(argv[1], "tpv")) {
+		stream = argc > 2 ? loadFile(argv[2], &len) : syntheticReports(&len);
+		benchTpv(stream, len);
+	}
+	else if (!strcmp(argv[1], "nmea")) {
+		stream = argc > 2 ? loadFile(argv[2], &len) : syntheticSentences(&len);
+		benchNmea(stream, len);
+		free(stream);
+		/* the same fixes the gpsd way, for comparison */
+		stream = syntheticReports(&len);
+		benchTpv(stream, len);
+	}
+	else
+		usage();
+
+	free(stream);
+	return 0;
+}
@@ -7,8 +7,15 @@
 #include <unistd.h> /* close */
 #include <string.h>
 #include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/timerfd.h>
+#include <linux/sockios.h>
 
 #include "client.h"
+#include "crc32c.h"
 
 
 int clientCall(char * serverName) {
@@ -62,3 +69,514 @@ int clientCall(char * serverName) {
 	return sockfd;
 
 }
+
+static int64_t uplinkNow(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* wall clock time in ms, what v2 batches are stamped with */
+static int64_t uplinkClock(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (int64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* open a v2 batch of flags for the current stream at the tail; there must be room */
+static void uplinkOpen(Uplink * link, uint8_t flags) {
+	link->open.header.protocolId = PROTOCOL;
+	link->open.header.packageId = ++link->sequence;
+	link->open.header.ack = 0;
+	link->open.version = COM_VERSION_2;
+	link->open.flags = flags | COM_BATCH_CRC;
+	link->open.count = 0;
+	link->open.length = 0;
+	link->open.stream = link->stream;
+	link->open.time = uplinkClock();
+	if (link->head == link->tail)
+		link->oldest = uplinkNow();
+	link->batch = link->tail;
+	comEncodeBatch(&link->open, link->buf + link->tail);
+	link->tail += COM_BATCH_SIZE;
+}
+
+/*
+ * Take over a connected socket, making it non-blocking. Frames wait
+ * up to latency ms to be sent together. Version 2 opens with a batch
+ * so the server knows the version before the first fix.
+ */
+void uplinkInit(Uplink * link, int fd, unsigned latency, int version) {
+	int flags = fcntl(fd, F_GETFL);
+
+	if (flags == -1 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1)
+		perror("uplink: fcntl");
+	link->fd = fd;
+	link->latency = latency;
+	link->oldest = 0;
+	link->base = link->head = link->tail = 0;
+	link->baseStream = 0;
+	link->frames = link->writes = link->dropped = 0;
+	link->lagMax = 0;
+	link->stream = 0;	/* where the server starts every connection */
+	link->version = version;
+	link->sequence = 0;
+	link->batch = UPLINK_NO_BATCH;
+	if (version == COM_VERSION_2)
+		uplinkOpen(link, 0);
+}
+
+/*
+ * Close the open v2 batch with the CRC-32C of its header and fixes.
+ * The room for it is kept free while the batch is open.
+ */
+static void uplinkSeal(Uplink * link) {
+	if (link->batch == UPLINK_NO_BATCH)
+		return;
+	comPut32(link->buf + link->tail, crc32c(0, link->buf + link->batch, link->tail - link->batch));
+	link->tail += COM_CRC_SIZE;
+	link->batch = UPLINK_NO_BATCH;
+}
+
+/* where the frame at p ends; only the open v2 batch has no trailer yet */
+static size_t uplinkFrameEnd(const Uplink * link, size_t p) {
+	comBatch batch;
+
+	if (link->version == COM_VERSION_2) {
+		comDecodeBatch(link->buf + p, &batch);
+		return p + COM_BATCH_SIZE + batch.length + (p == link->batch ? 0 : COM_CRC_SIZE);
+	}
+	if (link->buf[p + 1] == BACKFILL_BYTE)
+		return p + 2 + sizeof(struct gps_backfill);
+	if (link->buf[p + 1] == STREAM_BYTE)
+		return p + 2 + sizeof(streamId);
+	return p + 2 + sizeof(struct gps_package);
+}
+
+/* let go of the frames that end by upto */
+static void uplinkRelease(Uplink * link, size_t upto) {
+	size_t end;
+
+	while (link->base < upto && (end = uplinkFrameEnd(link, link->base)) <= upto) {
+		if (link->version != COM_VERSION_2 && link->buf[link->base + 1] == STREAM_BYTE)
+			memcpy(&link->baseStream, link->buf + link->base + 2, sizeof(streamId));
+		link->base = end;
+	}
+}
+
+/* let go of the frames the server acknowledged: the last bytes sent are those the socket still holds */
+static void uplinkAcked(Uplink * link) {
+	int unacked;
+
+	if (ioctl(link->fd, SIOCOUTQ, &unacked) == -1)
+		unacked = 0;
+	if ((size_t) unacked <= link->head)
+		uplinkRelease(link, link->head - (size_t) unacked);
+}
+
+/*
+ * Make room for n more bytes at the tail; false if there is none.
+ * Frames still waiting for an acknowledgement go first.
+ */
+static bool uplinkRoom(Uplink * link, size_t n) {
+	size_t from;
+
+	if (link->tail + n <= UPLINK_BUFFER)
+		return true;
+	uplinkAcked(link);
+	if (link->tail - link->base + n > UPLINK_BUFFER)
+		uplinkRelease(link, link->head);
+	if ((from = link->base) > 0) {
+		memmove(link->buf, link->buf + from, link->tail - from);
+		link->tail -= from;
+		link->head -= from;
+		if (link->batch != UPLINK_NO_BATCH)
+			link->batch -= from;
+		link->base = 0;
+	}
+	return link->tail + n <= UPLINK_BUFFER;
+}
+
+/*
+ * Add a fix to the open v2 batch, opening a new one when the kind of
+ * fix or the stream changes, or it is full. A fix held back for age
+ * ms is stamped that long before its batch was opened.
+ */
+static bool uplinkBatch(Uplink * link, const struct gps_package * fix, uint8_t flags,
+		uint32_t age) {
+	bool sealed = link->batch == UPLINK_NO_BATCH;
+	bool fresh = sealed || (link->open.flags & COM_BATCH_BACKFILL) != flags
+			|| link->open.stream != link->stream || link->open.count == COM_BATCH_MAX;
+	int32_t offset;
+
+	/* the trailer of the batch the fix goes in, and of the one it ends */
+	if (!uplinkRoom(link, (fresh ? (sealed ? 0 : COM_CRC_SIZE) + COM_BATCH_SIZE : 0)
+			+ COM_FIX_SIZE + COM_CRC_SIZE)) {
+		link->dropped++;
+		return false;
+	}
+	if (fresh) {
+		uplinkSeal(link);
+		uplinkOpen(link, flags);
+	}
+	else if (link->head == link->tail)
+		link->oldest = uplinkNow();
+	if (flags & COM_BATCH_BACKFILL)
+		offset = age > INT32_MAX ? INT32_MIN + 1 : -(int32_t) age;
+	else
+		offset = (int32_t) (uplinkClock() - link->open.time);
+	comEncodeFix(fix, offset, link->buf + link->tail);
+	link->tail += COM_FIX_SIZE;
+	link->open.count++;
+	link->open.length += COM_FIX_SIZE;
+	comEncodeBatch(&link->open, link->buf + link->batch);
+	link->frames++;
+	return true;
+}
+
+/*
+ * Queue one frame: delimiter, flag and payload. Frames are never split
+ * in the buffer; when there is no room the frame is dropped and false
+ * returned. Version 2 puts the fix of a GPS_BYTE or BACKFILL_BYTE
+ * frame in a batch instead.
+ */
+bool uplinkQueue(Uplink * link, uint8_t flag, const void * payload, size_t n) {
+	if (link->version == COM_VERSION_2) {
+		const struct gps_backfill * late = (const struct gps_backfill *) payload;
+
+		if (flag == GPS_BYTE)
+			return uplinkBatch(link, (const struct gps_package *) payload, 0, 0);
+		if (flag == BACKFILL_BYTE)
+			return uplinkBatch(link, &late->fix, COM_BATCH_BACKFILL, late->age);
+		return true;	/* nothing else is sent in version 2 */
+	}
+
+	if (!uplinkRoom(link, 2 + n)) {
+		link->dropped++;
+		return false;
+	}
+
+	if (link->head == link->tail)
+		link->oldest = uplinkNow();
+	link->buf[link->tail++] = DELIMITER_BYTE;
+	link->buf[link->tail++] = flag;
+	memcpy(link->buf + link->tail, payload, n);
+	link->tail += n;
+	link->frames++;
+	return true;
+}
+
+/*
+ * The fixes queued from now on come from stream; the server is told
+ * with a STREAM_BYTE frame when it changes, or in version 2 by the
+ * header of the next batch. Returns false if that frame had to be
+ * dropped, and with it the fix.
+ */
+bool uplinkStream(Uplink * link, streamId stream) {
+	if (stream == link->stream)
+		return true;
+	if (link->version == COM_VERSION_2) {
+		link->stream = stream;	/* in the header of the next batch */
+		return true;
+	}
+	if (!uplinkQueue(link, STREAM_BYTE, &stream, sizeof stream))
+		return false;
+	link->stream = stream;
+	return true;
+}
+
+/* ms until queued frames are due, 0 if they are, -1 if nothing is queued */
+int uplinkTimeout(const Uplink * link) {
+	int64_t left;
+
+	if (link->head == link->tail)
+		return -1;
+	left = link->oldest + link->latency - uplinkNow();
+	return left > 0 ? (int) left : 0;
+}
+
+/*
+ * Send what is queued, if it is due or force is set, in one write.
+ * Returns 0, even when the socket took only part of it, or -1 if the
+ * connection is lost.
+ */
+int uplinkFlush(Uplink * link, bool force) {
+	ssize_t rc;
+
+	if (link->head == link->tail || (!force && uplinkTimeout(link) > 0))
+		return 0;
+	/* once its header may be on its way, a batch takes no more fixes */
+	uplinkSeal(link);
+	rc = send(link->fd, link->buf + link->head, link->tail - link->head, MSG_NOSIGNAL);
+	if (rc == -1)
+		return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ? 0 : -1;
+
+	link->writes++;
+	link->head += (size_t) rc;
+	if (link->head == link->tail) {
+		int64_t lag = uplinkLag(link);
+
+		if (lag > link->lagMax)
+			link->lagMax = lag;
+	}
+	uplinkAcked(link);
+	if (link->base == link->tail)
+		link->base = link->head = link->tail = 0;
+	return 0;
+}
+
+/*
+ * The connection is lost: hand every fix of the frames that were not
+ * sent, or not acknowledged when last checked, to requeue and empty
+ * the buffer. Returns how many fixes were handed back. The server may
+ * still have some of them; it stores them as backfill.
+ */
+unsigned long uplinkTakeBack(Uplink * link, uplinkRequeue requeue, void * ctx) {
+	int64_t now = uplinkClock();
+	streamId stream = link->baseStream;
+	struct gps_backfill late;
+	comBatch batch;
+	unsigned long n = 0;
+	size_t p, end, f;
+
+	for (p = link->base; p < link->tail; p = end) {
+		end = uplinkFrameEnd(link, p);
+		if (link->version == COM_VERSION_2) {
+			comDecodeBatch(link->buf + p, &batch);
+			for (f = p + COM_BATCH_SIZE; f < p + COM_BATCH_SIZE + batch.length; f += COM_FIX_SIZE) {
+				int32_t offset = comDecodeFix(link->buf + f, &late.fix);
+
+				requeue(ctx, batch.stream, &late.fix, batch.time + offset);
+				n++;
+			}
+		}
+		else if (link->buf[p + 1] == STREAM_BYTE)
+			memcpy(&stream, link->buf + p + 2, sizeof stream);
+		else if (link->buf[p + 1] == BACKFILL_BYTE) {
+			memcpy(&late, link->buf + p + 2, sizeof late);
+			requeue(ctx, stream, &late.fix, now - late.age);
+			n++;
+		}
+		else {
+			/* queued within the latency window, close enough */
+			memcpy(&late.fix, link->buf + p + 2, sizeof late.fix);
+			requeue(ctx, stream, &late.fix, now);
+			n++;
+		}
+	}
+	link->base = link->head = link->tail = 0;
+	link->batch = UPLINK_NO_BATCH;
+	return n;
+}
+
+/* ms the oldest unsent frame is overdue, 0 if none is */
+int64_t uplinkLag(const Uplink * link) {
+	int64_t lag;
+
+	if (link->head == link->tail)
+		return 0;
+	lag = uplinkNow() - link->oldest - link->latency;
+	return lag > 0 ? lag : 0;
+}
+
+/* arm the timer to fire in ms, then every interval ms; 0 and 0 disarm it */
+static void connectorArm(Connector * c, unsigned ms, unsigned interval) {
+	struct itimerspec its;
+
+	its.it_value.tv_sec = ms / 1000;
+	its.it_value.tv_nsec = (long) (ms % 1000) * 1000000;
+	its.it_interval.tv_sec = interval / 1000;
+	its.it_interval.tv_nsec = (long) (interval % 1000) * 1000000;
+	if (timerfd_settime(c->timerfd, 0, &its, NULL) == -1)
+		perror("client: timerfd");
+}
+
+/* wait before the next round; the wait doubles per failed round, up to CONNECT_BACKOFF_MAX */
+static unsigned connectorRetry(Connector * c) {
+	unsigned delay;
+
+	c->backoff = c->backoff == 0 ? CONNECT_BACKOFF_MIN
+			: c->backoff * 2 > CONNECT_BACKOFF_MAX ? CONNECT_BACKOFF_MAX : c->backoff * 2;
+	/* half of it random, so that a fleet cut off together does not call back in step */
+	delay = c->backoff / 2 + (unsigned) rand_r(&c->seed) % (c->backoff / 2 + 1);
+	c->state = LINK_IDLE;
+	connectorArm(c, delay, 0);
+	return delay;
+}
+
+static void connectorFail(Connector * c) {
+	unsigned delay;
+
+	c->failures++;
+	/* look the name up again next round, the server may have moved */
+	c->resolved = 0;
+	delay = connectorRetry(c);
+	fprintf(stderr, "client: cannot reach %s, retrying in %u ms\n", c->host, delay);
+}
+
+static void connectorUp(Connector * c) {
+	char s[INET6_ADDRSTRLEN];
+
+	c->state = LINK_UP;
+	c->backoff = 0;
+	connectorArm(c, 0, 0);
+	inet_ntop(c->addrs[c->next - 1].ss_family,
+			get_in_addr((struct sockaddr *) &c->addrs[c->next - 1]), s, sizeof s);
+	fprintf(stderr, "client: connected to %s\n", s);
+}
+
+/* connect to the next cached address; a round out of addresses failed */
+static void connectorNext(Connector * c) {
+	int fd;
+
+	while (c->next < c->naddrs) {
+		const struct sockaddr_storage * addr = &c->addrs[c->next];
+		socklen_t len = c->lens[c->next++];
+
+		fd = socket(addr->ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+		if (fd == -1)
+			continue;
+		c->attempts++;
+		if (connect(fd, (const struct sockaddr *) addr, len) == 0) {
+			c->fd = fd;
+			connectorUp(c);
+			return;
+		}
+		if (errno == EINPROGRESS) {
+			c->fd = fd;
+			c->state = LINK_CONNECTING;
+			connectorArm(c, CONNECT_TIMEOUT, 0);
+			return;
+		}
+		close(fd);
+	}
+	connectorFail(c);
+}
+
+/* the lookup may have finished */
+static void connectorResolved(Connector * c) {
+	struct addrinfo * p;
+	int rc = gai_error(&c->lookup);
+
+	if (rc == EAI_INPROGRESS)
+		return;
+	connectorArm(c, 0, 0);
+	if (rc != 0) {
+		fprintf(stderr, "client: %s: %s\n", c->host, gai_strerror(rc));
+		/* the addresses of the last good lookup beat none */
+		c->next = 0;
+		if (c->naddrs > 0)
+			connectorNext(c);
+		else
+			connectorFail(c);
+		return;
+	}
+
+	c->naddrs = 0;
+	for (p = c->lookup.ar_result; p != NULL && c->naddrs < CONNECT_ADDRS; p = p->ai_next)
+		if (p->ai_addrlen <= sizeof(struct sockaddr_storage)) {
+			memcpy(&c->addrs[c->naddrs], p->ai_addr, p->ai_addrlen);
+			c->lens[c->naddrs++] = p->ai_addrlen;
+		}
+	freeaddrinfo(c->lookup.ar_result);
+	c->lookup.ar_result = NULL;
+	c->resolved = uplinkNow();
+	c->next = 0;
+	connectorNext(c);
+}
+
+/*
+ * Set up a connector for host and port; nothing happens until
+ * connectorStart(). Returns 0, -1 if there is no timer for it.
+ */
+int connectorInit(Connector * c, const char * host, const char * port) {
+	memset(c, 0, sizeof(Connector));
+	c->host = host;
+	c->port = port;
+	c->state = LINK_IDLE;
+	c->fd = -1;
+	c->hints.ai_family = AF_UNSPEC;
+	c->hints.ai_socktype = SOCK_STREAM;
+	c->seed = (unsigned) time(NULL) ^ (unsigned) getpid();
+	if ((c->timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) == -1) {
+		perror("client: timerfd");
+		return -1;
+	}
+	return 0;
+}
+
+/* Start a round of attempts now, looking the name up first unless cached */
+void connectorStart(Connector * c) {
+	struct gaicb * list[1] = { &c->lookup };
+
+	if (c->naddrs > 0 && c->resolved != 0 && uplinkNow() - c->resolved < CONNECT_DNS_TTL) {
+		c->next = 0;
+		connectorNext(c);
+		return;
+	}
+	c->lookup.ar_name = c->host;
+	c->lookup.ar_service = c->port;
+	c->lookup.ar_request = &c->hints;
+	c->lookup.ar_result = NULL;
+	if (getaddrinfo_a(GAI_NOWAIT, list, 1, NULL) != 0) {
+		connectorFail(c);
+		return;
+	}
+	/*
+	 * Polled: a completion signal or thread would be more machinery
+	 * than it saves. Names in /etc/hosts are answered at once, so the
+	 * first check comes early.
+	 */
+	c->state = LINK_RESOLVING;
+	connectorArm(c, 1, CONNECT_POLL);
+}
+
+/*
+ * Advance the connector: timer if its timerfd is readable, writable
+ * if its socket is while connecting. Returns the new state; once it
+ * is LINK_UP, fd is the connected socket.
+ */
+linkState connectorStep(Connector * c, bool timer, bool writable) {
+	uint64_t expirations;
+	socklen_t len = sizeof(int);
+	int err = 0;
+
+	if (timer)
+		timer = read(c->timerfd, &expirations, sizeof expirations) == (ssize_t) sizeof expirations;
+
+	switch (c->state) {
+	case LINK_IDLE:
+		if (timer)
+			connectorStart(c);
+		break;
+	case LINK_RESOLVING:
+		if (timer)
+			connectorResolved(c);
+		break;
+	case LINK_CONNECTING:
+		if (writable && getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len) == 0 && err == 0)
+			connectorUp(c);
+		else if (writable || timer) {
+			/* refused, unreachable or timed out: the next address */
+			close(c->fd);
+			c->fd = -1;
+			connectorNext(c);
+		}
+		break;
+	case LINK_UP:
+		break;
+	}
+	return c->state;
+}
+
+/* The connection broke: close it and call again shortly */
+void connectorLost(Connector * c) {
+	if (c->fd != -1) {
+		close(c->fd);
+		c->fd = -1;
+	}
+	c->backoff = 0;
+	connectorRetry(c);
+}
@@ -10,12 +10,107 @@
 #ifndef CLIENT_H_
 #define CLIENT_H_
 
+#include <stddef.h>
+#include <netdb.h>
+#include <sys/socket.h>
+
 #include "protocol.h"
 
 
 #define CALL_TRIES  3
-#define RETRY_TIMER 10.0
+
+#define UPLINK_BUFFER	4096	/* bytes of frames waiting to be sent */
+
+/*
+ * Send side of the connection to the server. Frames are assembled in
+ * one buffer and go out in a single write, together with any other
+ * frames queued within the latency window. The socket is non-blocking:
+ * what the kernel does not take stays queued for the next flush.
+ * Frames the server has not acknowledged yet are kept while there is
+ * room, so that uplinkTakeBack() can hand them back when the
+ * connection is lost.
+ */
+typedef struct uplink {
+	int fd;
+	unsigned latency;		/* ms a frame may wait for others, 0 to send at once */
+	int64_t oldest;			/* when the first unsent frame was queued, ms */
+	size_t base;			/* first frame not known to be acknowledged */
+	size_t head;			/* next byte to send */
+	size_t tail;			/* next byte to fill */
+	streamId baseStream;	/* v1: the stream in effect at base */
+	unsigned long frames;	/* frames queued */
+	unsigned long writes;	/* writes that sent something */
+	unsigned long dropped;	/* frames turned away by a full buffer */
+	int64_t lagMax;			/* ms a frame waited past its latency to be sent, at worst */
+	streamId stream;		/* of the fixes queued last */
+	int version;			/* COM_VERSION_1 or COM_VERSION_2 */
+	uint32_t sequence;		/* v2: batches queued */
+	size_t batch;			/* v2: where the batch still taking fixes starts, or UPLINK_NO_BATCH */
+	comBatch open;			/* v2: its header */
+	unsigned char buf[UPLINK_BUFFER];
+} Uplink;
+
+#define UPLINK_NO_BATCH	((size_t) -1)
+
+/*
+ * Connection establishment that never blocks the caller. The server
+ * name is resolved in the background and the addresses are kept for
+ * CONNECT_DNS_TTL; connects are non-blocking and tried address by
+ * address. Failed rounds are retried after an exponential backoff
+ * with jitter. All waiting is done on one timerfd, so the connector
+ * lives in the caller's readiness loop: watch timerfd for reading and,
+ * while connecting, fd for writing, then call connectorStep().
+ */
+#define CONNECT_ADDRS		8		/* addresses kept per name */
+#define CONNECT_DNS_TTL		300000	/* ms resolved addresses are trusted */
+#define CONNECT_TIMEOUT		5000	/* ms one connect may take */
+#define CONNECT_BACKOFF_MIN	500		/* ms before the first retry */
+#define CONNECT_BACKOFF_MAX	60000	/* ms retries back off to */
+#define CONNECT_POLL		50		/* ms between checks on a lookup */
+
+typedef enum {
+	LINK_IDLE,				/* waiting for the next attempt */
+	LINK_RESOLVING,			/* name lookup in flight */
+	LINK_CONNECTING,		/* connect in flight */
+	LINK_UP
+} linkState;
+
+typedef struct connector {
+	const char * host;
+	const char * port;
+	linkState state;
+	int fd;					/* socket connecting or connected, else -1 */
+	int timerfd;			/* the next attempt, a timeout or a lookup check */
+	struct sockaddr_storage addrs[CONNECT_ADDRS];
+	socklen_t lens[CONNECT_ADDRS];
+	unsigned naddrs;		/* cached addresses */
+	unsigned next;			/* the one to try next */
+	int64_t resolved;		/* when they were looked up, ms; 0 if never */
+	struct gaicb lookup;	/* getaddrinfo_a() request */
+	struct addrinfo hints;
+	unsigned backoff;		/* ms of the last wait between rounds */
+	unsigned seed;			/* of the jitter */
+	unsigned long attempts;	/* connects tried */
+	unsigned long failures;	/* rounds that failed */
+} Connector;
 
 int clientCall(char * serverName);
 
+int connectorInit(Connector * c, const char * host, const char * port);
+void connectorStart(Connector * c);
+linkState connectorStep(Connector * c, bool timer, bool writable);
+void connectorLost(Connector * c);
+
+void uplinkInit(Uplink * link, int fd, unsigned latency, int version);
+bool uplinkQueue(Uplink * link, uint8_t flag, const void * payload, size_t n);
+bool uplinkStream(Uplink * link, streamId stream);
+int uplinkTimeout(const Uplink * link);
+int64_t uplinkLag(const Uplink * link);
+int uplinkFlush(Uplink * link, bool force);
+
+/* a fix of stream taken at taken, ms since the epoch, that may not have reached the server */
+typedef void (*uplinkRequeue)(void * ctx, streamId stream, const struct gps_package * fix,
+		int64_t taken);
+unsigned long uplinkTakeBack(Uplink * link, uplinkRequeue requeue, void * ctx);
+
 #endif /* CLIENT_H_ */
@@ -0,0 +1,194 @@
+/*
+ * crc32c.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: yiding
+ */
+
+#include <string.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define CRC32C_X86 1
+#endif
+
+#include "crc32c.h"
+
+#define CRC32C_POLY 0x82F63B78		/* reflected */
+#define CRC32C_LANE	128				/* bytes per lane of the interleaved crc32 loop */
+
+typedef uint32_t (*crcFunc)(uint32_t crc, const unsigned char * p, size_t n);
+
+static uint32_t crcTable[8][256];
+static uint32_t crcShift[4][256];	/* a CRC carried over CRC32C_LANE zero bytes */
+static uint32_t crcLaneK;			/* the same as one carry-less factor, see crcClmulShift() */
+
+static void crcTableInit(void) {
+	uint32_t c, basis[32];
+	int i, j;
+
+	for (i = 0; i < 256; i++) {
+		c = (uint32_t) i;
+		for (j = 0; j < 8; j++)
+			c = c & 1 ? (c >> 1) ^ CRC32C_POLY : c >> 1;
+		crcTable[0][i] = c;
+	}
+	for (i = 0; i < 256; i++)
+		for (j = 1; j < 8; j++)
+			crcTable[j][i] = (crcTable[j - 1][i] >> 8) ^ crcTable[0][crcTable[j - 1][i] & 0xFF];
+
+	/* the shift is linear: one bit at a time, then every byte value */
+	for (i = 0; i < 32; i++) {
+		c = (uint32_t) 1 << i;
+		for (j = 0; j < CRC32C_LANE; j++)
+			c = (c >> 8) ^ crcTable[0][c & 0xFF];
+		basis[i] = c;
+	}
+	for (i = 0; i < 4; i++)
+		for (j = 0; j < 256; j++) {
+			int b;
+
+			for (c = 0, b = 0; b < 8; b++)
+				if (j & (1 << b))
+					c ^= basis[i * 8 + b];
+			crcShift[i][j] = c;
+		}
+	/* the product is 64 bits, which the crc32 that reduces it carries over 8 more bytes */
+	for (c = 1, j = 0; j < CRC32C_LANE - 8; j++)
+		c = (c >> 8) ^ crcTable[0][c & 0xFF];
+	crcLaneK = c;
+}
+
+static uint32_t crcLaneShift(uint32_t crc) {
+	return crcShift[0][crc & 0xFF] ^ crcShift[1][(crc >> 8) & 0xFF]
+			^ crcShift[2][(crc >> 16) & 0xFF] ^ crcShift[3][crc >> 24];
+}
+
+/* eight bytes per step through eight tables */
+static uint32_t crcSlice8(uint32_t crc, const unsigned char * p, size_t n) {
+	while (n >= 8) {
+		uint32_t lo = crc ^ ((uint32_t) p[0] | (uint32_t) p[1] << 8
+				| (uint32_t) p[2] << 16 | (uint32_t) p[3] << 24);
+
+		crc = crcTable[7][lo & 0xFF] ^ crcTable[6][(lo >> 8) & 0xFF]
+				^ crcTable[5][(lo >> 16) & 0xFF] ^ crcTable[4][lo >> 24]
+				^ crcTable[3][p[4]] ^ crcTable[2][p[5]] ^ crcTable[1][p[6]] ^ crcTable[0][p[7]];
+		p += 8;
+		n -= 8;
+	}
+	while (n--)
+		crc = (crc >> 8) ^ crcTable[0][(crc ^ *p++) & 0xFF];
+	return crc;
+}
+
+#ifdef CRC32C_X86
+/*
+ * crcLaneShift() in registers: a multiply and a crc32 instead of four
+ * table loads, which miss the cache when checks are far apart, as
+ * they are between the reads of a server.
+ */
+__attribute__((target("sse4.2,pclmul")))
+static uint32_t crcClmulShift(uint32_t crc) {
+	__m128i product = _mm_clmulepi64_si128(_mm_cvtsi32_si128((int) crc),
+			_mm_cvtsi32_si128((int) crcLaneK), 0);
+
+	return (uint32_t) _mm_crc32_u64(0, (uint64_t) _mm_cvtsi128_si64(product));
+}
+
+/*
+ * crc32 takes three cycles but a new one can start every cycle: three
+ * lanes of CRC32C_LANE bytes are run side by side, the first from crc
+ * and the others from 0, and joined by carrying each over the next
+ * with shift. Inlined into each caller, so shift is a direct call.
+ */
+__attribute__((target("sse4.2"), always_inline))
+static inline uint32_t crcLanes(uint32_t crc, const unsigned char * p, size_t n,
+		uint32_t (*shift)(uint32_t)) {
+	uint64_t c = crc;
+
+	while (n >= 3 * CRC32C_LANE) {
+		uint64_t b = 0, d = 0;
+		int i;
+
+		for (i = 0; i < CRC32C_LANE; i += 8) {
+			uint64_t v[3];
+
+			memcpy(&v[0], p + i, 8);
+			memcpy(&v[1], p + CRC32C_LANE + i, 8);
+			memcpy(&v[2], p + 2 * CRC32C_LANE + i, 8);
+			c = _mm_crc32_u64(c, v[0]);
+			b = _mm_crc32_u64(b, v[1]);
+			d = _mm_crc32_u64(d, v[2]);
+		}
+		c = shift(shift((uint32_t) c) ^ (uint32_t) b) ^ (uint32_t) d;
+		p += 3 * CRC32C_LANE;
+		n -= 3 * CRC32C_LANE;
+	}
+
+	while (n >= 8) {
+		uint64_t v;
+
+		memcpy(&v, p, sizeof v);
+		c = _mm_crc32_u64(c, v);
+		p += 8;
+		n -= 8;
+	}
+	crc = (uint32_t) c;
+	while (n--)
+		crc = _mm_crc32_u8(crc, *p++);
+	return crc;
+}
+
+__attribute__((target("sse4.2")))
+static uint32_t crcSSE42(uint32_t crc, const unsigned char * p, size_t n) {
+	return crcLanes(crc, p, n, crcLaneShift);
+}
+
+__attribute__((target("sse4.2,pclmul")))
+static uint32_t crcSSE42Clmul(uint32_t crc, const unsigned char * p, size_t n) {
+	return crcLanes(crc, p, n, crcClmulShift);
+}
+#endif
+
+static uint32_t crcDetect(uint32_t crc, const unsigned char * p, size_t n);
+
+static crcFunc crcUpdate = crcDetect;
+
+/*
+ * Choose the implementation. CRC32C_AUTO takes the crc32 instruction
+ * where the CPU has it; asking for it where it has not falls back to
+ * the table. Returns the name of the implementation in use.
+ */
+const char * crc32cSelect(crc32cImpl impl) {
+	crcTableInit();
+#ifdef CRC32C_X86
+	__builtin_cpu_init();
+	if (impl != CRC32C_TABLE && __builtin_cpu_supports("sse4.2")
+			&& __builtin_cpu_supports("pclmul")) {
+		__atomic_store_n(&crcUpdate, crcSSE42Clmul, __ATOMIC_RELEASE);
+		return "sse4.2+pclmul";
+	}
+	if (impl != CRC32C_TABLE && __builtin_cpu_supports("sse4.2")) {
+		__atomic_store_n(&crcUpdate, crcSSE42, __ATOMIC_RELEASE);
+		return "sse4.2";
+	}
+#endif
+	(void) impl;
+	__atomic_store_n(&crcUpdate, crcSlice8, __ATOMIC_RELEASE);
+	return "table";
+}
+
+/* the first call, for programs that never select */
+static uint32_t crcDetect(uint32_t crc, const unsigned char * p, size_t n) {
+	crc32cSelect(CRC32C_AUTO);
+	return __atomic_load_n(&crcUpdate, __ATOMIC_ACQUIRE)(crc, p, n);
+}
+
+/*
+ * CRC-32C of n bytes, continuing from crc: 0 to start, the result of
+ * the previous call to carry on over the next piece.
+ */
+uint32_t crc32c(uint32_t crc, const void * buf, size_t n) {
+	crcFunc update = __atomic_load_n(&crcUpdate, __ATOMIC_ACQUIRE);
+
+	return ~update(~crc, (const unsigned char *) buf, n);
+}
@@ -0,0 +1,30 @@
+/*
+ * crc32c.h
+ *
+ * CRC-32C (Castagnoli), the checksum of the GPS stream and of the
+ * track store checkpoint. x86-64 CPUs with SSE4.2 compute it with the
+ * crc32 instruction, joining interleaved runs of it with PCLMUL where
+ * they have that too; the others use a slicing-by-8 table.
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: yiding
+ */
+
+#ifndef CRC32C_H_
+#define CRC32C_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* implementations, the first call picks CRC32C_AUTO unless one was selected */
+typedef enum {
+	CRC32C_AUTO,
+	CRC32C_TABLE,
+	CRC32C_SSE42
+} crc32cImpl;
+
+const char * crc32cSelect(crc32cImpl impl);
+
+uint32_t crc32c(uint32_t crc, const void * buf, size_t n);
+
+#endif /* CRC32C_H_ */
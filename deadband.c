@@ -0,0 +1,71 @@
+/*
+ * deadband.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: yiding
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include "deadband.h"
+
+#define EARTH_RADIUS	6371008.8	/* m, mean */
+#define RADIANS(d)		((d) * M_PI / 180)
+
+/* m between two fixes; flat earth is plenty over a dead band */
+static double deadbandDistance(const struct gps_package * a, const struct gps_package * b) {
+	double dy = RADIANS((double) b->lat - a->lat);
+	double dx = RADIANS((double) b->lon - a->lon) * cos(RADIANS(((double) a->lat + b->lat) / 2));
+
+	return EARTH_RADIUS * sqrt(dx * dx + dy * dy);
+}
+
+/* degrees between two headings, 0 to 180 */
+static double deadbandTurn(double a, double b) {
+	double d = fmod(fabs(a - b), 360);
+
+	return d > 180 ? 360 - d : d;
+}
+
+/*
+ * Set up the thresholds: distance in m, heading in degrees, speed in
+ * m/s, silence in ms. A threshold of 0 sends every fix.
+ */
+void deadbandInit(Deadband * band, double distance, double heading, double speed, unsigned silence) {
+	memset(band, 0, sizeof(Deadband));
+	band->distance = distance;
+	band->heading = heading;
+	band->speed = speed;
+	band->silence = silence;
+}
+
+/*
+ * Whether fix, taken at now ms, is to be sent. It then becomes the
+ * one the next fixes are compared with.
+ */
+bool deadbandPass(Deadband * band, const struct gps_package * fix, int64_t now) {
+	const struct gps_package * last = &band->last;
+	double reach = band->distance;
+	bool pass;
+
+	/* on a steady course, no more than a fix per DEADBAND_HORIZON */
+	if (fix->speed * (DEADBAND_HORIZON / 1000.0) > reach)
+		reach = fix->speed * (DEADBAND_HORIZON / 1000.0);
+
+	pass = !band->primed
+			|| now - band->sent >= (int64_t) band->silence || now < band->sent
+			|| fabs((double) fix->speed - last->speed) >= band->speed
+			|| (fix->speed >= DEADBAND_CRAWL && last->speed >= DEADBAND_CRAWL
+					&& deadbandTurn(fix->heading, last->heading) >= band->heading)
+			|| deadbandDistance(last, fix) >= reach;
+	if (!pass) {
+		band->suppressed++;
+		return false;
+	}
+	band->primed = true;
+	band->last = *fix;
+	band->sent = now;
+	band->passed++;
+	return true;
+}
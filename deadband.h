@@ -0,0 +1,49 @@
+/*
+ * deadband.h
+ *
+ * Suppression of fixes that tell the server nothing new. A fix is
+ * sent when the vehicle moved, turned or changed speed by more than a
+ * threshold since the last fix sent, and at least every silence ms
+ * so that a parked vehicle is still seen to be alive.
+ *
+ * The distance threshold widens with speed: a vehicle is allowed to
+ * go DEADBAND_HORIZON ms between fixes on a straight road, so the send
+ * interval is the time to cover the dead band at slow speeds and
+ * DEADBAND_HORIZON at speed, with turns and braking still sent at
+ * once.
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: yiding
+ */
+
+#ifndef DEADBAND_H_
+#define DEADBAND_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "global.h"
+
+#define DEADBAND_DISTANCE	10.0	/* m, default */
+#define DEADBAND_HEADING	15.0	/* degrees, default */
+#define DEADBAND_SPEED		2.0		/* m/s, default */
+#define DEADBAND_SILENCE	60000	/* ms, default */
+#define DEADBAND_HORIZON	5000	/* ms a steady course may go unsent */
+#define DEADBAND_CRAWL		1.0		/* m/s below which the heading is noise */
+
+typedef struct deadband {
+	double distance;		/* m */
+	double heading;			/* degrees */
+	double speed;			/* m/s */
+	unsigned silence;		/* ms */
+	bool primed;			/* a fix was sent */
+	struct gps_package last;	/* the last fix sent */
+	int64_t sent;			/* when, ms */
+	unsigned long passed;
+	unsigned long suppressed;
+} Deadband;
+
+void deadbandInit(Deadband * band, double distance, double heading, double speed, unsigned silence);
+bool deadbandPass(Deadband * band, const struct gps_package * fix, int64_t now);
+
+#endif /* DEADBAND_H_ */
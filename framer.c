@@ -0,0 +1,396 @@
+/*
+ * framer.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: yiding
+ */
+
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define FRAMER_X86 1
+#endif
+
+#include "framer.h"
+#include "crc32c.h"
+
+/*
+ * Delimiter scanners: return the offset of the first DELIMITER_BYTE
+ * in p[0..n), or n if there is none. Every frame start is a delimiter,
+ * so one call skips a whole run of noise between frames.
+ */
+typedef size_t (*scanFunc)(const unsigned char * p, size_t n);
+
+static size_t scanScalar(const unsigned char * p, size_t n) {
+	size_t i;
+
+	for (i = 0; i < n; i++)
+		if (p[i] == DELIMITER_BYTE)
+			return i;
+	return n;
+}
+
+#ifdef FRAMER_X86
+__attribute__((target("sse2")))
+static size_t scanSSE2(const unsigned char * p, size_t n) {
+	const __m128i delim = _mm_set1_epi8((char) DELIMITER_BYTE);
+	size_t i = 0;
+
+	for (; i + 16 <= n; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *) (p + i));
+		unsigned mask = (unsigned) _mm_movemask_epi8(_mm_cmpeq_epi8(v, delim));
+		if (mask)
+			return i + (size_t) __builtin_ctz(mask);
+	}
+	return i + scanScalar(p + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static size_t scanAVX2(const unsigned char * p, size_t n) {
+	const __m256i delim = _mm256_set1_epi8((char) DELIMITER_BYTE);
+	size_t i = 0;
+
+	for (; i + 32 <= n; i += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i *) (p + i));
+		unsigned mask = (unsigned) _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, delim));
+		if (mask)
+			return i + (size_t) __builtin_ctz(mask);
+	}
+	return i + scanSSE2(p + i, n - i);
+}
+#endif
+
+static scanFunc scanDelimiter = scanScalar;
+
+/*
+ * Choose the delimiter scanner. FRAMER_SCAN_AUTO takes the widest one
+ * the CPU supports; asking for an unsupported one falls back to scalar.
+ * Returns the name of the scanner in use.
+ */
+const char * framerSelect(framerScan scan) {
+#ifdef FRAMER_X86
+	__builtin_cpu_init();
+	if (scan == FRAMER_SCAN_AUTO)
+		scan = __builtin_cpu_supports("avx2") ? FRAMER_SCAN_AVX2 : FRAMER_SCAN_SSE2;
+	if (scan == FRAMER_SCAN_AVX2 && __builtin_cpu_supports("avx2")) {
+		scanDelimiter = scanAVX2;
+		return "avx2";
+	}
+	if (scan == FRAMER_SCAN_SSE2 && __builtin_cpu_supports("sse2")) {
+		scanDelimiter = scanSSE2;
+		return "sse2";
+	}
+#endif
+	scanDelimiter = scanScalar;
+	return "scalar";
+}
+
+void framerInit(GpsFramer * framer) {
+	framer->head = 0;
+	framer->tail = 0;
+	framer->stream = 0;
+	framer->version = 0;
+	framer->left = 0;
+	framer->flags = 0;
+	framer->time = 0;
+	framer->sequence = 0;
+	framer->batches = 0;
+	framer->rejects = 0;
+	framer->frames = 0;
+	framer->nofix = 0;
+	framer->backfill = 0;
+	framer->skipped = 0;
+	framer->switches = 0;
+}
+
+/*
+ * Largest contiguous free span of the ring; lets a reader fill the
+ * ring in place. Returns its size, 0 when the ring is full.
+ */
+size_t framerSpace(GpsFramer * framer, unsigned char ** span) {
+	uint32_t used = framer->tail - framer->head;
+	uint32_t off = framer->tail & FRAMER_MASK;
+	uint32_t n = FRAMER_SIZE - used;
+
+	if (n > FRAMER_SIZE - off)
+		n = FRAMER_SIZE - off;
+	*span = framer->ring + off;
+	return n;
+}
+
+/* n bytes were written into the span returned by framerSpace() */
+void framerCommit(GpsFramer * framer, size_t n) {
+	framer->tail += (uint32_t) n;
+}
+
+/*
+ * Copy received bytes into the ring.
+ * Returns how many fitted; decode and push the rest again.
+ */
+size_t framerPush(GpsFramer * framer, const void * buf, size_t n) {
+	const unsigned char * src = (const unsigned char *) buf;
+	unsigned char * span;
+	size_t done = 0, len;
+
+	while (done < n && (len = framerSpace(framer, &span)) > 0) {
+		if (len > n - done)
+			len = n - done;
+		memcpy(span, src + done, len);
+		framerCommit(framer, len);
+		done += len;
+	}
+	return done;
+}
+
+/* copy n bytes starting at ring position pos, across the wrap */
+static void framerCopy(const GpsFramer * framer, uint32_t pos, void * dst, size_t n) {
+	uint32_t off = pos & FRAMER_MASK;
+	size_t first = FRAMER_SIZE - off;
+
+	if (first >= n)
+		memcpy(dst, framer->ring + off, n);
+	else {
+		memcpy(dst, framer->ring + off, first);
+		memcpy((unsigned char *) dst + first, framer->ring, n - first);
+	}
+}
+
+/* version 1 frames */
+static int framerDecodeV1(GpsFramer * framer, struct gps_package * out, uint32_t * age, int max) {
+	uint32_t head = framer->head;
+	uint32_t tail = framer->tail;
+	unsigned long skipped = 0;
+	int found = 0;
+
+	while (found < max && head != tail) {
+		const unsigned char * p = framer->ring + (head & FRAMER_MASK);
+		uint32_t span = FRAMER_SIZE - (head & FRAMER_MASK);	/* contiguous bytes */
+		unsigned char type;
+
+		if (span > tail - head)
+			span = tail - head;
+
+		/* back-to-back GPS frames that do not wrap: the common case */
+		while (found < max && span >= GPS_FRAME_SIZE
+				&& p[0] == DELIMITER_BYTE && p[1] == GPS_BYTE) {
+			if (age != NULL)
+				age[found] = 0;
+			memcpy(&out[found++], p + 2, sizeof(struct gps_package));
+			p += GPS_FRAME_SIZE;
+			span -= GPS_FRAME_SIZE;
+			head += GPS_FRAME_SIZE;
+		}
+		if (found == max || head == tail)
+			break;
+
+		if (*p != DELIMITER_BYTE) {
+			size_t skip = span ? scanDelimiter(p, span) : 0;
+			head += (uint32_t) skip;
+			skipped += skip;
+			continue;
+		}
+		if (tail - head < 2)
+			break;		/* need the type byte */
+
+		type = framer->ring[(head + 1) & FRAMER_MASK];
+		if (type == GPS_BYTE) {
+			if (tail - head < GPS_FRAME_SIZE)
+				break;	/* need the rest of the payload */
+			if (age != NULL)
+				age[found] = 0;
+			framerCopy(framer, head + 2, &out[found++], sizeof(struct gps_package));
+			head += GPS_FRAME_SIZE;
+		}
+		else if (type == BACKFILL_BYTE) {
+			struct gps_backfill late;
+
+			if (tail - head < BACKFILL_FRAME_SIZE)
+				break;
+			framerCopy(framer, head + 2, &late, sizeof late);
+			if (age != NULL)
+				age[found] = late.age;
+			out[found++] = late.fix;
+			framer->backfill++;
+			head += BACKFILL_FRAME_SIZE;
+		}
+		else if (type == STREAM_BYTE) {
+			if (found > 0)
+				break;	/* hand over the fixes of the current stream first */
+			if (tail - head < STREAM_FRAME_SIZE)
+				break;
+			framerCopy(framer, head + 2, &framer->stream, sizeof(streamId));
+			framer->switches++;
+			head += STREAM_FRAME_SIZE;
+		}
+		else if (type == NOFIX_BYTE) {
+			framer->nofix++;
+			head += 2;
+		}
+		else {
+			/* not a frame start after all, resynchronise */
+			head++;
+			skipped++;
+		}
+	}
+
+	framer->head = head;
+	framer->frames += (unsigned long) found;
+	framer->skipped += skipped;
+	return found;
+}
+
+/*
+ * Check the batch at head: a version 2 header of at most COM_BATCH_MAX
+ * fixes, with the CRC trailer that holds for header and fixes. Returns
+ * 1 if it does, -1 if not, 0 until the whole batch is buffered. Every
+ * field is taken on trust only after this, the length included.
+ */
+static int framerChecked(const GpsFramer * framer, uint32_t head, const comBatch * batch) {
+	size_t size = COM_BATCH_SIZE + (size_t) batch->length;
+	uint32_t off = head & FRAMER_MASK;
+	unsigned char trailer[COM_CRC_SIZE];
+	uint32_t crc;
+
+	if (batch->version != COM_VERSION_2 || !(batch->flags & COM_BATCH_CRC)
+			|| batch->count > COM_BATCH_MAX
+			|| batch->length != (uint32_t) batch->count * COM_FIX_SIZE)
+		return -1;
+	if (framer->tail - head < size + COM_CRC_SIZE)
+		return 0;
+	if (off + size <= FRAMER_SIZE)
+		crc = crc32c(0, framer->ring + off, size);
+	else {
+		crc = crc32c(0, framer->ring + off, FRAMER_SIZE - off);
+		crc = crc32c(crc, framer->ring, size - (FRAMER_SIZE - off));
+	}
+	framerCopy(framer, head + (uint32_t) size, trailer, COM_CRC_SIZE);
+	return crc == comGet32(trailer) ? 1 : -1;
+}
+
+/*
+ * Version 2 batches. A batch is checked whole before any of its fixes
+ * is handed out; one that fails is dropped and the next is looked for
+ * from the byte after its start, so damage costs one batch at most.
+ */
+static int framerDecodeV2(GpsFramer * framer, struct gps_package * out, uint32_t * age,
+		int64_t * sent, int max) {
+	uint32_t head = framer->head;
+	uint32_t tail = framer->tail;
+	unsigned char raw[COM_BATCH_SIZE];
+	int found = 0;
+
+	while (found < max) {
+		if (framer->left == 0) {
+			comBatch batch;
+			int checked;
+
+			if (tail - head < COM_BATCH_SIZE)
+				break;
+			framerCopy(framer, head, raw, COM_BATCH_SIZE);
+			comDecodeBatch(raw, &batch);
+			if (batch.header.protocolId != PROTOCOL) {
+				/* lost track of the batches, look for the next one */
+				head++;
+				framer->skipped++;
+				continue;
+			}
+			if (batch.stream != framer->stream && found > 0)
+				break;	/* hand over the fixes of the current stream first */
+			if ((checked = framerChecked(framer, head, &batch)) == 0)
+				break;
+			if (checked < 0) {
+				framer->rejects++;
+				head++;
+				framer->skipped++;
+				continue;
+			}
+			head += COM_BATCH_SIZE;
+			framer->batches++;
+			framer->sequence = batch.header.packageId;
+			if (batch.stream != framer->stream) {
+				framer->stream = batch.stream;
+				framer->switches++;
+			}
+			framer->left = batch.count;
+			framer->flags = batch.flags;
+			framer->time = batch.time;
+			if (framer->left == 0)
+				head += COM_CRC_SIZE;
+		}
+		else {
+			const unsigned char * p = framer->ring + (head & FRAMER_MASK);
+			int32_t offset;
+
+			/* checked already, the whole batch is in */
+			if (FRAMER_SIZE - (head & FRAMER_MASK) < COM_FIX_SIZE) {
+				framerCopy(framer, head, raw, COM_FIX_SIZE);
+				p = raw;
+			}
+			offset = comDecodeFix(p, &out[found]);
+			if (sent != NULL)
+				sent[found] = framer->time + offset;
+			if (age != NULL)
+				age[found] = 0;
+			if (framer->flags & COM_BATCH_BACKFILL) {
+				/* taken before the batch was opened; 0 would read as a live fix */
+				if (age != NULL)
+					age[found] = offset < -1 ? (uint32_t) -(int64_t) offset : 1;
+				framer->backfill++;
+			}
+			found++;
+			head += COM_FIX_SIZE;
+			if (--framer->left == 0)
+				head += COM_CRC_SIZE;
+		}
+	}
+
+	framer->head = head;
+	framer->frames += (unsigned long) found;
+	return found;
+}
+
+/*
+ * Tell the version from the first bytes: a version 2 batch starts
+ * with PROTOCOL, anything else is read as version 1, which skips
+ * noise. Returns 0 while too few bytes are in to tell.
+ */
+static int framerDetect(GpsFramer * framer) {
+	unsigned char first[4], magic[4];
+	uint32_t n = framer->tail - framer->head;
+
+	if (n == 0)
+		return 0;
+	if (n > sizeof first)
+		n = sizeof first;
+	framerCopy(framer, framer->head, first, n);
+	comPut32(magic, PROTOCOL);
+	if (memcmp(first, magic, n) != 0)
+		framer->version = COM_VERSION_1;
+	else if (n == sizeof first)
+		framer->version = COM_VERSION_2;
+	return framer->version;
+}
+
+/*
+ * Decode up to max complete GPS records from the buffered bytes.
+ * Returns the number written to out; an incomplete trailing frame
+ * stays buffered until more bytes are pushed. age[i], if age is not
+ * NULL, is how old out[i] was when sent in ms: 0 but for backfill.
+ * sent[i], if sent is not NULL, is when out[i] was taken in ms since
+ * the epoch by the sender's clock; version 1 does not tell, it is 0.
+ * All the records of one call come from framer->stream; decoding
+ * stops before a frame that switches to another.
+ */
+int framerDecode(GpsFramer * framer, struct gps_package * out, uint32_t * age, int64_t * sent,
+		int max) {
+	int n, i;
+
+	if (framer->version == 0 && framerDetect(framer) == 0)
+		return 0;
+	if (framer->version == COM_VERSION_2)
+		return framerDecodeV2(framer, out, age, sent, max);
+	n = framerDecodeV1(framer, out, age, max);
+	for (i = 0; sent != NULL && i < n; i++)
+		sent[i] = 0;
+	return n;
+}
@@ -0,0 +1,70 @@
+/*
+ * framer.h
+ *
+ * Resumable decoder for the 0xFE-framed GPS stream. Each connection
+ * owns one framer; bytes go in as they arrive, in pieces of any size,
+ * and complete gps_package records come out. Partial frames are kept
+ * across calls. The framer never touches a descriptor, so it works
+ * behind any I/O backend. A connection speaks version 1 (0xFE frames)
+ * or version 2 (batches, see protocol.h); the framer tells which from
+ * its first bytes and sticks to it.
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: yiding
+ */
+
+#ifndef FRAMER_H_
+#define FRAMER_H_
+
+#include <stddef.h>
+
+#include "global.h"
+#include "protocol.h"
+
+#define FRAMER_SIZE	4096		/* ring buffer size, a power of 2: one read takes several batches */
+#define FRAMER_MASK	(FRAMER_SIZE - 1)
+
+/*                     DELIMITER         TYPE              GPS DATA */
+#define GPS_FRAME_SIZE (sizeof(uint8_t) + sizeof(uint8_t) + sizeof(struct gps_package))
+#define BACKFILL_FRAME_SIZE (sizeof(uint8_t) + sizeof(uint8_t) + sizeof(struct gps_backfill))
+#define STREAM_FRAME_SIZE (sizeof(uint8_t) + sizeof(uint8_t) + sizeof(streamId))
+
+typedef struct gpsFramer {
+	unsigned char ring[FRAMER_SIZE];
+	uint32_t head;				/* next byte to decode */
+	uint32_t tail;				/* next byte to fill */
+	streamId stream;			/* of the fixes decoded last */
+	int version;				/* COM_VERSION_1 or 2, 0 until the first bytes tell */
+	uint32_t left;				/* v2: fixes of the current batch still to decode */
+	uint8_t flags;				/* v2: of the current batch */
+	int64_t time;				/* v2: when the current batch was opened, sender's clock */
+	uint32_t sequence;			/* v2: packageId of the current batch */
+	unsigned long batches;		/* v2 batches seen */
+	unsigned long rejects;		/* v2 batches dropped: bad header or CRC */
+	unsigned long frames;		/* GPS frames decoded */
+	unsigned long nofix;		/* no-fix frames seen */
+	unsigned long backfill;		/* of the GPS frames, fixes sent late */
+	unsigned long skipped;		/* bytes skipped to find a delimiter */
+	unsigned long switches;		/* stream frames seen */
+} GpsFramer;
+
+/* delimiter scanners, pick one at startup before any framer is used */
+typedef enum {
+	FRAMER_SCAN_AUTO,
+	FRAMER_SCAN_SCALAR,
+	FRAMER_SCAN_SSE2,
+	FRAMER_SCAN_AVX2
+} framerScan;
+
+const char * framerSelect(framerScan scan);
+
+void framerInit(GpsFramer * framer);
+
+size_t framerSpace(GpsFramer * framer, unsigned char ** span);
+void framerCommit(GpsFramer * framer, size_t n);
+size_t framerPush(GpsFramer * framer, const void * buf, size_t n);
+
+int framerDecode(GpsFramer * framer, struct gps_package * out, uint32_t * age, int64_t * sent,
+		int max);
+
+#endif /* FRAMER_H_ */
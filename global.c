@@ -6,6 +6,7 @@
  */
 
 #include "global.h"
+#include "crc32c.h"
 
 void *get_in_addr(struct sockaddr *sa)
 {
@@ -16,12 +17,7 @@ void *get_in_addr(struct sockaddr *sa)
     return &(((struct sockaddr_in6*)sa)->sin6_addr);
 }
 
+/* CRC-32C of n bytes */
 CheckSum_t ChecksumCalculator(const void * buf, size_t n) {
-	CheckSum_t checksum = 0;
-	unsigned i;
-	for (i = 0; i < n; i++) {
-		checksum += *(((uint8_t *)buf) + i);
-	}
-	//printf("checksum %u\n", checksum);
-	return checksum;
+	return crc32c(0, buf, n);
 }
@@ -12,10 +12,10 @@
 #include <stdio.h>
 #include <arpa/inet.h>
 
-/* socket port and max message length */
+/* socket port, max message length and default pending connection queue */
 #define SERVER_PORT "3412"
 #define MAX_MSG 1024
-#define BACKLOG 5
+#define BACKLOG 1024
 
 /*
  * Data transfer Protocol
@@ -35,6 +35,25 @@ struct gps_package {
 #define DELIMITER_BYTE  0xFE
 #define NOFIX_BYTE		0x23
 #define GPS_BYTE		0x34
+#define BACKFILL_BYTE	0x42
+#define STREAM_BYTE		0x53
+
+/*
+ * Payload of a BACKFILL_BYTE frame: a fix held back while the uplink
+ * was down, sent late. age is how long ago it was taken, in ms at the
+ * time it is sent, so the two clocks need not agree.
+ */
+struct gps_backfill {
+    struct gps_package fix;
+    uint32_t age;
+};
+
+/*
+ * Payload of a STREAM_BYTE frame: the fixes that follow it, up to the
+ * next STREAM_BYTE frame, come from this source of a gateway. Every
+ * connection starts on stream 0, the sender itself.
+ */
+typedef uint32_t streamId;
 
 
 typedef uint32_t CheckSum_t;
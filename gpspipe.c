@@ -16,6 +16,13 @@
  * This will dump the GPSD and the NMEA sentences from gpsd to stdout
  *      gpspipe -wr
  *
+ * This will read the NMEA sentences of a receiver without gpsd
+ *      gpspipe -N /dev/ttyUSB0:9600
+ *
+ * This will send the fixes of two gpsd instances to one server, over
+ * one connection
+ *      gpspipe -w -S server localhost:2947 localhost:2948
+ *
  * Original code by: Gary E. Miller <gem@rellim.com>.  Cleanup by ESR.
  *
  * This file is Copyright (c) 2010 by the GPSD project
@@ -38,6 +45,8 @@
 #include <termios.h>
 #include <time.h>
 #include <sys/time.h>
+#include <signal.h>
+#include <sys/signalfd.h>
 #ifndef S_SPLINT_S
 #include <unistd.h>
 #endif /* S_SPLINT_S */
@@ -46,102 +55,351 @@
 #include "gpsdclient.h"
 #include "revision.h"
 #include "client.h"
+#include "tpv.h"
+#include "spool.h"
+#include "reactor.h"
+#include "sink.h"
+#include "nmea.h"
+#include "deadband.h"
 
-static struct gps_data_t gpsdata;
 static void spinner(unsigned int, unsigned int);
 
 /* NMEA-0183 standard baud rate */
 #define BAUDRATE B4800
+/* what receivers read with -N mostly run at */
+#define RECEIVER_SPEED 9600
+/* gpsd instances one gateway reads */
+#define MAX_SOURCES 16
+/* longest line collected for parsing; gpsd reports are shorter */
+#define SOURCE_LINE 4096
+
+/*
+ * One gpsd, or the receiver of -N. A gateway reads several and sends
+ * the fixes of each as its own stream over the one uplink.
+ */
+typedef struct source {
+	struct fixsource_t spec;
+	struct gps_data_t gpsdata;
+	streamId stream;		/* 0 but in a gateway */
+	reactorEvent ev;
+	uint32_t ready;			/* what its descriptor became ready for */
+	char line[SOURCE_LINE];	/* the line being read */
+	size_t len;
+	bool overlong;			/* longer than line: passed on, not parsed */
+	bool newLine;			/* the next byte read starts a line */
+	Deadband band;			/* -m: fixes held back for telling nothing new */
+} Source;
 
 /* Serial port variables */
 static struct termios oldtio, newtio;
 static int fd_out = 1;		/* output initially goes to standard output */
-static char serbuf[MAX_MSG];
 static int debug;
-
-#include <yajl/yajl_tree.h>
+static Uplink uplink;		/* send buffer of the server connection */
+static Spool spool;			/* fixes held back while the uplink is down */
+static bool spooling;		/* -q given */
+static const char * spoolPath;
+static Connector conn;		/* calls the server */
+static bool connectionAlive;
+static AmbleReactor * reactor;
+static Sink out;			/* -o file or stdout */
+static Sink serial;			/* -s port */
+/* what each descriptor became ready for during the last poll */
+static reactorEvent timerEvent, linkEvent, sigEvent;
+static uint32_t timerReady, linkReady, sigReady;
+static Source sources[MAX_SOURCES];
+static int nsources;
+static bool gateway;		/* more than one source */
+static NmeaState nmea;		/* -N: the fix being read off the receiver */
+static bool suppress;		/* -m */
+static bool timestamp;		/* -t */
+static const char * format = "%c";
+static bool lowLatency;		/* -u */
+static long count = -1;		/* -n */
+static bool usesocket;		/* -S */
+static char * serialport;	/* -s */
+static char * receiver;		/* -N */
 
 /*
  * Parse the json package
  * @params:
- * buffer	:	pointer to a null terminated string
+ * buffer	:	pointer to the report, one line
+ * n		:	its length
  * data		:	pointer to a structure for GPS data
  */
-static int parse_gps_json(const char * buffer, struct gps_package * data) {
-    yajl_val node;
-    char errbuf[1024];
-
-    /* null plug buffers */
-    errbuf[0] = 0;
-
-    /* we have the whole config file in memory.  let's parse it ... */
-    node = yajl_tree_parse((const char *) buffer, errbuf, sizeof(errbuf));
-
-    /* parse error handling */
-    /*if (node == NULL) {
-        fprintf(stderr, "parse_error: ");
-        if (strlen(errbuf)) fprintf(stderr, " %s", errbuf);
-        else fprintf(stderr, "unknown error");
-        fprintf(stderr, "\n");
-        return 0;
-    }*/
-
-    /* ... and extract a nested value from the json file */
-    if (node != NULL)
-    {
-        const char * lat_path[] = { "lat", (const char *) 0 };
-        const char * lon_path[] = { "lon", (const char *) 0 };
-        const char * alt_path[] = { "alt", (const char *) 0 };
-        const char * track_path[] = { "track", (const char *) 0 };
-        const char * speed_path[] = { "speed", (const char *) 0 };
-
-        yajl_val lat = yajl_tree_get(node, lat_path, yajl_t_number);
-        yajl_val lon = yajl_tree_get(node, lon_path, yajl_t_number);
-        yajl_val alt = yajl_tree_get(node, alt_path, yajl_t_number);
-        yajl_val track = yajl_tree_get(node, track_path, yajl_t_number);
-        yajl_val speed = yajl_tree_get(node, speed_path, yajl_t_number);
-
-        if (lat) data->lat = YAJL_GET_DOUBLE(lat);
-        else return ERROR;
-        if (lon) data->lon = YAJL_GET_DOUBLE(lon);
-        else return ERROR;
-        if (alt) data->alt = YAJL_GET_DOUBLE(alt);
-        else return ERROR;
-        if (track) data->heading = YAJL_GET_DOUBLE(track);
-        else return ERROR;
-        if (speed) data->speed = YAJL_GET_DOUBLE(speed);
-        else return ERROR;
-    }
-    else
-    	return ERROR;
+static int parse_gps_json(const char * buffer, size_t n, struct gps_package * data) {
+	TpvReport report;
+
+	/* SKY, DEVICE and the other classes are dropped at their class member */
+	if (tpvParse(buffer, n, &report) != TPV_OK)
+		return ERROR;
+	return tpvFix(&report, data);
+}
+
+/*
+ * Parse an NMEA sentence read straight off the receiver
+ * @params:
+ * buffer	:	pointer to the sentence, one line
+ * n		:	its length
+ * data		:	filled once the sentences of a fix add up to one
+ */
+static int parse_nmea(const char * buffer, size_t n, struct gps_package * data) {
+	if (nmeaParse(&nmea, buffer, n) != NMEA_OK)
+		return ERROR;
+	return nmeaFix(&nmea, data);
+}
+
+/*
+ * Queue a gps package of stream for the server; the main loop sends
+ * the queued frames in one write once they are due. Returns false if
+ * the frame had to be dropped.
+ */
+static bool SendGPSPackage(Uplink * link, streamId stream, const void *buf, size_t n,
+		uint8_t flag) {
+	return uplinkStream(link, stream) && uplinkQueue(link, flag, buf, n);
+}
+
+/* wall clock time in ms */
+static int64_t wallclock(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (int64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/*
+ * Queue spooled fixes as backfill, at most rate per second, between
+ * the live ones. Unused allowance carries over for up to a second.
+ */
+static void backfill(unsigned rate) {
+	static int64_t last;
+	static double allowance;
+	int64_t now = wallclock();
+	const SpoolSlot * slot;
+	struct gps_backfill late;
+
+	allowance += (double) (now - last) * rate / 1000;
+	if (last == 0 || allowance > rate)
+		allowance = rate;
+	last = now;
+
+	/* at most half the buffer: the live fixes come first */
+	while (allowance >= 1 && uplink.tail - uplink.head < UPLINK_BUFFER / 2
+			&& (slot = spoolPeek(&spool)) != NULL) {
+		late.fix = slot->fix;
+		/* 0 would read as a live fix */
+		late.age = now - slot->taken > 1 ? (uint32_t) (now - slot->taken) : 1;
+		if (!SendGPSPackage(&uplink, spoolStream(slot), &late, sizeof late, BACKFILL_BYTE))
+			break;
+		spoolPop(&spool);
+		allowance--;
+		if (spoolDepth(&spool) == 0)
+			fprintf(stderr, "gpspipe: backfill done, %llu fixes dropped while offline\n",
+					(unsigned long long) spool.header->dropped);
+	}
+}
+
+/*
+ * The -t prefix of lines read at now; localtime() and strftime() only
+ * run when the second changes.
+ */
+static size_t stampFor(time_t now, const char * format, const char ** prefix) {
+	static time_t cached = (time_t) -1;
+	static char stamp[200 + 2];
+	static size_t len;
+
+	if (now != cached) {
+		char tmstr[200];
+		struct tm tm;
+
+		(void) localtime_r(&now, &tm);
+		(void) strftime(tmstr, sizeof(tmstr), format, &tm);
+		len = (size_t) snprintf(stamp, sizeof stamp, "%.24s :", tmstr);
+		cached = now;
+	}
+	*prefix = stamp;
+	return len;
+}
+
+/* note what a descriptor is ready for; the main loop acts on it */
+static void ready(reactorEvent * ev, uint32_t events) {
+	*(uint32_t *) ev->ctx |= events;
+}
 
-    yajl_tree_free(node);
+static void watchReady(reactorEvent * ev, int fd, uint32_t * ready_events, uint32_t events) {
+	ev->fd = fd;
+	ev->handler = ready;
+	ev->ctx = ready_events;
+	if (reactorAdd(reactor, ev, events) == -1) {
+		perror("gpspipe: epoll_ctl");
+		exit(1);
+	}
+}
 
-    return SUCCESS;
+static void respool(void * ctx, streamId stream, const struct gps_package * fix, int64_t taken) {
+	spoolPush(&spool, fix, stream, taken);
 }
 
-static bool SendGPSPackage(int fd, const void *buf, size_t n, uint8_t flag) {
-	/* send gps package */
-    uint8_t header = DELIMITER_BYTE;
-	if (write(fd, &header, sizeof(uint8_t)) == -1) {
-		fprintf(stderr, "gpspipe: Socket write Error, %s(%d)\n", strerror(errno), errno);
-		return false;
+/*
+ * The server is gone: keep the fixes aside, if asked to, those it may
+ * not have received included, and call again
+ */
+static void uplinkLost(const char * why, int err) {
+	fprintf(stderr, "gpspipe: Socket write Error, %s(%d)\n", why, err);
+	if (spooling)
+		fprintf(stderr, "gpspipe: queueing fixes in %s, %lu taken back from the uplink\n",
+				spoolPath, uplinkTakeBack(&uplink, respool, NULL));
+	connectorLost(&conn);
+	connectionAlive = false;
+}
+
+/* what the dead band did, over all sources */
+static void deadbandReport(void) {
+	unsigned long passed = 0, suppressed = 0;
+	int i;
+
+	if (!suppress)
+		return;
+	for (i = 0; i < nsources; i++) {
+		passed += sources[i].band.passed;
+		suppressed += sources[i].band.suppressed;
 	}
-	if (write(fd, &flag, sizeof(uint8_t)) == -1) {
-		fprintf(stderr, "gpspipe: Socket write Error, %s(%d)\n", strerror(errno), errno);
-		return false;
+	fprintf(stderr, "gpspipe: dead band: %lu fixes sent, %lu suppressed\n", passed, suppressed);
+}
+
+/* How far behind each output is, on SIGUSR1 */
+static void report(bool toSerial, bool toServer) {
+	const Sink * sinks[2] = { &out, &serial };
+	int i;
+
+	for (i = 0; i < (toSerial ? 2 : 1); i++)
+		fprintf(stderr, "gpspipe: %s: %lu pieces in %lu writes, %zu bytes queued, lag %lld ms, at worst %lld ms, %lu dropped\n",
+				sinks[i]->name, sinks[i]->queues, sinks[i]->writes, sinkQueued(sinks[i]),
+				(long long) sinkLag(sinks[i]), (long long) sinks[i]->lagMax, sinks[i]->dropped);
+	if (!toServer)
+		return;
+	if (connectionAlive)
+		fprintf(stderr, "gpspipe: uplink: %lu frames in %lu writes, %zu bytes queued, lag %lld ms, at worst %lld ms, %lu dropped\n",
+				uplink.frames, uplink.writes, uplink.tail - uplink.head,
+				(long long) uplinkLag(&uplink), (long long) uplink.lagMax, uplink.dropped);
+	else
+		fprintf(stderr, "gpspipe: uplink: down, %lu connects tried, %llu fixes queued\n",
+				conn.attempts, spooling ? (unsigned long long) spoolDepth(&spool) : 0ULL);
+	deadbandReport();
+}
+
+/* Send what is still queued and leave */
+static void finish(int status) {
+	/* the uplink first: draining a stuck output may wait for good */
+	if (connectionAlive)
+		uplinkFlush(&uplink, true);
+	if (spooling)
+		spoolClose(&spool);
+	sinkDrain(&out);
+	if (serial.name != NULL)
+		sinkDrain(&serial);
+	deadbandReport();
+	exit(status);
+}
+
+/* copy n bytes read from src to the output, behind a time stamp where a line starts */
+static void echo(Source * src, time_t now, const char * p, size_t n) {
+	if (src->newLine && timestamp) {
+		const char *prefix;
+		size_t len = stampFor(now, format, &prefix);
+
+		sinkWrite(&out, prefix, len);
 	}
-	char * data = (char *) buf;
-	unsigned i;
-	for (i = 0; i<n; i++) {
-		if (write(fd, data++, 1) == -1) {
-			fprintf(stderr, "gpspipe: Socket write Error, %s(%d)\n", strerror(errno), errno);
-			return false;
+	src->newLine = false;
+	sinkWrite(&out, p, n);
+}
+
+/* src read a whole line: send its fix to the server and copy it to the serial port */
+static void sourceLine(Source * src) {
+	struct gps_package gpsPackage;
+	int rc;
+
+	if (usesocket && (connectionAlive || spooling)) {
+		/* null end the string */
+		src->line[src->len] = '\0';
+
+		rc = receiver != NULL ? parse_nmea(src->line, src->len, &gpsPackage)
+				: parse_gps_json(src->line, src->len, &gpsPackage);
+		/* a fix that tells the server nothing new is neither sent nor queued */
+		if (rc == SUCCESS && suppress && !deadbandPass(&src->band, &gpsPackage, wallclock()))
+			rc = ERROR;
+		if (rc == SUCCESS && !connectionAlive)
+			spoolPush(&spool, &gpsPackage, src->stream, wallclock());
+		else if (rc == SUCCESS && SendGPSPackage(&uplink, src->stream,
+				&gpsPackage,
+				(size_t) sizeof(struct gps_package),
+				GPS_BYTE) == false) {
+			/* sent as backfill once the uplink drains */
+			if (spooling)
+				spoolPush(&spool, &gpsPackage, src->stream, wallclock());
+			else if (uplink.dropped % 100 == 1)
+				fprintf(stderr, "gpspipe: uplink backed up, %lu fixes dropped\n",
+						uplink.dropped);
 		}
 	}
-	return true;
+	if (serialport != NULL
+			&& !sinkWrite(&serial, src->line, src->len) && serial.dropped % 100 == 1)
+		fprintf(stderr, "gpspipe: %s backed up, %lu lines dropped\n",
+				serialport, serial.dropped);
 }
 
+/* Handle n bytes read from src, which may end in the middle of a line */
+static void sourceInput(Source * src, const char * buf, size_t n) {
+	const char *p = buf, *end = buf + n, *nl;
+	/* the lines of one read arrived together */
+	time_t now = timestamp ? time(NULL) : 0;
+
+	while (p < end) {
+		size_t span;
+
+		/* up to the end of the line, or of the read; the rest of a line comes later */
+		nl = (const char *) memchr(p, '\n', (size_t) (end - p));
+		span = (size_t) ((nl != NULL ? nl + 1 : end) - p);
+		/*
+		 * A line is collected across reads; longer ones are passed on, not
+		 * parsed. A gateway writes whole lines out, lest those of two
+		 * sources mix; only overlong ones go in pieces.
+		 */
+		if (!src->overlong && src->len + span < sizeof(src->line)) {
+			memcpy(src->line + src->len, p, span);
+			src->len += span;
+			if (!gateway)
+				echo(src, now, p, span);
+		} else {
+			if (gateway && !src->overlong && src->len > 0)
+				echo(src, now, src->line, src->len);
+			src->overlong = true;
+			echo(src, now, p, span);
+		}
+		p += span;
+		if (nl == NULL)
+			break;
+
+		/* We have received a complete package */
+		if (!src->overlong) {
+			if (gateway)
+				echo(src, now, src->line, src->len);
+			sourceLine(src);
+		}
+		src->len = 0;
+		src->overlong = false;
+
+		src->newLine = true;
+		/* -u: every line goes out as soon as it is whole */
+		if (lowLatency && sinkFlush(&out) == -1)
+			finish(1);
+		if (count > 0) {
+			if (0 >= --count) {
+				/* completed count */
+				finish(0);
+			}
+		}
+	}
+}
 
 static void open_serial(char *device)
 /* open the serial port and set it up */
@@ -177,10 +435,54 @@ static void open_serial(char *device)
     }
 }
 
+/* open the receiver on device[:speed] to read it in place of gpsd */
+static int open_receiver(char *spec)
+{
+	static const struct { unsigned bps; speed_t speed; } speeds[] = {
+		{ 4800, B4800 }, { 9600, B9600 }, { 19200, B19200 },
+		{ 38400, B38400 }, { 57600, B57600 }, { 115200, B115200 }
+	};
+	struct termios tio;
+	unsigned bps = RECEIVER_SPEED, i;
+	char *colon = strchr(spec, ':');
+	int fd;
+
+	if (colon != NULL) {
+		*colon = '\0';
+		bps = (unsigned) strtoul(colon + 1, NULL, 10);
+	}
+	for (i = 0; i < sizeof(speeds) / sizeof(speeds[0]) && speeds[i].bps != bps; i++)
+		;
+	if (i == sizeof(speeds) / sizeof(speeds[0])) {
+		fprintf(stderr, "gpspipe: unsupported speed %u\n", bps);
+		exit(1);
+	}
+
+	if ((fd = open(spec, O_RDONLY | O_NOCTTY | O_NONBLOCK | O_CLOEXEC)) == -1) {
+		fprintf(stderr, "gpspipe: error opening %s, %s(%d)\n", spec, strerror(errno), errno);
+		exit(1);
+	}
+	/* not a tty: a recording replayed through a pipe or file */
+	if (tcgetattr(fd, &tio) != 0)
+		return fd;
+	cfmakeraw(&tio);
+	tio.c_cflag |= CLOCAL | CREAD;
+	tio.c_cc[VMIN] = 1;
+	tio.c_cc[VTIME] = 0;
+	(void) cfsetispeed(&tio, speeds[i].speed);
+	(void) cfsetospeed(&tio, speeds[i].speed);
+	(void) tcflush(fd, TCIFLUSH);
+	if (tcsetattr(fd, TCSANOW, &tio) != 0) {
+		fprintf(stderr, "gpspipe: error configuring %s\n", spec);
+		exit(1);
+	}
+	return fd;
+}
+
 static void usage(void)
 {
     (void)fprintf(stderr,
-		  "Usage: gpspipe [OPTIONS] [server[:port[:device]]]\n\n"
+		  "Usage: gpspipe [OPTIONS] [server[:port[:device]] ...]\n\n"
 		  "-d Run as a daemon.\n" 
 		  "-o [file] Write output to file.\n"
 		  "-h Show this help.\n" 
@@ -190,62 +492,54 @@ static void usage(void)
 		  "-l Sleep for ten seconds before connecting to gpsd.\n"
 		  "-t Time stamp the data.\n"
 		  "-T [format] set the timestamp format (strftime(3)-like; implies '-t')\n"
+		  "-u Write every line out as it comes, also to a file or pipe.\n"
 		  "-s [serial dev] emulate a 4800bps NMEA GPS on serial port (use with '-r').\n"
+		  "-N [dev[:speed]] Read NMEA from the receiver on dev, without gpsd (9600 bps).\n"
 		  "-n [count] exit after count packets.\n"
+		  "-b [ms] Batch the fixes sent to the server over ms (default 0).\n"
+		  "-P [version] Speak version 1 or 2 of the protocol to the server (default 2).\n"
+		  "-q [file] Queue fixes in file while the server is unreachable.\n"
+		  "-Q [count] Size of a new queue file, in fixes (default 86400).\n"
+		  "-B [rate] Send queued fixes at rate per second (default 10).\n"
+		  "-m [m[:deg[:m/s]]] Send a fix only when it moved, turned or changed speed this much.\n"
+		  "-M [s] With -m, send a fix at least this often (default 60).\n"
 		  "-v Print a little spinner.\n"
 		  "-p Include profiling info in the JSON.\n"
 		  "-V Print version and exit.\n\n"
-		  "You must specify one, or more, of -r, -R, or -w\n"
-		  "You must use -o if you use -d.\n");
-}
-
-time_t checkpoint;
-
-static bool timer_up(void) {
-	time_t now = time(NULL );
-	if (difftime(now, checkpoint) > RETRY_TIMER)
-		return true;
-	else
-		return false;
-}
-
-static void timer_reset(void) {
-	checkpoint = time(NULL);
+		  "You must specify one, or more, of -r, -R, or -w, unless you use -N\n"
+		  "You must use -o if you use -d.\n"
+		  "Several gpsd sources are sent to the server as streams of one connection.\n");
 }
 
 /*@ -compdestroy @*/
 int main(int argc, char **argv) {
 	char buf[4096]; /* Yiding: buffer to put the gps package from gpsd */
-	bool timestamp = false; /* Yiding: set the time stamp */
-	char *format = "%c";
-	char tmstr[200]; /* Yiding: time string */
 	bool daemonize = false; /* Yiding: allow the client to run as a daemon */
 	bool binary = false;
 	bool sleepy = false;
-	bool new_line = true;
 	bool raw = false;
 	bool watch = false;
 	bool profile = false;
-	bool usesocket = false;
-	bool connectionAlive = false;
-	long count = -1;
 	int option;
 	unsigned int vflag = 0, l = 0;
 	FILE *fp;
 	unsigned int flags;
-	fd_set fds;
-	int client = -1;
-	int rc = -1;
+	unsigned int latency = 0;
+	int protocol = COM_VERSION_2;
+	unsigned int spoolFixes = SPOOL_FIXES, spoolRate = SPOOL_RATE;
+	double distance = DEADBAND_DISTANCE, heading = DEADBAND_HEADING, speed = DEADBAND_SPEED;
+	unsigned int silence = DEADBAND_SILENCE;
+	char *spoolfile = NULL;
+	int r, i, sigfd;
+	unsigned long linked = 0;
+	sigset_t mask;
 
-	struct fixsource_t source;
-	char *serialport = NULL;
 	char *outfile = NULL;
 	char *serverName = NULL;
-	struct gps_package gpsPackage;
 
 	/*@-branchstate@*/
 	flags = WATCH_ENABLE;
-	while ((option = getopt(argc, argv, "?dD:lhrRwtT:vVn:s:o:pS:")) != -1) {
+	while ((option = getopt(argc, argv, "?dD:lhrRwtT:vVn:s:o:pS:b:q:Q:B:N:m:M:uP:")) != -1) {
 		switch (option) {
 		case 'S':
 			usesocket = true;
@@ -260,6 +554,42 @@ int main(int argc, char **argv) {
 		case 'n':
 			count = strtol(optarg, 0, 0);
 			break;
+		case 'b':
+			latency = (unsigned) strtoul(optarg, 0, 0);
+			break;
+		case 'q':
+			spoolfile = optarg;
+			break;
+		case 'Q':
+			spoolFixes = (unsigned) strtoul(optarg, 0, 0);
+			break;
+		case 'B':
+			spoolRate = (unsigned) strtoul(optarg, 0, 0);
+			break;
+		case 'm': {
+			char *next;
+
+			suppress = true;
+			distance = strtod(optarg, &next);
+			if (*next == ':')
+				heading = strtod(next + 1, &next);
+			if (*next == ':')
+				speed = strtod(next + 1, &next);
+			break;
+		}
+		case 'u':
+			lowLatency = true;
+			break;
+		case 'P':
+			protocol = atoi(optarg);
+			if (protocol != COM_VERSION_1 && protocol != COM_VERSION_2) {
+				(void) fprintf(stderr, "gpspipe: protocol version 1 or 2.\n");
+				exit(1);
+			}
+			break;
+		case 'M':
+			silence = (unsigned) (strtod(optarg, 0) * 1000);
+			break;
 		case 'r':
 			raw = true;
 			/*
@@ -302,6 +632,11 @@ int main(int argc, char **argv) {
 		case 's':
 			serialport = optarg;
 			break;
+		case 'N':
+			/* the receiver's own sentences are what is dumped */
+			receiver = optarg;
+			raw = true;
+			break;
 		case 'o':
 			outfile = optarg;
 			break;
@@ -314,11 +649,28 @@ int main(int argc, char **argv) {
 	}
 	/*@+branchstate@*/
 
-	/* Grok the server, port, and device. */
-	if (optind < argc) {
-		gpsd_source_spec(argv[optind], &source);
+	/* Grok the server, port, and device of every source. */
+	if (receiver != NULL)
+		nsources = 1;	/* read in place of gpsd */
+	else if (optind < argc) {
+		if (argc - optind > MAX_SOURCES) {
+			(void) fprintf(stderr, "gpspipe: at most %d sources.\n", MAX_SOURCES);
+			exit(1);
+		}
+		for (; optind < argc; optind++)
+			gpsd_source_spec(argv[optind], &sources[nsources++].spec);
 	} else
-		gpsd_source_spec(NULL, &source);
+		gpsd_source_spec(NULL, &sources[nsources++].spec);
+	gateway = nsources > 1;
+	for (i = 0; i < nsources; i++) {
+		sources[i].stream = gateway ? (streamId) i + 1 : 0;
+		sources[i].newLine = true;
+	}
+
+	if (gateway && binary) {
+		(void) fprintf(stderr, "gpspipe: '-R' reads one source only.\n");
+		exit(1);
+	}
 
 	if (serialport != NULL && !raw) {
 		(void) fprintf(stderr, "gpspipe: use of '-s' requires '-r'.\n");
@@ -371,158 +723,160 @@ int main(int argc, char **argv) {
 	if (serialport)
 		open_serial(serialport);
 
-	/*@ -nullpass -onlytrans @*/
-	if (gps_open(source.server, source.port, &gpsdata) != 0) {
-		(void) fprintf(stderr,
-				"gpspipe: could not connect to gpsd %s:%s, %s(%d)\n",
-				source.server, source.port, strerror(errno), errno);
-		exit(1);
-	}
-	/*@ +nullpass +onlytrans @*/
+	if (receiver != NULL) {
+		/* the receiver is read like the gpsd socket would be */
+		nmeaInit(&nmea);
+		sources[0].gpsdata.gps_fd = open_receiver(receiver);
+	} else {
+		if (profile)
+			flags |= WATCH_TIMING;
+		for (i = 0; i < nsources; i++) {
+			struct fixsource_t *source = &sources[i].spec;
+
+			/*@ -nullpass -onlytrans @*/
+			if (gps_open(source->server, source->port, &sources[i].gpsdata) != 0) {
+				(void) fprintf(stderr,
+						"gpspipe: could not connect to gpsd %s:%s, %s(%d)\n",
+						source->server, source->port, strerror(errno), errno);
+				exit(1);
+			}
+			/*@ +nullpass +onlytrans @*/
 
-	if (profile)
-		flags |= WATCH_TIMING;
-	if (source.device != NULL )
-		flags |= WATCH_DEVICE;
-	(void) gps_stream(&gpsdata, flags, source.device);
+			(void) gps_stream(&sources[i].gpsdata,
+					source->device != NULL ? flags | WATCH_DEVICE : flags, source->device);
+		}
+	}
 
 	if ((isatty(STDERR_FILENO) == 0) || daemonize)
 		vflag = 0;
 
-	/* check if server address is reachable */
+	if (suppress)
+		for (i = 0; i < nsources; i++)
+			deadbandInit(&sources[i].band, distance, heading, speed, silence);
+
+	if (usesocket && spoolfile != NULL) {
+		if (spoolOpen(&spool, spoolfile, spoolFixes) == -1)
+			exit(1);
+		spooling = true;
+		spoolPath = spoolfile;
+		if (spoolDepth(&spool) > 0)
+			fprintf(stderr, "gpspipe: %llu queued fixes to backfill\n",
+					(unsigned long long) spoolDepth(&spool));
+	}
+
+	/* everything is watched by one loop: every gpsd, the outputs, the server and SIGUSR1 */
+	reactor = newReactor();
+	for (i = 0; i < nsources; i++)
+		watchReady(&sources[i].ev, sources[i].gpsdata.gps_fd, &sources[i].ready, EPOLLIN);
+	sinkInit(&out, reactor, outfile != NULL ? outfile : "output", fileno(fp));
+	/* a terminal sees every read as it comes; files and pipes get few large writes */
+	if (!lowLatency && !isatty(fileno(fp)))
+		sinkPolicy(&out, SINK_BATCH, SINK_DELAY);
+	if (serialport != NULL)
+		sinkInit(&serial, reactor, serialport, fd_out);
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGUSR1);
+	sigprocmask(SIG_BLOCK, &mask, NULL);
+	if ((sigfd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC)) == -1) {
+		perror("gpspipe: signalfd");
+		exit(1);
+	}
+	watchReady(&sigEvent, sigfd, &sigReady, EPOLLIN);
+
+	/* the server is called from the loop below, without holding up gpsd */
 	if (usesocket) {
-		client = clientCall(serverName);
-		if (client != -1)
-			connectionAlive = true;
-		else
-			timer_reset();
+		if (connectorInit(&conn, serverName, SERVER_PORT) == -1)
+			exit(1);
+		watchReady(&timerEvent, conn.timerfd, &timerReady, EPOLLIN);
+		connectorStart(&conn);
 	}
 
 	for (;;) {
-		int r = 0;
-		struct timeval tv;
-
-		tv.tv_sec = 0;
-		tv.tv_usec = 100000;
-		FD_ZERO(&fds);
-		FD_SET(gpsdata.gps_fd, &fds);
-		errno = 0;
-		r = select(gpsdata.gps_fd + 1, &fds, NULL, NULL, &tv);
-		if (r == -1 && errno != EINTR) {
-			(void) fprintf(stderr, "gpspipe: select error %s(%d)\n",
-					strerror(errno), errno);
-			exit(1);
-		} else if (r == 0)
-			continue;
-
-		if (vflag)
-			spinner(vflag, l++);
-
-		/* reading directly from the socket avoids decode overhead */
-		errno = 0;
-		r = (int) read(gpsdata.gps_fd, buf, sizeof(buf));
-		if (r > 0) {
-			int i = 0;
-			int j = 0;
-			for (i = 0; i < r; i++) {
-				char c = buf[i];
-				if (j < (int) (sizeof(serbuf) - 1)) {
-					serbuf[j++] = c;
-				}
-				if (new_line && timestamp) {
-					time_t now = time(NULL );
-
-					struct tm *tmp_now = localtime(&now);
-					(void) strftime(tmstr, sizeof(tmstr), format, tmp_now);
-					new_line = 0;
-					if (fprintf(fp, "%.24s :", tmstr) <= 0) {
-						(void) fprintf(stderr, "gpspipe: write error, %s(%d)\n",
-								strerror(errno), errno);
-						exit(1);
-					}
-				}
-				if (fputc(c, fp) == EOF) {
-					fprintf(stderr, "gpspipe: Write Error, %s(%d)\n",
-							strerror(errno), errno);
-					exit(1);
-				}
-
-				if (c == '\n') {
-					/* We have received a complete package */
-					if (usesocket && connectionAlive) {
-						/* parse the package with json */
-						/* null end the string */
-						if (j < (int) (sizeof(serbuf) - 1)) {
-							serbuf[j] = '\0';
-
-							rc = parse_gps_json(serbuf, &gpsPackage);
-							if (rc == SUCCESS) {
-								if (SendGPSPackage(client,
-										&gpsPackage,
-										(size_t) sizeof(struct gps_package),
-										GPS_BYTE) == false) {
-									connectionAlive = false;
-									timer_reset();
-								}
-							}
-
-						} else {
-							fprintf(stderr, "gpspipe: buffer overflow");
-							exit(1);
-						}
-					}
-					else if (usesocket && !connectionAlive) {
-						if (timer_up()) {
-							client = clientCall(serverName);
-							if (client == -1) {
-								connectionAlive = false;
-								timer_reset();
-							}
-							else {
-								connectionAlive = true;
-							}
-						}
-					}
-
-					if (serialport != NULL ) {
-						if (write(fd_out, serbuf, (size_t) j) == -1) {
-							fprintf(stderr,
-									"gpspipe: Serial port write Error, %s(%d)\n",
-									strerror(errno), errno);
-							exit(1);
-						}
-					}
-
-					j = 0;
-
-					new_line = true;
-					/* flush after every good line */
-					if (fflush(fp)) {
-						(void) fprintf(stderr,
-								"gpspipe: fflush Error, %s(%d)\n",
-								strerror(errno), errno);
-						exit(1);
-					}
-					if (count > 0) {
-						if (0 >= --count) {
-							/* completed count */
-							exit(0);
-						}
-					}
-				} /* c == '\n' */
-			} /* for i */
-		} else {
+		int due = -1, held, wait;
+
+		/* a new socket: the one it replaces left epoll when it was closed */
+		if (usesocket && conn.fd != -1 && conn.attempts != linked) {
+			linked = conn.attempts;
+			linkReady = 0;
+			watchReady(&linkEvent, conn.fd, &linkReady, EPOLLOUT | EPOLLRDHUP | EPOLLET);
+		}
+
+		/* frames queued by the last read go out together, once due */
+		if (usesocket && connectionAlive) {
+			if (spooling)
+				backfill(spoolRate);
+			if (uplinkFlush(&uplink, false) == -1)
+				uplinkLost(strerror(errno), errno);
+			else
+				due = uplinkTimeout(&uplink);
+		}
+		if (spooling)
+			spoolSync(&spool, wallclock());
+		/* output held back by its policy goes once it waited long enough */
+		if (sinkPoll(&out) == -1)
+			finish(1);
+		held = sinkTimeout(&out);
+
+		/* a backed up uplink or output (0) waits for its socket to drain */
+		wait = 100;
+		if (due > 0 && due < wait)
+			wait = due;
+		if (held > 0 && held < wait)
+			wait = held;
+		timerReady = linkReady = sigReady = 0;
+		for (i = 0; i < nsources; i++)
+			sources[i].ready = 0;
+		reactorPoll(reactor, wait);
+
+		if (sigReady) {
+			struct signalfd_siginfo si;
+
+			while (read(sigfd, &si, sizeof si) == (ssize_t) sizeof si)
+				;
+			report(serialport != NULL, usesocket);
+		}
+
+		if (usesocket && connectionAlive && (linkReady & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)))
+			uplinkLost("connection closed", 0);
+		else if (usesocket && !connectionAlive && (timerReady || linkReady)
+				&& connectorStep(&conn, timerReady != 0,
+						conn.state == LINK_CONNECTING && linkReady != 0) == LINK_UP) {
+			uplinkInit(&uplink, conn.fd, latency, protocol);
+			connectionAlive = true;
+			if (spooling && spoolDepth(&spool) > 0)
+				fprintf(stderr, "gpspipe: %llu queued fixes to backfill, %llu dropped\n",
+						(unsigned long long) spoolDepth(&spool),
+						(unsigned long long) spool.header->dropped);
+		}
+		for (i = 0; i < nsources; i++) {
+			Source *src = &sources[i];
+
+			if (src->ready == 0)
+				continue;
+			if (vflag)
+				spinner(vflag, l++);
+
+			/* reading directly from the socket avoids decode overhead */
+			errno = 0;
+			r = (int) read(src->gpsdata.gps_fd, buf, sizeof(buf));
+			if (r > 0) {
+				sourceInput(src, buf, (size_t) r);
+				continue;
+			}
 			if (r == -1) {
 				if (errno == EAGAIN)
 					continue;
 				else
 					(void) fprintf(stderr, "gpspipe: read error %s(%d)\n",
 							strerror(errno), errno);
-				exit(1);
+				finish(1);
 			} else {
-				exit(0);
+				finish(0);
 			}
 		}
+
+		if (sinkPoll(&out) == -1 || (serialport != NULL && sinkFlush(&serial) == -1))
+			finish(1);
 	} /* infinite loop */
 
 #ifdef __UNUSED__
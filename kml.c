@@ -0,0 +1,410 @@
+/*
+ * kml.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: yiding
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/eventfd.h>
+
+#include "kml.h"
+#include "registry.h"
+
+#define KML_MASK (KML_QUEUE - 1)
+
+/* client-N.kml of one client; only the KML thread touches it */
+typedef struct kmlWriter {
+	clientId cid;
+	int fd;						/* KML_OVERWRITE: the open file, else -1 */
+	bool pending;				/* fix holds a fix not published yet */
+	bool listed;				/* on the pending list */
+	bool ended;					/* the session ended, freed once off the pending list */
+	struct gps_package fix;
+	int size;					/* length of the document in the file */
+	int64_t published;			/* ns, monotonic, of the last publish, 0 before the first */
+	KmlQueue * queue;			/* of the shard serving the client */
+	struct kmlWriter * due;		/* pending list */
+	struct kmlWriter * prev;	/* list of all writers */
+	struct kmlWriter * next;
+	char path[KML_PATH];
+	char buf[KML_SIZE];
+} KmlWriter;
+
+static kmlPublish publishMode = KML_RENAME;
+static int64_t refreshNs;		/* minimum time between two publishes */
+static KmlQueue * queues;
+static int nqueues;
+static pthread_t thread;
+static int wakefd = -1;			/* eventfd: a ring is filling up, or stop */
+static bool stopping;
+static AmbleRegistry writerIndex;	/* client ID -> writer */
+static KmlWriter * writers;
+static KmlWriter * pendingList;
+
+static int64_t kmlNow(void) {
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+	return (int64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static KmlWriter * kmlWriter(KmlQueue * q, clientId cid) {
+	KmlWriter * kml = (KmlWriter *) registryFind(&writerIndex, cid);
+
+	if (kml != NULL)
+		return kml;
+	kml = (KmlWriter *) malloc(sizeof(KmlWriter));
+	if (kml == NULL) {
+		printf("Fail to allocate memory space\n");
+		exit(1);
+	}
+	kml->cid = cid;
+	kml->fd = -1;
+	kml->pending = false;
+	kml->listed = false;
+	kml->ended = false;
+	kml->size = 0;
+	kml->published = 0;
+	kml->queue = q;
+	snprintf(kml->path, sizeof kml->path, "client-%u.kml", cid);
+	kml->prev = NULL;
+	kml->next = writers;
+	if (writers != NULL)
+		writers->prev = kml;
+	writers = kml;
+	registryInsert(&writerIndex, cid, kml);
+	return kml;
+}
+
+/*
+ * Render a fix into kml->buf. Every number has a fixed width, so
+ * successive documents of one client normally have the same length
+ * and can overwrite each other in place. Coordinates are padded with
+ * zeros: whitespace would split the tuple.
+ */
+static int kmlRender(KmlWriter * kml, const struct gps_package * gps) {
+	int range, tilt, speed;
+
+	speed = (int)(gps->speed * 2.2369356f);
+	if (speed < 0 || speed > 9999)
+		speed = speed < 0 ? 0 : 9999;
+	if (speed >= 10) {
+		range = ((speed / 100) * 350) + 650;
+		tilt = ((speed / 120) * 43) + 30;
+	} else {
+		range = 200;
+		tilt = 30;
+	}
+
+	return snprintf(kml->buf, sizeof kml->buf,
+			"<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+			"<kml xmlns=\"http://earth.google.com/kml/2.0\">\n"
+			"  <Placemark>\n"
+			"    <name>%4d mph</name>\n"
+			"    <description>AmbleTour ClientId %10u</description>\n"
+			"    <LookAt>\n"
+			"      <longitude>%11.6f</longitude>\n"
+			"      <latitude>%11.6f</latitude>\n"
+			"      <range>%6d</range>\n"
+			"      <tilt>%5d</tilt>\n"
+			"      <heading>%11.6f</heading>\n"
+			"    </LookAt>\n"
+			"    <Point>\n"
+			"      <coordinates>%011.6f,%011.6f,%011.3f</coordinates>\n"
+			"    </Point>\n"
+			"  </Placemark>\n"
+			"</kml>\n",
+			speed, kml->cid, gps->lon, gps->lat, range, tilt, gps->heading,
+			gps->lon, gps->lat, gps->alt);
+}
+
+static int kmlWriteAll(int fd, const char * buf, int n, off_t offset) {
+	ssize_t rc;
+
+	while (n > 0) {
+		rc = pwrite(fd, buf, (size_t) n, offset);
+		if (rc == -1)
+			return -1;
+		buf += rc;
+		n -= (int) rc;
+		offset += rc;
+	}
+	return 0;
+}
+
+/* readers of client-N.kml see the old or the new document, never a mix */
+static int kmlRename(KmlWriter * kml, int n) {
+	char tmp[KML_PATH + 4];
+	int fd;
+
+	snprintf(tmp, sizeof tmp, "%s.tmp", kml->path);
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd == -1) {
+		perror(tmp);
+		return -1;
+	}
+	if (kmlWriteAll(fd, kml->buf, n, 0) == -1) {
+		perror(tmp);
+		close(fd);
+		return -1;
+	}
+	close(fd);
+	if (rename(tmp, kml->path) == -1) {
+		perror(kml->path);
+		return -1;
+	}
+	return 0;
+}
+
+/* one pwrite() per publish; the file is only truncated if its length changes */
+static int kmlOverwrite(KmlWriter * kml, int n) {
+	if (kml->fd == -1) {
+		kml->fd = open(kml->path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+		if (kml->fd == -1) {
+			perror(kml->path);
+			return -1;
+		}
+		kml->size = 0;
+	}
+	if (kmlWriteAll(kml->fd, kml->buf, n, 0) == -1
+			|| (n < kml->size && ftruncate(kml->fd, n) == -1)) {
+		perror(kml->path);
+		return -1;
+	}
+	kml->size = n;
+	return 0;
+}
+
+static int kmlPublishFix(KmlWriter * kml, int64_t now) {
+	int n = kmlRender(kml, &kml->fix);
+
+	if (n >= (int) sizeof kml->buf)
+		n = (int) sizeof kml->buf - 1;
+	kml->pending = false;
+	kml->published = now;
+	if ((publishMode == KML_OVERWRITE ? kmlOverwrite(kml, n) : kmlRename(kml, n)) == -1)
+		return -1;
+	__atomic_store_n(&kml->queue->published, kml->queue->published + 1, __ATOMIC_RELAXED);
+	return 0;
+}
+
+/* Take the latest fix of the client; it waits on the pending list */
+static void kmlUpdate(KmlWriter * kml, const struct gps_package * gps) {
+	kml->fix = *gps;
+	kml->pending = true;
+	if (!kml->listed) {
+		kml->listed = true;
+		kml->due = pendingList;
+		pendingList = kml;
+	}
+}
+
+/* Flush and release the writer when its session ends */
+static void kmlClose(KmlWriter * kml) {
+	if (kml->pending)
+		kmlPublishFix(kml, kmlNow());
+	if (kml->fd != -1) {
+		close(kml->fd);
+		kml->fd = -1;
+	}
+	registryRemove(&writerIndex, kml->cid);
+	if (kml->prev != NULL)
+		kml->prev->next = kml->next;
+	else
+		writers = kml->next;
+	if (kml->next != NULL)
+		kml->next->prev = kml->prev;
+	kml->ended = true;
+	if (!kml->listed)
+		free(kml);
+}
+
+/*
+ * Publish the pending fixes whose refresh interval has passed, all of
+ * them if flush is set; the others stay on the list.
+ */
+static void kmlPublishDue(bool flush) {
+	KmlWriter ** link = &pendingList;
+	KmlWriter * kml;
+	int64_t now = kmlNow();
+
+	while ((kml = *link) != NULL) {
+		if (kml->pending && !flush && refreshNs > 0 && kml->published != 0
+				&& now - kml->published < refreshNs) {
+			link = &kml->due;
+			continue;
+		}
+		if (kml->pending)
+			kmlPublishFix(kml, now);
+		*link = kml->due;
+		kml->listed = false;
+		if (kml->ended)
+			free(kml);
+	}
+}
+
+/* Take everything queued in q; only the newest fix of a client counts */
+static void kmlDrain(KmlQueue * q) {
+	uint64_t h = q->head;
+	uint64_t t = __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+	KmlEntry * e;
+
+	for (; h < t; h++) {
+		e = &q->slots[h & KML_MASK];
+		if (e->ended) {
+			KmlWriter * kml = (KmlWriter *) registryFind(&writerIndex, e->cid);
+
+			if (kml != NULL)
+				kmlClose(kml);
+		}
+		else
+			kmlUpdate(kmlWriter(q, e->cid), &e->fix);
+	}
+	__atomic_store_n(&q->head, t, __ATOMIC_RELEASE);
+}
+
+static void * kmlThread(void * arg) {
+	struct pollfd pfd;
+	sigset_t mask;
+	uint64_t count;
+	bool stop;
+	int i;
+
+	/* leave job control signals to the shell thread */
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGCHLD);
+	sigaddset(&mask, SIGINT);
+	sigaddset(&mask, SIGTSTP);
+	pthread_sigmask(SIG_BLOCK, &mask, NULL);
+
+	pfd.fd = wakefd;
+	pfd.events = POLLIN;
+	while (1) {
+		stop = __atomic_load_n(&stopping, __ATOMIC_ACQUIRE);
+		for (i = 0; i < nqueues; i++)
+			kmlDrain(&queues[i]);
+		kmlPublishDue(stop);
+		if (stop)
+			break;
+
+		if (poll(&pfd, 1, KML_DRAIN_MS) > 0 && read(wakefd, &count, sizeof count) == -1
+				&& errno != EAGAIN)
+			perror("eventfd");
+	}
+
+	/* every session ends with the server */
+	while (writers != NULL)
+		kmlClose(writers);
+	kmlPublishDue(true);
+	return NULL;
+}
+
+/*
+ * Start the KML thread with one ring per producer. Documents are
+ * published as the mode says, at most once every interval ms per
+ * client; 0 publishes every fix the thread gets to see.
+ */
+void kmlOnLine(int producers, kmlPublish mode, unsigned interval) {
+	publishMode = mode;
+	refreshNs = (int64_t) interval * 1000000;
+
+	if (posix_memalign((void **) &queues, 64, producers * sizeof(KmlQueue)) != 0) {
+		printf("Fail to allocate memory space\n");
+		exit(1);
+	}
+	memset(queues, 0, producers * sizeof(KmlQueue));
+	nqueues = producers;
+	registryInit(&writerIndex, KML_WRITERS);
+
+	wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (wakefd == -1) {
+		perror("eventfd");
+		exit(1);
+	}
+	if (pthread_create(&thread, NULL, kmlThread, NULL) != 0) {
+		fprintf(stderr, "kml: cannot start the KML thread\n");
+		exit(1);
+	}
+}
+
+/*
+ * Publish every pending fix, close the writers and stop the thread.
+ * The producers must have stopped pushing.
+ */
+void kmlOffLine(void) {
+	uint64_t one = 1;
+
+	if (wakefd == -1)
+		return;
+	__atomic_store_n(&stopping, true, __ATOMIC_RELEASE);
+	if (write(wakefd, &one, sizeof one) == -1)
+		perror("eventfd");
+	pthread_join(thread, NULL);
+	close(wakefd);
+	wakefd = -1;
+	registryFree(&writerIndex);
+}
+
+KmlQueue * kmlQueue(int producer) {
+	return &queues[producer];
+}
+
+/* Queue one entry; false if the ring is full */
+static bool kmlQueueEntry(KmlQueue * q, clientId cid, bool ended, const struct gps_package * fix) {
+	uint64_t t = q->tail;
+	uint64_t used = t - __atomic_load_n(&q->head, __ATOMIC_ACQUIRE);
+	uint64_t one = 1;
+	KmlEntry * e;
+
+	if (used == KML_QUEUE)
+		return false;
+	e = &q->slots[t & KML_MASK];
+	e->cid = cid;
+	e->ended = ended;
+	if (fix != NULL)
+		e->fix = *fix;
+	__atomic_store_n(&q->tail, t + 1, __ATOMIC_RELEASE);
+
+	/* the thread drains on its own every KML_DRAIN_MS; only hurry it up when needed */
+	if (used + 1 == KML_QUEUE / 2 && write(wakefd, &one, sizeof one) == -1)
+		perror("eventfd");
+	return true;
+}
+
+/*
+ * Hand the latest fix of a client to the KML thread. Only the producer
+ * thread may call this. A fix that finds the ring full is dropped: a
+ * later one replaces it anyway.
+ */
+void kmlPush(KmlQueue * q, clientId cid, const struct gps_package * fix) {
+	if (!kmlQueueEntry(q, cid, false, fix))
+		__atomic_store_n(&q->dropped, q->dropped + 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * Tell the KML thread a session ended, so its pending fix is published
+ * and its writer released. Unlike a fix this is never dropped: the
+ * producer waits for the thread to make room.
+ */
+void kmlEnd(KmlQueue * q, clientId cid) {
+	uint64_t one = 1;
+
+	if (wakefd == -1)
+		return;
+	while (!kmlQueueEntry(q, cid, true, NULL)) {
+		if (write(wakefd, &one, sizeof one) == -1)
+			perror("eventfd");
+		sched_yield();
+	}
+}
@@ -0,0 +1,62 @@
+/*
+ * kml.h
+ *
+ * Per-client KML output. Shards hand the live fixes of their clients
+ * to a KML thread through a bounded single-producer/single-consumer
+ * ring each, so rendering and writing files never holds up ingest.
+ * The thread keeps one writer per client that renders the latest fix
+ * into a reusable buffer and publishes client-N.kml at most once per
+ * refresh interval. Fixes arriving faster than that only replace the
+ * pending fix; the newest one is published as soon as the interval
+ * has passed, whether or not another fix comes, or when the session
+ * ends.
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: yiding
+ */
+
+#ifndef KML_H_
+#define KML_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "protocol.h"
+
+#define KML_SIZE	1024	/* rendered document, fixed width fields */
+#define KML_PATH	32
+#define KML_INTERVAL	1000	/* default minimum ms between publishes */
+#define KML_QUEUE	4096	/* fixes per producer ring, a power of 2 */
+#define KML_DRAIN_MS	100		/* rings are drained and pending fixes published this often */
+#define KML_WRITERS	1024	/* initial size of the writer index */
+
+/* how a rendered document reaches client-N.kml */
+typedef enum {
+	KML_RENAME,		/* write client-N.kml.tmp, then rename() over the file */
+	KML_OVERWRITE	/* keep the file open, pwrite() the same-sized document */
+} kmlPublish;
+
+typedef struct kmlEntry {
+	clientId cid;
+	bool ended;					/* the session ended, fix is unused */
+	struct gps_package fix;
+} KmlEntry;
+
+typedef struct kmlQueue {
+	/* producer side */
+	uint64_t tail __attribute__((aligned(64)));	/* entries queued */
+	unsigned long dropped;		/* fixes lost to a full ring */
+	/* consumer side */
+	uint64_t head __attribute__((aligned(64)));	/* entries taken by the thread */
+	unsigned long published;	/* documents published for the producer's clients */
+	KmlEntry slots[KML_QUEUE];
+} KmlQueue;
+
+void kmlOnLine(int producers, kmlPublish mode, unsigned interval);
+void kmlOffLine(void);
+
+KmlQueue * kmlQueue(int producer);
+void kmlPush(KmlQueue * q, clientId cid, const struct gps_package * fix);
+void kmlEnd(KmlQueue * q, clientId cid);
+
+#endif /* KML_H_ */
@@ -0,0 +1,250 @@
+/*
+ * nmea.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: yiding
+ */
+
+#include <string.h>
+#include <stdint.h>
+
+#include "nmea.h"
+
+/* exactly representable negative powers of ten, as divisors */
+static const double nmeaPow10[] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15
+};
+
+static int nmeaHex(char c) {
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	return -1;
+}
+
+/*
+ * Read the unsigned decimal of n characters at p; receivers write at
+ * most a handful of digits. Returns false if the field is empty or
+ * not such a number.
+ */
+static bool nmeaDecimal(const char * p, size_t n, double * value) {
+	uint64_t mantissa = 0;
+	int digits = 0, scale = -1;
+	size_t i;
+
+	for (i = 0; i < n; i++) {
+		if (p[i] == '.' && scale < 0)
+			scale = 0;
+		else if (p[i] >= '0' && p[i] <= '9' && digits < 15) {
+			mantissa = mantissa * 10 + (uint64_t) (p[i] - '0');
+			digits++;
+			if (scale >= 0)
+				scale++;
+		}
+		else
+			return false;
+	}
+	if (digits == 0)
+		return false;
+	*value = (double) mantissa / nmeaPow10[scale > 0 ? scale : 0];
+	return true;
+}
+
+static bool nmeaSigned(const char * p, size_t n, double * value) {
+	if (n > 0 && *p == '-') {
+		if (!nmeaDecimal(p + 1, n - 1, value))
+			return false;
+		*value = -*value;
+		return true;
+	}
+	return nmeaDecimal(p, n, value);
+}
+
+/* "hhmmss.sss" as ms of the day, -1 if it is not one */
+static long nmeaTime(const char * p, size_t n) {
+	double ss;
+	int hh, mm;
+
+	if (n < 6 || p[0] < '0' || p[0] > '2' || p[1] < '0' || p[1] > '9'
+			|| p[2] < '0' || p[2] > '5' || p[3] < '0' || p[3] > '9'
+			|| !nmeaDecimal(p + 4, n - 4, &ss) || ss >= 61)
+		return -1;
+	hh = (p[0] - '0') * 10 + p[1] - '0';
+	mm = (p[2] - '0') * 10 + p[3] - '0';
+	return ((long) hh * 3600 + mm * 60) * 1000 + (long) (ss * 1000 + 0.5);
+}
+
+/* "ddmmyy" as days since 1970-01-01, -1 if it is not one */
+static long nmeaDate(const char * p, size_t n) {
+	int y, m, d, era, yoe, doy, i;
+
+	if (n != 6)
+		return -1;
+	for (i = 0; i < 6; i++)
+		if (p[i] < '0' || p[i] > '9')
+			return -1;
+	d = (p[0] - '0') * 10 + p[1] - '0';
+	m = (p[2] - '0') * 10 + p[3] - '0';
+	/* two digit years, pivoting at 1980, the start of GPS time */
+	y = (p[4] - '0') * 10 + p[5] - '0';
+	y += y < 80 ? 2000 : 1900;
+	if (m < 1 || m > 12 || d < 1 || d > 31)
+		return -1;
+
+	y -= m <= 2;
+	era = y / 400;
+	yoe = y - era * 400;
+	doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+	return (long) era * 146097 + yoe * 365 + yoe / 4 - yoe / 100 + doy - 719468;
+}
+
+/*
+ * "ddmm.mmmm" or "dddmm.mmmm" and its hemisphere as signed degrees.
+ * Returns false if either field is empty or bad.
+ */
+static bool nmeaAngle(const char * p, size_t n, const char * h, size_t hn, double * deg) {
+	double v;
+	int whole;
+
+	if (hn != 1 || !nmeaDecimal(p, n, &v))
+		return false;
+	whole = (int) (v / 100);
+	v = whole + (v - whole * 100) / 60;
+	if (*h == 'S' || *h == 'W')
+		v = -v;
+	else if (*h != 'N' && *h != 'E')
+		return false;
+	*deg = v;
+	return true;
+}
+
+/* start a new fix at the ms of the day tod, unless it is the current one */
+static void nmeaEpoch(NmeaState * state, long tod) {
+	if (tod == state->tod)
+		return;
+	state->tod = tod;
+	state->done = false;
+	state->report.fields = 0;
+}
+
+void nmeaInit(NmeaState * state) {
+	memset(state, 0, sizeof(NmeaState));
+	state->tod = -1;
+}
+
+/*
+ * Read the sentence in the len bytes of one line into the fix being
+ * gathered. Sentences without a valid checksum are rejected. Never
+ * allocates.
+ */
+nmeaStatus nmeaParse(NmeaState * state, const char * line, size_t len) {
+	const char * f[NMEA_FIELDS], * p, * end = line + len, * star;
+	size_t n[NMEA_FIELDS];
+	unsigned char sum = 0;
+	int nf = 0, hi, lo;
+	TpvReport * r = &state->report;
+	double v;
+	long tod, day;
+
+	while (end > line && (end[-1] == '\n' || end[-1] == '\r'))
+		end--;
+	if (end - line < 10 || line[0] != '$' || end[-3] != '*'
+			|| (hi = nmeaHex(end[-2])) < 0 || (lo = nmeaHex(end[-1])) < 0) {
+		state->bad++;
+		return NMEA_MALFORMED;
+	}
+	star = end - 3;
+
+	/* the type follows the talker, GP, GN, GL...; the others are not even checked */
+	if (line[6] != ',' || !(!memcmp(line + 3, "GGA", 3) || !memcmp(line + 3, "RMC", 3)
+			|| !memcmp(line + 3, "VTG", 3)))
+		return NMEA_OTHER;
+
+	/* one pass: the checksum and the field boundaries */
+	f[0] = line + 1;
+	for (p = line + 1; p < star; p++) {
+		sum ^= (unsigned char) *p;
+		if (*p == ',' && nf < NMEA_FIELDS - 1) {
+			n[nf] = (size_t) (p - f[nf]);
+			f[++nf] = p + 1;
+		}
+	}
+	n[nf] = (size_t) (star - f[nf]);
+	nf++;
+	if (sum != (unsigned char) (hi << 4 | lo)) {
+		state->bad++;
+		return NMEA_MALFORMED;
+	}
+	if (!memcmp(f[0] + 2, "GGA", 3) && nf >= 10) {
+		if ((tod = nmeaTime(f[1], n[1])) < 0)
+			return NMEA_OTHER;
+		nmeaEpoch(state, tod);
+		/* quality 0 is no fix */
+		if (n[6] != 1 || f[6][0] == '0')
+			return NMEA_OK;
+		if (nmeaAngle(f[2], n[2], f[3], n[3], &r->lat)
+				&& nmeaAngle(f[4], n[4], f[5], n[5], &r->lon))
+			r->fields |= TPV_LAT | TPV_LON;
+		/* above mean sea level, as gpsd reports alt */
+		if (nmeaSigned(f[9], n[9], &v)) {
+			r->alt = v;
+			r->fields |= TPV_ALT;
+		}
+	}
+	else if (!memcmp(f[0] + 2, "RMC", 3) && nf >= 10) {
+		if ((tod = nmeaTime(f[1], n[1])) < 0)
+			return NMEA_OTHER;
+		nmeaEpoch(state, tod);
+		/* V is a warning: no fix */
+		if (n[2] != 1 || f[2][0] != 'A')
+			return NMEA_OK;
+		if (nmeaAngle(f[3], n[3], f[4], n[4], &r->lat)
+				&& nmeaAngle(f[5], n[5], f[6], n[6], &r->lon))
+			r->fields |= TPV_LAT | TPV_LON;
+		if (nmeaDecimal(f[7], n[7], &v)) {
+			r->speed = v * NMEA_KNOTS;
+			r->fields |= TPV_SPEED;
+		}
+		if (nmeaDecimal(f[8], n[8], &v)) {
+			r->track = v;
+			r->fields |= TPV_TRACK;
+		}
+		if ((day = nmeaDate(f[9], n[9])) >= 0) {
+			r->time = (double) day * 86400 + tod / 1000.0;
+			r->fields |= TPV_TIME;
+		}
+	}
+	else if (!memcmp(f[0] + 2, "VTG", 3) && nf >= 8) {
+		/* no time of its own: it belongs to the fix being gathered */
+		if (state->tod < 0 || (nf >= 10 && n[9] == 1 && f[9][0] == 'N'))
+			return NMEA_OK;
+		if (!(r->fields & TPV_TRACK) && nmeaDecimal(f[1], n[1], &v)) {
+			r->track = v;
+			r->fields |= TPV_TRACK;
+		}
+		if (!(r->fields & TPV_SPEED) && nmeaDecimal(f[7], n[7], &v)) {
+			r->speed = v / 3.6;
+			r->fields |= TPV_SPEED;
+		}
+	}
+	else
+		return NMEA_OTHER;
+
+	state->sentences++;
+	return NMEA_OK;
+}
+
+/*
+ * Fill a package once the fix being gathered is whole. Returns
+ * SUCCESS once per fix, ERROR until then and after.
+ */
+int nmeaFix(NmeaState * state, struct gps_package * fix) {
+	if (state->done || tpvFix(&state->report, fix) != SUCCESS)
+		return ERROR;
+	state->done = true;
+	return SUCCESS;
+}
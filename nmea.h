@@ -0,0 +1,46 @@
+/*
+ * nmea.h
+ *
+ * NMEA 0183 reader for a GPS receiver on a serial port, for running
+ * without gpsd. Sentences are checked against their checksum and read
+ * in place, without allocating. GGA, RMC and VTG sentences of any
+ * talker are used, the rest are passed over. A receiver reports one
+ * fix as several sentences sharing a time; they are gathered into a
+ * TpvReport, and the fix is handed out as soon as it is whole, which
+ * for most receivers is at the RMC sentence.
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: yiding
+ */
+
+#ifndef NMEA_H_
+#define NMEA_H_
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "global.h"
+#include "tpv.h"
+
+#define NMEA_FIELDS	24		/* fields looked at, the sentences used have fewer */
+#define NMEA_KNOTS	0.514444	/* m/s */
+
+typedef enum {
+	NMEA_OK,			/* a sentence used for the fix */
+	NMEA_OTHER,			/* a good sentence of another type */
+	NMEA_MALFORMED		/* not a sentence, or a bad checksum */
+} nmeaStatus;
+
+typedef struct nmeaState {
+	TpvReport report;		/* the fix being gathered, as gpsd would report it */
+	long tod;				/* its UTC time of day, ms; -1 before the first */
+	bool done;				/* it was handed out */
+	unsigned long sentences;	/* sentences used */
+	unsigned long bad;		/* sentences rejected */
+} NmeaState;
+
+void nmeaInit(NmeaState * state);
+nmeaStatus nmeaParse(NmeaState * state, const char * line, size_t len);
+int nmeaFix(NmeaState * state, struct gps_package * fix);
+
+#endif /* NMEA_H_ */
@@ -0,0 +1,250 @@
+/*
+ * persist.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: yiding
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <time.h>
+#include <sys/eventfd.h>
+
+#include "persist.h"
+
+#define PERSIST_MASK (PERSIST_QUEUE - 1)
+
+static PersistQueue * queues;
+static int nqueues;
+static pthread_t thread;
+static int wakefd = -1;			/* eventfd: a ring is filling up, or stop */
+static bool stopping;
+static long commitNs;			/* longest time records wait for a commit */
+static size_t commitBytes;		/* bytes that make the thread commit right away */
+static TrackLogPos logPos[TRACK_SHARDS];	/* how far the store holds each shard's log */
+
+static int64_t persistNow(clockid_t clock) {
+	struct timespec now;
+
+	clock_gettime(clock, &now);
+	return (int64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/*
+ * Queue one fix of producer q. Only the producer thread may call this.
+ * Returns the sequence number of the record, 0 if the ring was full
+ * and the fix was dropped.
+ */
+uint64_t persistPush(PersistQueue * q, clientId cid, int64_t received, uint32_t flags,
+		const struct gps_package * fix) {
+	uint64_t t = q->tail;
+	uint64_t used = t - __atomic_load_n(&q->head, __ATOMIC_ACQUIRE);
+	uint64_t one = 1;
+	TrackRecord * rec;
+
+	if (used == PERSIST_QUEUE) {
+		__atomic_store_n(&q->dropped, q->dropped + 1, __ATOMIC_RELAXED);
+		return 0;
+	}
+	rec = &q->slots[t & PERSIST_MASK];
+	rec->cid = cid;
+	rec->flags = flags;
+	rec->received = received;
+	rec->fix = *fix;
+	rec->pad = 0;
+	__atomic_store_n(&q->tail, t + 1, __ATOMIC_RELEASE);
+
+	/* the thread drains on its own every PERSIST_DRAIN_MS; only hurry it up when needed */
+	if (used + 1 == PERSIST_QUEUE / 2 && write(wakefd, &one, sizeof one) == -1)
+		perror("eventfd");
+	return t + 1;
+}
+
+/*
+ * Move everything queued in q into its track log; returns the bytes
+ * taken. A record the log refuses stays queued, head left on it, and
+ * the next drain retries it: nothing behind it is taken before it.
+ */
+static size_t persistDrain(PersistQueue * q) {
+	uint64_t h = q->head;
+	uint64_t t = __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+	uint64_t i;
+
+	for (i = h; i < t; i++)
+		if (trackAppend(&q->log, &q->slots[i & PERSIST_MASK]) == -1) {
+			t = i;
+			break;
+		}
+	/* at most two spans, the ring may wrap */
+	for (i = h; i < t; ) {
+		uint64_t end = (i | PERSIST_MASK) + 1 < t ? (i | PERSIST_MASK) + 1 : t;
+		storeAppend(&q->slots[i & PERSIST_MASK], (unsigned) (end - i));
+		i = end;
+	}
+	__atomic_store_n(&q->head, t, __ATOMIC_RELEASE);
+	return (size_t) (t - h) * sizeof(TrackRecord);
+}
+
+/* One group commit: everything taken so far reaches the disk */
+static void persistCommit(void) {
+	PersistQueue * q;
+	int i;
+
+	for (i = 0; i < nqueues; i++) {
+		q = &queues[i];
+		if (q->head != q->durable && trackSync(&q->log) == 0)
+			__atomic_store_n(&q->durable, q->head, __ATOMIC_RELEASE);
+	}
+	storeSync();
+}
+
+/* Checkpoint the store at the end of what the logs hold; after a commit */
+static void persistCheckpoint(void) {
+	int i;
+
+	for (i = 0; i < nqueues && i < TRACK_SHARDS; i++)
+		if (queues[i].log.fd != -1) {
+			logPos[i].segment = queues[i].log.segment;
+			logPos[i].offset = queues[i].log.size;
+		}
+	storeCheckpoint(logPos);
+}
+
+static void * persistThread(void * arg) {
+	struct pollfd pfd;
+	sigset_t mask;
+	size_t pending = 0;
+	int64_t now, lastCommit = persistNow(CLOCK_MONOTONIC), lastSweep = lastCommit;
+	int64_t lastCheckpoint = lastCommit;
+	uint64_t count;
+	bool stop;
+	int i;
+
+	/* leave job control signals to the shell thread */
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGCHLD);
+	sigaddset(&mask, SIGINT);
+	sigaddset(&mask, SIGTSTP);
+	pthread_sigmask(SIG_BLOCK, &mask, NULL);
+
+	pfd.fd = wakefd;
+	pfd.events = POLLIN;
+	while (1) {
+		stop = __atomic_load_n(&stopping, __ATOMIC_ACQUIRE);
+		for (i = 0; i < nqueues; i++)
+			pending += persistDrain(&queues[i]);
+
+		now = persistNow(CLOCK_MONOTONIC);
+		if (now - lastSweep >= PERSIST_SWEEP_MS * 1000000LL) {
+			storeSweep(persistNow(CLOCK_REALTIME));
+			lastSweep = now;
+		}
+		if (stop || (pending > 0 && (pending >= commitBytes || now - lastCommit >= commitNs))) {
+			persistCommit();
+			pending = 0;
+			lastCommit = now;
+			if (!stop && now - lastCheckpoint >= PERSIST_CHECKPOINT_MS * 1000000LL) {
+				persistCheckpoint();
+				lastCheckpoint = now;
+			}
+		}
+		if (stop)
+			break;
+
+		if (poll(&pfd, 1, PERSIST_DRAIN_MS) > 0 && read(wakefd, &count, sizeof count) == -1
+				&& errno != EAGAIN)
+			perror("eventfd");
+	}
+
+	/* the logs are committed: the last checkpoint covers them entirely */
+	for (i = 0; i < nqueues && i < TRACK_SHARDS; i++)
+		if (queues[i].log.fd != -1) {
+			logPos[i].segment = queues[i].log.segment;
+			logPos[i].offset = queues[i].log.size;
+		}
+	storeOffLine(logPos);
+	for (i = 0; i < nqueues; i++)
+		trackClose(&queues[i].log);
+	return NULL;
+}
+
+static int persistReplay(const TrackRecord * rec, void * ctx) {
+	(void) ctx;
+	storeAppend(rec, 1);
+	return 0;
+}
+
+/*
+ * Bring the track store up to date and start the persistence thread
+ * with one ring and track log per producer. The store is recovered
+ * from its checkpoint and only the log written after it is replayed.
+ * Records are committed at least every interval ms, and as soon as
+ * bytes of them are waiting. Returns the first client ID that has no
+ * stored history.
+ */
+clientId persistOnLine(int producers, unsigned interval, size_t bytes) {
+	int i;
+
+	storeRecover(logPos);
+	trackReplay(logPos, persistReplay, NULL);
+
+	if (posix_memalign((void **) &queues, 64, producers * sizeof(PersistQueue)) != 0) {
+		printf("Fail to allocate memory space\n");
+		exit(1);
+	}
+	memset(queues, 0, producers * sizeof(PersistQueue));
+	for (i = 0; i < producers; i++)
+		trackInit(&queues[i].log, i);
+	nqueues = producers;
+	commitNs = (long) interval * 1000000L;
+	commitBytes = bytes;
+
+	wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (wakefd == -1) {
+		perror("eventfd");
+		exit(1);
+	}
+	if (pthread_create(&thread, NULL, persistThread, NULL) != 0) {
+		fprintf(stderr, "persist: cannot start the persistence thread\n");
+		exit(1);
+	}
+	return storeNextClient();
+}
+
+/*
+ * Commit whatever the producers queued and stop the thread. The
+ * producers must have stopped pushing.
+ */
+void persistOffLine(void) {
+	uint64_t one = 1;
+
+	if (wakefd == -1)
+		return;
+	__atomic_store_n(&stopping, true, __ATOMIC_RELEASE);
+	if (write(wakefd, &one, sizeof one) == -1)
+		perror("eventfd");
+	pthread_join(thread, NULL);
+	close(wakefd);
+	wakefd = -1;
+}
+
+PersistQueue * persistQueue(int producer) {
+	return &queues[producer];
+}
+
+/* Sequence number of the last record queued by the producer */
+uint64_t persistQueued(const PersistQueue * q) {
+	return __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+}
+
+/* Sequence number up to which records are on disk */
+uint64_t persistDurable(const PersistQueue * q) {
+	return __atomic_load_n(&q->durable, __ATOMIC_ACQUIRE);
+}
@@ -0,0 +1,59 @@
+/*
+ * persist.h
+ *
+ * Write-behind persistence of received fixes. Each producer (a shard)
+ * hands records to a dedicated persistence thread through its own
+ * bounded single-producer/single-consumer ring, so the receive path
+ * never touches a file. The thread appends them to the producer's
+ * track log and makes them durable in groups: one fdatasync() per
+ * commit interval or byte threshold, whichever comes first.
+ *
+ * Every record a producer queues gets the next sequence number of
+ * that producer (1, 2, ...); persistDurable() tells how far the
+ * sequence is on disk. The thread also feeds every record to the
+ * track store, which keeps the per-client history, and checkpoints
+ * the store every PERSIST_CHECKPOINT_MS so that a restart replays
+ * only the tail of the logs.
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: yiding
+ */
+
+#ifndef PERSIST_H_
+#define PERSIST_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "tracklog.h"
+#include "trackstore.h"
+
+#define PERSIST_QUEUE		16384	/* records per producer ring, a power of 2 */
+#define PERSIST_INTERVAL	1000	/* default ms between two commits */
+#define PERSIST_BYTES		(1024 * 1024)	/* default bytes that force a commit */
+#define PERSIST_DRAIN_MS	100		/* rings are drained at least this often */
+#define PERSIST_SWEEP_MS	1000	/* old open blocks of the store are sealed this often */
+#define PERSIST_CHECKPOINT_MS 300000	/* the store is checkpointed this often */
+
+typedef struct persistQueue {
+	/* producer side */
+	uint64_t tail __attribute__((aligned(64)));	/* records queued, the last sequence */
+	unsigned long dropped;		/* records lost to a full ring */
+	/* consumer side */
+	uint64_t head __attribute__((aligned(64)));	/* records taken by the thread */
+	uint64_t durable;			/* records on disk */
+	TrackLog log;
+	TrackRecord slots[PERSIST_QUEUE];
+} PersistQueue;
+
+clientId persistOnLine(int producers, unsigned interval, size_t bytes);
+void persistOffLine(void);
+
+PersistQueue * persistQueue(int producer);
+uint64_t persistPush(PersistQueue * q, clientId cid, int64_t received, uint32_t flags,
+		const struct gps_package * fix);
+
+uint64_t persistQueued(const PersistQueue * q);
+uint64_t persistDurable(const PersistQueue * q);
+
+#endif /* PERSIST_H_ */
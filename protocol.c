@@ -11,17 +11,8 @@
 
 #include "protocol.h"
 
-#define UNINITPKG  0xDEADBEEF
-#define PROTOCOL   0x8EF3F38E
-
 #define COMPILE_ASSERT(pred) switch(0){case 0:case pred:;}
 
-typedef struct _comPackageHeader {
-	uint32_t protocolId;
-	uint32_t packageId;
-	uint32_t ack;
-} comHeader;
-
 void compile_time_assertions(void) {
 	COMPILE_ASSERT(sizeof(comHeader) == COM_HEADER_SIZE)
 }
@@ -43,6 +34,7 @@ comSender * newComSender(void) {
 		printf("Fail to allocate memory space\n");
 		exit(1);
 	}
+	ptr->latestId = 0;
 	return  ptr;
 }
 
@@ -87,11 +79,10 @@ int comSendData(comSender* pSender, comPackage* pPackage) {
 	((comHeader *)data)->packageId  = pSender->latestId;
 	((comHeader *)data)->ack        = header->ack;
 
-	data += sizeof(struct _comPackageHeader);
-	memcpy(data, pPackage->pData, pPackage->uDataBytes);
+	memcpy(data + sizeof(comHeader), pPackage->pData, pPackage->uDataBytes);
 
 	/* assuming a connection is previously established */
-	int bytesSent = send(pSender->sockfd, data, pPackage->uDataBytes, pSender->flag);
+	int bytesSent = send(pSender->sockfd, data, sizeof(comHeader) + pPackage->uDataBytes, pSender->flag);
 
 	free(data);
 	return bytesSent;
@@ -100,3 +91,82 @@ int comSendData(comSender* pSender, comPackage* pPackage) {
 int comReceiveData(const comReceiver* pReceiver, const comPackage* pPackage, char ** ppData, size_t* pLength) {
 	return 0;
 }
+
+/* little endian, whatever the host */
+void comPut32(unsigned char * p, uint32_t v) {
+	p[0] = (unsigned char) v;
+	p[1] = (unsigned char) (v >> 8);
+	p[2] = (unsigned char) (v >> 16);
+	p[3] = (unsigned char) (v >> 24);
+}
+
+uint32_t comGet32(const unsigned char * p) {
+	return (uint32_t) p[0] | (uint32_t) p[1] << 8 | (uint32_t) p[2] << 16 | (uint32_t) p[3] << 24;
+}
+
+static void comPutFloat(unsigned char * p, float f) {
+	uint32_t v;
+
+	memcpy(&v, &f, sizeof v);
+	comPut32(p, v);
+}
+
+static float comGetFloat(const unsigned char * p) {
+	uint32_t v = comGet32(p);
+	float f;
+
+	memcpy(&f, &v, sizeof f);
+	return f;
+}
+
+/* Read the comHeader in front of a datagram or batch */
+void comDecodeHeader(const unsigned char * in, comHeader * header) {
+	header->protocolId = comGet32(in);
+	header->packageId = comGet32(in + 4);
+	header->ack = comGet32(in + 8);
+}
+
+/* Write the COM_BATCH_SIZE bytes of a version 2 batch header */
+void comEncodeBatch(const comBatch * batch, unsigned char * out) {
+	comPut32(out, batch->header.protocolId);
+	comPut32(out + 4, batch->header.packageId);
+	comPut32(out + 8, batch->header.ack);
+	out[12] = batch->version;
+	out[13] = batch->flags;
+	out[14] = (unsigned char) batch->count;
+	out[15] = (unsigned char) (batch->count >> 8);
+	comPut32(out + 16, batch->length);
+	comPut32(out + 20, batch->stream);
+	comPut32(out + 24, (uint32_t) batch->time);
+	comPut32(out + 28, (uint32_t) ((uint64_t) batch->time >> 32));
+}
+
+void comDecodeBatch(const unsigned char * in, comBatch * batch) {
+	comDecodeHeader(in, &batch->header);
+	batch->version = in[12];
+	batch->flags = in[13];
+	batch->count = (uint16_t) (in[14] | in[15] << 8);
+	batch->length = comGet32(in + 16);
+	batch->stream = comGet32(in + 20);
+	batch->time = (int64_t) ((uint64_t) comGet32(in + 24) | (uint64_t) comGet32(in + 28) << 32);
+}
+
+/* Write the COM_FIX_SIZE bytes of a fix taken offset ms after its batch was opened */
+void comEncodeFix(const struct gps_package * fix, int32_t offset, unsigned char * out) {
+	comPutFloat(out, fix->lat);
+	comPutFloat(out + 4, fix->lon);
+	comPutFloat(out + 8, fix->alt);
+	comPutFloat(out + 12, fix->speed);
+	comPutFloat(out + 16, fix->heading);
+	comPut32(out + 20, (uint32_t) offset);
+}
+
+/* Read a fix; returns its time, in ms after its batch was opened */
+int32_t comDecodeFix(const unsigned char * in, struct gps_package * fix) {
+	fix->lat = comGetFloat(in);
+	fix->lon = comGetFloat(in + 4);
+	fix->alt = comGetFloat(in + 8);
+	fix->speed = comGetFloat(in + 12);
+	fix->heading = comGetFloat(in + 16);
+	return (int32_t) comGet32(in + 20);
+}
@@ -27,6 +27,72 @@ typedef unsigned clientId;
  */
 #define COM_HEADER_SIZE	12
 
+#define UNINITPKG  0xDEADBEEF
+#define PROTOCOL   0x8EF3F38E
+
+/*
+ * Header in front of every datagram. packageId counts up by one per
+ * datagram sent, so the receiver can spot losses and duplicates.
+ */
+typedef struct _comPackageHeader {
+	uint32_t protocolId;
+	uint32_t packageId;
+	uint32_t ack;
+} comHeader;
+
+/*
+ * Version 2 of the GPS stream, for connections and datagrams alike.
+ * Fixes go in batches, each behind a comHeader extended with what the
+ * frames of version 1 lack. Every field is little endian whatever the
+ * host, floats as their IEEE 754 bits:
+ *
+ *   0  protocolId  PROTOCOL
+ *   4  packageId   batch sequence number of the sender, from 1
+ *   8  ack
+ *  12  version     COM_VERSION_2
+ *  13  flags       COM_BATCH_BACKFILL: fixes held back while the uplink was down
+ *                  COM_BATCH_CRC: always set, the fixes are followed by the
+ *                  CRC-32C of header and fixes, 4 bytes not counted in length
+ *  14  count       fixes in the batch, 16 bits, at most COM_BATCH_MAX
+ *  16  length      bytes of fixes after the header, count * COM_FIX_SIZE
+ *  20  stream      source of a gateway the fixes come from, 0 for the sender
+ *  24  time        ms since the epoch the batch was opened, 64 bits
+ *
+ * then per fix lat, lon, alt, speed, heading and its time as signed ms
+ * after the batch's. A version 2 client opens its connection with a
+ * batch, empty if need be, where one of version 1 starts with a
+ * DELIMITER_BYTE: the first bytes tell the server which it is. A
+ * batch that breaks any of the above, or whose CRC does not hold, is
+ * dropped whole, so a fix is never taken from bytes damaged on the
+ * way; a flipped flag or length cannot turn the check off.
+ */
+#define COM_VERSION_1		1
+#define COM_VERSION_2		2
+#define COM_BATCH_SIZE		32		/* header of a batch */
+#define COM_FIX_SIZE		24
+#define COM_BATCH_MAX		32		/* fixes in one batch, so it fits a framer */
+#define COM_BATCH_BACKFILL	0x01
+#define COM_BATCH_CRC		0x02
+#define COM_CRC_SIZE		4		/* trailer of a batch */
+
+typedef struct comBatch {
+	comHeader header;
+	uint8_t version;
+	uint8_t flags;
+	uint16_t count;
+	uint32_t length;
+	streamId stream;
+	int64_t time;
+} comBatch;
+
+void comPut32(unsigned char * p, uint32_t v);
+uint32_t comGet32(const unsigned char * p);
+void comDecodeHeader(const unsigned char * in, comHeader * header);
+void comEncodeBatch(const comBatch * batch, unsigned char * out);
+void comDecodeBatch(const unsigned char * in, comBatch * batch);
+void comEncodeFix(const struct gps_package * fix, int32_t offset, unsigned char * out);
+int32_t comDecodeFix(const unsigned char * in, struct gps_package * fix);
+
 typedef struct comPackage {
 	char header[COM_HEADER_SIZE];
 	void * pData;
@@ -0,0 +1,123 @@
+/*
+ * reactor.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: yiding
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "reactor.h"
+
+AmbleReactor * newReactor(void) {
+	AmbleReactor * ptr = (AmbleReactor *) malloc( sizeof(AmbleReactor) );
+	if (ptr == NULL) {
+		printf("Fail to allocate memory space\n");
+		exit(1);
+	}
+
+	ptr->epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (ptr->epfd == -1) {
+		perror("epoll_create1");
+		exit(1);
+	}
+	ptr->ready = NULL;
+	ptr->readyTail = &ptr->ready;
+	return ptr;
+}
+
+void reactorClose(AmbleReactor * reactor) {
+	close(reactor->epfd);
+	free(reactor);
+}
+
+/*
+ * Watch ev->fd for the given events. The reactor keeps a pointer
+ * to ev, which must stay valid until reactorDel().
+ */
+int reactorAdd(AmbleReactor * reactor, reactorEvent * ev, uint32_t events) {
+	struct epoll_event ee;
+
+	ev->deferred = false;
+	ev->later = NULL;
+	ee.events = events;
+	ee.data.ptr = ev;
+	return epoll_ctl(reactor->epfd, EPOLL_CTL_ADD, ev->fd, &ee);
+}
+
+int reactorDel(AmbleReactor * reactor, reactorEvent * ev) {
+	reactorEvent ** link;
+
+	if (ev->deferred) {
+		for (link = &reactor->ready; *link != ev; link = &(*link)->later)
+			;
+		*link = ev->later;
+		if (reactor->readyTail == &ev->later)
+			reactor->readyTail = link;
+		ev->deferred = false;
+	}
+	return epoll_ctl(reactor->epfd, EPOLL_CTL_DEL, ev->fd, NULL);
+}
+
+/*
+ * Call the handler of ev again on the next pass with EPOLLIN, after
+ * the descriptors that became ready meanwhile. An edge triggered
+ * handler that stops reading before EAGAIN, to let other descriptors
+ * have their turn, would otherwise never hear of the rest.
+ */
+void reactorDefer(AmbleReactor * reactor, reactorEvent * ev) {
+	if (ev->deferred)
+		return;
+	ev->deferred = true;
+	ev->later = NULL;
+	*reactor->readyTail = ev;
+	reactor->readyTail = &ev->later;
+}
+
+/*
+ * Wait up to timeout ms for readiness and dispatch every ready
+ * descriptor to its handler, then the deferred ones; with deferred
+ * handlers pending it does not wait. Returns the number of events
+ * handled.
+ */
+int reactorPoll(AmbleReactor * reactor, int timeout) {
+	struct epoll_event events[REACTOR_MAX_EVENTS];
+	reactorEvent * ev;
+	int n, i, later;
+
+	/* only those deferred before this pass: a handler may defer itself again */
+	for (later = 0, ev = reactor->ready; ev != NULL; ev = ev->later)
+		later++;
+	if (later > 0)
+		timeout = 0;
+	n = epoll_wait(reactor->epfd, events, REACTOR_MAX_EVENTS, timeout);
+	if (n == -1) {
+		if (errno == EINTR)
+			return 0;
+		perror("epoll_wait");
+		exit(1);
+	}
+
+	for (i = 0; i < n; i++) {
+		ev = (reactorEvent *) events[i].data.ptr;
+		ev->handler(ev, events[i].events);
+	}
+	/* a handler may have removed any of them, take them one by one */
+	for (; later > 0 && (ev = reactor->ready) != NULL; later--) {
+		reactor->ready = ev->later;
+		if (reactor->ready == NULL)
+			reactor->readyTail = &reactor->ready;
+		ev->deferred = false;
+		ev->handler(ev, EPOLLIN);
+		n++;
+	}
+	return n;
+}
+
+void reactorRun(AmbleReactor * reactor) {
+	while (1)
+		reactorPoll(reactor, -1);
+}
@@ -0,0 +1,48 @@
+/*
+ * reactor.h
+ *
+ * A small readiness-based event loop on top of epoll. Each watched
+ * descriptor is described by a reactorEvent that the owner embeds in
+ * its own state, so registering a descriptor never allocates.
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: yiding
+ */
+
+#ifndef REACTOR_H_
+#define REACTOR_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/epoll.h>
+
+#define REACTOR_MAX_EVENTS 64
+
+typedef struct reactorEvent reactorEvent;
+typedef void (*reactorHandler)(reactorEvent * ev, uint32_t events);
+
+struct reactorEvent {
+	int fd;
+	reactorHandler handler;
+	void * ctx;
+	bool deferred;			/* on the ready list, see reactorDefer() */
+	reactorEvent * later;
+};
+
+typedef struct ambleReactor {
+	int epfd;
+	reactorEvent * ready;	/* handlers that stopped before draining their descriptor */
+	reactorEvent ** readyTail;
+} AmbleReactor;
+
+AmbleReactor * newReactor(void);
+void reactorClose(AmbleReactor * reactor);
+
+int reactorAdd(AmbleReactor * reactor, reactorEvent * ev, uint32_t events);
+int reactorDel(AmbleReactor * reactor, reactorEvent * ev);
+void reactorDefer(AmbleReactor * reactor, reactorEvent * ev);
+
+int reactorPoll(AmbleReactor * reactor, int timeout);
+void reactorRun(AmbleReactor * reactor);
+
+#endif /* REACTOR_H_ */
@@ -0,0 +1,119 @@
+/*
+ * registry.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: yiding
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "registry.h"
+
+/* value of a removed entry */
+static char tombstone;
+#define REGISTRY_TOMB ((void *) &tombstone)
+
+/* keys are mostly sequential, spread them over the table */
+static unsigned registryHash(uint64_t key) {
+	return (unsigned) ((key * 0x9E3779B97F4A7C15ULL) >> 32);
+}
+
+static registrySlot * registryAlloc(unsigned size) {
+	registrySlot * slots = (registrySlot *) calloc(size, sizeof(registrySlot));
+
+	if (slots == NULL) {
+		printf("Fail to allocate memory space\n");
+		exit(1);
+	}
+	return slots;
+}
+
+/* size is rounded up to a power of 2 */
+void registryInit(AmbleRegistry * reg, unsigned size) {
+	unsigned n = 16;
+
+	while (n < size)
+		n *= 2;
+	reg->slots = registryAlloc(n);
+	reg->mask = n - 1;
+	reg->count = 0;
+	reg->used = 0;
+}
+
+void registryFree(AmbleRegistry * reg) {
+	free(reg->slots);
+	reg->slots = NULL;
+}
+
+/* rebuild without tombstones, doubling the table if live entries need it */
+static void registryGrow(AmbleRegistry * reg) {
+	registrySlot * old = reg->slots;
+	unsigned oldSize = reg->mask + 1;
+	unsigned size = oldSize;
+	unsigned i, j;
+
+	while ((reg->count + 1) * 4 > size)
+		size *= 2;
+	reg->slots = registryAlloc(size);
+	reg->mask = size - 1;
+	reg->used = reg->count;
+	for (i = 0; i < oldSize; i++) {
+		if (old[i].value == NULL || old[i].value == REGISTRY_TOMB)
+			continue;
+		for (j = registryHash(old[i].key) & reg->mask; reg->slots[j].value != NULL;
+				j = (j + 1) & reg->mask)
+			;
+		reg->slots[j] = old[i];
+	}
+	free(old);
+}
+
+/*
+ * Index value under key; the key must not be present yet. Keeps
+ * the table at most half full, tombstones included.
+ */
+void registryInsert(AmbleRegistry * reg, uint64_t key, void * value) {
+	unsigned i;
+
+	if ((reg->used + 1) * 2 > reg->mask + 1)
+		registryGrow(reg);
+
+	for (i = registryHash(key) & reg->mask; reg->slots[i].value != NULL
+			&& reg->slots[i].value != REGISTRY_TOMB; i = (i + 1) & reg->mask)
+		;
+	if (reg->slots[i].value == NULL)
+		reg->used++;
+	reg->slots[i].key = key;
+	reg->slots[i].value = value;
+	reg->count++;
+}
+
+static registrySlot * registrySlotOf(const AmbleRegistry * reg, uint64_t key) {
+	unsigned i;
+
+	for (i = registryHash(key) & reg->mask; reg->slots[i].value != NULL; i = (i + 1) & reg->mask)
+		if (reg->slots[i].key == key && reg->slots[i].value != REGISTRY_TOMB)
+			return &reg->slots[i];
+	return NULL;
+}
+
+/* Returns the value indexed under key, NULL if there is none */
+void * registryFind(const AmbleRegistry * reg, uint64_t key) {
+	registrySlot * slot = registrySlotOf(reg, key);
+
+	return slot == NULL ? NULL : slot->value;
+}
+
+/* Drop key from the index; returns its value, NULL if there was none */
+void * registryRemove(AmbleRegistry * reg, uint64_t key) {
+	registrySlot * slot = registrySlotOf(reg, key);
+	void * value;
+
+	if (slot == NULL)
+		return NULL;
+	value = slot->value;
+	slot->value = REGISTRY_TOMB;
+	reg->count--;
+	return value;
+}
@@ -0,0 +1,38 @@
+/*
+ * registry.h
+ *
+ * Growable hash index from integer keys (client IDs, PIDs, job IDs)
+ * to the records that own them. Open addressing with linear probing;
+ * removal leaves a tombstone, so a lookup racing with a removal
+ * (a signal handler, or a reader without the write lock) never
+ * misses a live entry. Only inserts allocate.
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: yiding
+ */
+
+#ifndef REGISTRY_H_
+#define REGISTRY_H_
+
+#include <stdint.h>
+
+typedef struct registrySlot {
+	uint64_t key;
+	void * value;		/* NULL when the slot was never used */
+} registrySlot;
+
+typedef struct ambleRegistry {
+	registrySlot * slots;
+	unsigned mask;		/* table size - 1, a power of 2 */
+	unsigned count;		/* live entries */
+	unsigned used;		/* live entries plus tombstones */
+} AmbleRegistry;
+
+void registryInit(AmbleRegistry * reg, unsigned size);
+void registryFree(AmbleRegistry * reg);
+
+void registryInsert(AmbleRegistry * reg, uint64_t key, void * value);
+void * registryFind(const AmbleRegistry * reg, uint64_t key);
+void * registryRemove(AmbleRegistry * reg, uint64_t key);
+
+#endif /* REGISTRY_H_ */
@@ -14,9 +14,13 @@
 #include <stdbool.h>
 #include <fcntl.h>
 #include <stdarg.h>
+#include <errno.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
 
 
 #include "server.h"
+#include "crc32c.h"
 
 #define SUCCESS 0
 #define ERROR   1
@@ -44,9 +48,40 @@ static int Printf (const char * format, ...)
 int readnf (int, char *);
 int readline(int, char *, int);
 
-int ReadGPSPackage(int fd, struct gps_package * gpkg);
+/* fixes decoded per framer call */
+#define FIX_BATCH 32
 
-int server;         /* listening socket descriptor */
+/* reads of one connection before the next connection's turn */
+#define HANDLER_READS 16
+
+/* ns a fix may arrive later than the quickest one before the sender's clock counts as set back */
+#define SKEW_STEP (10LL * 1000000000)
+
+/* io_uring shards: queue depth and provided receive buffers */
+#define URING_ENTRIES	256
+#define URING_BUFFERS	1024
+#define URING_BUFSIZE	MAX_MSG
+
+static AmbleShard shards[MAX_SHARDS];	/* one event loop per worker thread */
+static int nshards;
+static serverAnswer answer;			/* called for every new connection */
+static bool started;				/* shard threads are running */
+
+/*
+ * Every open session, for the shell: a list in client ID order plus
+ * an index by client ID. Shards take the write lock on connect and
+ * hangup only; lookups and listings share the read lock.
+ */
+static pthread_rwlock_t sessionLock = PTHREAD_RWLOCK_INITIALIZER;
+static AmbleClientInfo * sessions;
+static AmbleClientInfo * sessionsLast;
+static AmbleRegistry sessionIndex;
+static clientId nextcid = 1;		/* next client ID to allocate */
+
+/* shard counters are written by their owner only, read by the shell */
+#define SHARD_INC(counter) __atomic_store_n(&(counter), (counter) + 1, __ATOMIC_RELAXED)
+#define SHARD_DEC(counter) __atomic_store_n(&(counter), (counter) - 1, __ATOMIC_RELAXED)
+#define SHARD_GET(counter) __atomic_load_n(&(counter), __ATOMIC_RELAXED)
 
 
 /**
@@ -54,168 +89,754 @@ int server;         /* listening socket descriptor */
 **/
 void cleanup()
 {
-    close(server);
+    serverOffLine();
     pthread_exit(NULL);
     return;
 } /* cleanup() */
 
 
-#include <yajl/yajl_tree.h>
+/*
+ * Hand one received fix to the outputs of its client
+ */
+static void deliver(AmbleClientInfo * clientInfo, struct gps_package * gps, int64_t received,
+        uint32_t age) {
+    SHARD_INC(clientInfo->shard->fixes);
+    if (age != 0) {
+        /* held back by the client: history only, the live outputs have moved on */
+        SHARD_INC(clientInfo->shard->backfill);
+        if (__atomic_load_n(&clientInfo->state, __ATOMIC_RELAXED) == SESSION_FOLLOWED)
+            printf("[@%u] %f, %f, %f, %f, %f (%u s late)\n", clientInfo->cid,
+                    gps->lat, gps->lon, gps->alt, gps->speed, gps->heading, age / 1000);
+        persistPush(clientInfo->shard->persist, clientInfo->cid,
+                received - (int64_t) age * 1000000, TRACK_BACKFILL, gps);
+        return;
+    }
+    if (__atomic_load_n(&clientInfo->state, __ATOMIC_RELAXED) == SESSION_FOLLOWED)
+        printf("[@%u] %f, %f, %f, %f, %f\n", clientInfo->cid,
+                gps->lat, gps->lon, gps->alt, gps->speed, gps->heading);
+    kmlPush(clientInfo->shard->kml, clientInfo->cid, gps);
+    persistPush(clientInfo->shard->persist, clientInfo->cid, received, 0, gps);
+}
 
-/* 
- * Parse the json package
+static AmbleClientInfo * serverAnswerClient(AmbleShard * shard, int remotefd,
+		const struct sockaddr_storage * remoteAddr, AmbleClientInfo * parent, streamId stream);
+
+/*
+ * The session fixes of stream go to: the client itself for stream 0,
+ * else the stream's own, opened the first time it is seen. NULL while
+ * that session is stopped; its fixes are dropped, like those of a
+ * stopped UDP sender, as the gateway's other streams share the socket.
  */
-int parse_gps_json(const char * buffer, struct gps_package * data) {
-    yajl_val node;
-    char errbuf[1024];
-
-    /* null plug buffers */
-    errbuf[0] = 0;
-
-    /* we have the whole config file in memory.  let's parse it ... */
-    node = yajl_tree_parse((const char *) buffer, errbuf, sizeof(errbuf));
-
-    /* parse error handling */
-    /*if (node == NULL) {
-        fprintf(stderr, "parse_error: ");
-        if (strlen(errbuf)) fprintf(stderr, " %s", errbuf);
-        else fprintf(stderr, "unknown error");
-        fprintf(stderr, "\n");
-        return 0;
-    }*/
-
-    /* ... and extract a nested value from the json file */
-    {
-        const char * lat_path[] = { "lat", (const char *) 0 };
-        const char * lon_path[] = { "lon", (const char *) 0 };
-        yajl_val lat = yajl_tree_get(node, lat_path, yajl_t_number);
-        yajl_val lon = yajl_tree_get(node, lon_path, yajl_t_number);
-        if (lat) data->lat = YAJL_GET_DOUBLE(lat);
-        else return 0;
-        if (lon) data->lon = YAJL_GET_DOUBLE(lon);
-        else return 0;
+static AmbleClientInfo * serverStream(AmbleClientInfo * clientInfo, streamId stream) {
+    AmbleClientInfo * child;
+
+    if (stream == 0)
+        return clientInfo;
+    for (child = clientInfo->streams; child != NULL && child->stream != stream;
+            child = child->sibling)
+        ;
+    if (child == NULL) {
+        if ((child = serverAnswerClient(clientInfo->shard, -1, &clientInfo->remoteAddr,
+                clientInfo, stream)) == NULL)
+            return NULL;
+        if (answer != NULL)
+            answer(child);
     }
+    if (__atomic_load_n(&child->state, __ATOMIC_RELAXED) == SESSION_STOPPED)
+        return NULL;
+    return child;
+}
 
-    yajl_tree_free(node);
+/*
+ * When a live fix sent at sent ms by the client's clock was taken, by
+ * ours. The offset between the clocks is the smallest gap seen yet
+ * between taking a fix and receiving it: fixes keep the spacing and
+ * order the sender gave them and none is stamped after it arrived.
+ */
+static int64_t serverTaken(AmbleClientInfo * clientInfo, int64_t sent, int64_t received) {
+    int64_t gap;
 
-    return 1;
+    if (sent == 0)
+        return received;    /* version 1: the receive time is all there is */
+    sent *= 1000000;
+    gap = received - sent;
+    if (gap < clientInfo->skew || gap - clientInfo->skew > SKEW_STEP)
+        clientInfo->skew = gap;
+    return sent + clientInfo->skew;
 }
 
+/*
+ * Decode every complete frame buffered for a client and deliver it
+ */
+static void serverConsume(AmbleClientInfo * clientInfo) {
+    struct gps_package fixes[FIX_BATCH];
+    uint32_t ages[FIX_BATCH];
+    int64_t sent[FIX_BATCH];
+    AmbleClientInfo * target;
+    struct timespec now;
+    int64_t received;
+    unsigned long rejects = clientInfo->framer.rejects;
+    int n, i;
 
-void outputKML(struct gps_package * gps, clientId cid)
-{
-	FILE * fpKML;
-    char kmlfile[50];
-    sprintf(kmlfile, "client-%d.kml", cid);
-	fpKML = fopen(kmlfile, "w");
-
-	int range, tilt, speed;
-	speed = (int)(gps->speed * 2.2369356f);
-	if (speed >= 10) {
-		range = ((speed / 100) * 350) + 650;
-		tilt = ((speed / 120) * 43) + 30;
-	} else {
-		range = 200;
-		tilt = 30;
-	}
-
-	fprintf(fpKML, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
-	fprintf(fpKML, "<kml xmlns=\"http://earth.google.com/kml/2.0\">\n");
-	fprintf(fpKML, "  <Placemark>\n");
-	fprintf(fpKML, "    <name>%d mph</name>\n", speed);
-	fprintf(fpKML, "    <description>AmbleTour ClientId %d</description>\n", cid);
-	fprintf(fpKML, "    <LookAt>\n");
-	fprintf(fpKML, "      <longitude>%f</longitude>\n", gps->lon);
-	fprintf(fpKML, "      <latitude>%f</latitude>\n", gps->lat);
-	fprintf(fpKML, "      <range>%d</range>\n", range);
-	fprintf(fpKML, "      <tilt>%d</tilt>\n", tilt);
-	fprintf(fpKML, "      <heading>%f</heading>\n", gps->heading);
-	fprintf(fpKML, "    </LookAt>\n");
-	fprintf(fpKML, "    <Point>\n");
-	fprintf(fpKML, "      <coordinates>%f,%f,%f</coordinates>\n", gps->lon, gps->lat, gps->alt);
-	fprintf(fpKML, "    </Point>\n");
-	fprintf(fpKML, "  </Placemark>\n");
-	fprintf(fpKML, "</kml>\n");
-
-	fflush(fpKML);
-	fclose(fpKML);
+    /* one receive time for everything that arrived in the same read */
+    clock_gettime(CLOCK_REALTIME_COARSE, &now);
+    received = (int64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+    /* a batch never spans two streams */
+    while ((n = framerDecode(&clientInfo->framer, fixes, ages, sent, FIX_BATCH)) > 0) {
+        if ((target = serverStream(clientInfo, clientInfo->framer.stream)) == NULL)
+            continue;
+        for (i = 0; i < n; i++)
+            deliver(target, &fixes[i],
+                    ages[i] == 0 ? serverTaken(clientInfo, sent[i], received) : received, ages[i]);
+    }
+    if (clientInfo->framer.rejects != rejects) {
+        rejects = clientInfo->framer.rejects - rejects;
+        __atomic_store_n(&clientInfo->rejects, clientInfo->rejects + rejects, __ATOMIC_RELAXED);
+        __atomic_store_n(&clientInfo->shard->rejects, clientInfo->shard->rejects + rejects,
+                __ATOMIC_RELAXED);
+    }
 }
 
 /**
- * Thread handler for incoming connections...
+ * Handler for readable client connections. The socket is edge
+ * triggered, so it is drained until read() would block. Bytes are
+ * read straight into the client's framer, which keeps a partial frame
+ * until the rest arrives. A client that keeps the socket full gets
+ * HANDLER_READS reads, then waits for the others to have their turn.
 **/
-void handler(AmbleClientInfo * clientInfo) {
-    int client_local;   /* keep a local copy of the client's socket descriptor */
-    FILE * fp;
-    struct gps_package gps;
-
-    char outfile[50];
-    sprintf(outfile, "client-%d.txt", clientInfo->cid);
-
+void handler(reactorEvent * ev, uint32_t events) {
+    AmbleClientInfo * clientInfo = (AmbleClientInfo *) ev->ctx;
+    unsigned char * span;
+    size_t len;
+    ssize_t rc;
+    int reads = 0;
 
-    fp = fopen(outfile, "w");
+    if (__atomic_load_n(&clientInfo->state, __ATOMIC_RELAXED) == SESSION_STOPPED)
+        return;     /* the shard stops watching it on its next control pass */
 
-    client_local = clientInfo->remotefd; /* store client socket descriptor */
-    
-    while(ReadGPSPackage(client_local, &gps)!= -1) {
-    	outputKML(&gps, clientInfo->cid);
-        fprintf(fp, "%f, %f\n", gps.lat, gps.lon);
-		fflush(fp);
+    while (1) {
+        if (reads++ == HANDLER_READS) {
+            reactorDefer(clientInfo->shard->reactor, ev);
+            return;
+        }
+        len = framerSpace(&clientInfo->framer, &span);
+        rc = read(clientInfo->remotefd, span, len);
+        if (rc > 0) {
+            framerCommit(&clientInfo->framer, (size_t) rc);
+            serverConsume(clientInfo);
+            continue;
+        }
+        if (rc == -1 && errno == EINTR)
+            continue;
+        if (rc == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return;
+        break;  /* EOF or error */
     }
-    
-    fclose(fp);
+
     serverHangup(clientInfo);
     return;
 } /* handler() */
 
-/* A not so elegant implementation that constantly checks if a
- * new connection is coming
- * TODO: we should use select instead
+/*
+ * Set up the session of a freshly accepted connection, or of stream
+ * of the gateway whose session is parent. Returns NULL if the client
+ * cannot be served.
  */
-int serverRings(AmbleClientInfo ** pClientInfoPtr) {
+static AmbleClientInfo * serverAnswerClient(AmbleShard * shard, int remotefd,
+		const struct sockaddr_storage * remoteAddr, AmbleClientInfo * parent, streamId stream) {
 	char s[INET6_ADDRSTRLEN];
-	struct sockaddr_storage remoteAddr;
-	int remotefd;
+	AmbleClientInfo * client;
 
-	/* non-blocking accept */
-	socklen_t sin_size = sizeof (remoteAddr);
-	remotefd = accept(server, (struct sockaddr *)&remoteAddr, &sin_size);
+	/* allocate an AmbleClient */
+	client = (AmbleClientInfo *) calloc(1, sizeof(AmbleClientInfo));
+	if (client == NULL) {
+		printf("Fail to allocate memory space\n");
+		exit(1);
+	}
+	client->state = SESSION_RUNNING;
+	client->shard = shard;
+	client->remotefd = remotefd;
+	client->remoteAddr = *remoteAddr;
+	client->skew = INT64_MAX;	/* until the first fix */
+	framerInit(&client->framer);
+	if (parent != NULL) {
+		client->stream = stream;
+		client->parent = parent;
+		client->sibling = parent->streams;
+		parent->streams = client;
+	}
 
-	if (remotefd != -1) {
-		/* allocate an AmbleClient */
-		*pClientInfoPtr = (AmbleClientInfo *) malloc(sizeof(AmbleClientInfo));
-		(*pClientInfoPtr)->remotefd = remotefd;
-		(*pClientInfoPtr)->remoteAddr = remoteAddr;
+	/* IDs are handed out in list order, listings can resume by ID */
+	pthread_rwlock_wrlock(&sessionLock);
+	client->cid = nextcid++;
+	client->prev = sessionsLast;
+	if (sessionsLast != NULL)
+		sessionsLast->next = client;
+	else
+		sessions = client;
+	sessionsLast = client;
+	registryInsert(&sessionIndex, client->cid, client);
+	pthread_rwlock_unlock(&sessionLock);
 
-		inet_ntop(remoteAddr.ss_family,
-				get_in_addr((struct sockaddr *)&remoteAddr),
-				s, sizeof s);
-		printf("server: got connection from %s\n", s);
-		return 1;
+	inet_ntop(remoteAddr->ss_family,
+			get_in_addr((struct sockaddr *)remoteAddr),
+			s, sizeof s);
+	if (parent != NULL) {
+		printf("server: shard %d got stream %u of [@%u] from %s\n", shard->id,
+				stream, parent->cid, s);
+		SHARD_INC(shard->streams);
 	}
 	else {
-		*pClientInfoPtr = NULL;
-		return 0;
+		printf("server: shard %d got %s from %s\n", shard->id,
+				remotefd == -1 ? "datagrams" : "connection", s);
+		SHARD_INC(shard->connections);
 	}
+	SHARD_INC(shard->active);
+
+	return client;
 }
 
-/* Clean up after the connection is broken */
+/*
+ * Listening socket became readable: drain the pending connection
+ * queue, handing every new client to the shard's event loop.
+ * Returns the number of connections accepted.
+ */
+int serverRings(AmbleShard * shard) {
+	struct sockaddr_storage remoteAddr;
+	socklen_t sin_size;
+	int remotefd;
+	int accepted = 0;
+	AmbleClientInfo * client;
+
+	while (1) {
+		sin_size = sizeof (remoteAddr);
+		remotefd = accept4(shard->listenfd, (struct sockaddr *)&remoteAddr, &sin_size,
+				SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (remotefd == -1) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				perror("accept4");
+			break;
+		}
+
+		if ((client = serverAnswerClient(shard, remotefd, &remoteAddr, NULL, 0)) == NULL)
+			continue;
+
+		client->ev.fd = remotefd;
+		client->ev.handler = handler;
+		client->ev.ctx = client;
+		client->watched = true;
+		if (reactorAdd(shard->reactor, &client->ev, EPOLLIN | EPOLLRDHUP | EPOLLET) == -1) {
+			perror("epoll_ctl");
+			serverHangup(client);
+			continue;
+		}
+		accepted++;
+
+		if (answer != NULL)
+			answer(client);
+	}
+	return accepted;
+}
+
+static void listenerReady(reactorEvent * ev, uint32_t events) {
+	serverRings((AmbleShard *) ev->ctx);
+}
+
+/* Clean up after the connection is broken, taking the streams it carried along */
 void serverHangup(AmbleClientInfo * pWorker) {
-	close(pWorker->remotefd);
+	while (pWorker->streams != NULL) {
+		AmbleClientInfo * child = pWorker->streams;
+
+		pWorker->streams = child->sibling;
+		serverHangup(child);
+	}
+
+	pthread_rwlock_wrlock(&sessionLock);
+	if (pWorker->prev != NULL)
+		pWorker->prev->next = pWorker->next;
+	else
+		sessions = pWorker->next;
+	if (pWorker->next != NULL)
+		pWorker->next->prev = pWorker->prev;
+	else
+		sessionsLast = pWorker->prev;
+	registryRemove(&sessionIndex, pWorker->cid);
+	pthread_rwlock_unlock(&sessionLock);
+
+	SHARD_DEC(pWorker->shard->active);
+	if (pWorker->remotefd != -1) {
+		if (pWorker->shard->uring == NULL && pWorker->watched)
+			reactorDel(pWorker->shard->reactor, &pWorker->ev);
+		close(pWorker->remotefd);
+	}
+	kmlEnd(pWorker->shard->kml, pWorker->cid);
 
 	free(pWorker);
 }
 
 /*
- * Initialize the server's listening port
+ * UDP ingest. A datagram is a comHeader followed by complete frames,
+ * or a version 2 batch, whose header starts with the comHeader.
+ * Each sender address maps to one session through the shard's peer
+ * table, so a datagram costs no allocation once its sender is known.
+ * A sender silent for UDP_IDLE ms has its session closed.
  */
-void serverOnLine(void) {
+#define UDP_BATCH	64		/* datagrams per recvmmsg() */
+#define UDP_MAX		1500	/* largest datagram we accept */
+
+struct udpBatch {
+	struct mmsghdr msgs[UDP_BATCH];
+	struct iovec iov[UDP_BATCH];
+	struct sockaddr_storage addrs[UDP_BATCH];
+	unsigned char bufs[UDP_BATCH][UDP_MAX];
+};
+
+static uint32_t addrHash(const struct sockaddr_storage * addr) {
+	const unsigned char * p = (const unsigned char *) addr;
+	size_t n = addr->ss_family == AF_INET6 ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in);
+	uint32_t h = 2166136261u;	/* FNV-1a */
+	size_t i;
+
+	for (i = 0; i < n; i++)
+		h = (h ^ p[i]) * 16777619u;
+	return h;
+}
+
+/* ms on the monotonic clock, to tell how long a sender has been silent */
+static int64_t shardNow(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+	return (int64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static bool addrEqual(const struct sockaddr_storage * a, const struct sockaddr_storage * b) {
+	if (a->ss_family != b->ss_family)
+		return false;
+	if (a->ss_family == AF_INET6) {
+		const struct sockaddr_in6 * x = (const struct sockaddr_in6 *) a;
+		const struct sockaddr_in6 * y = (const struct sockaddr_in6 *) b;
+		return x->sin6_port == y->sin6_port
+				&& !memcmp(&x->sin6_addr, &y->sin6_addr, sizeof(struct in6_addr));
+	}
+	else {
+		const struct sockaddr_in * x = (const struct sockaddr_in *) a;
+		const struct sockaddr_in * y = (const struct sockaddr_in *) b;
+		return x->sin_port == y->sin_port && x->sin_addr.s_addr == y->sin_addr.s_addr;
+	}
+}
+
+static void peersInsert(UdpPeers * peers, AmbleClientInfo * client) {
+	unsigned i;
+
+	if ((peers->count + 1) * 2 > peers->mask + 1) {
+		/* keep the table at most half full */
+		AmbleClientInfo ** old = peers->slots;
+		unsigned oldSize = peers->mask + 1;
+
+		peers->mask = oldSize * 2 - 1;
+		peers->slots = (AmbleClientInfo **) calloc(peers->mask + 1, sizeof(AmbleClientInfo *));
+		if (peers->slots == NULL) {
+			printf("Fail to allocate memory space\n");
+			exit(1);
+		}
+		peers->count = 0;
+		for (i = 0; i < oldSize; i++)
+			if (old[i] != NULL)
+				peersInsert(peers, old[i]);
+		free(old);
+	}
+
+	for (i = addrHash(&client->remoteAddr) & peers->mask; peers->slots[i] != NULL;
+			i = (i + 1) & peers->mask)
+		;
+	peers->slots[i] = client;
+	peers->count++;
+}
+
+static AmbleClientInfo * peersFind(const UdpPeers * peers, const struct sockaddr_storage * addr) {
+	unsigned i;
+
+	for (i = addrHash(addr) & peers->mask; peers->slots[i] != NULL; i = (i + 1) & peers->mask)
+		if (addrEqual(&peers->slots[i]->remoteAddr, addr))
+			return peers->slots[i];
+	return NULL;
+}
+
+/*
+ * End the sessions of the senders not heard from since before. The
+ * survivors are rehashed in place, which keeps the probe chains whole
+ * without tombstones.
+ */
+static void peersExpire(AmbleShard * shard, int64_t before) {
+	UdpPeers * peers = &shard->peers;
+	AmbleClientInfo ** old = peers->slots;
+	unsigned size = peers->mask + 1;
+	unsigned i, idle = 0;
+
+	for (i = 0; i < size; i++)
+		if (old[i] != NULL && old[i]->lastSeen < before)
+			idle++;
+	if (idle == 0)
+		return;
+
+	peers->slots = (AmbleClientInfo **) calloc(size, sizeof(AmbleClientInfo *));
+	if (peers->slots == NULL) {
+		printf("Fail to allocate memory space\n");
+		exit(1);
+	}
+	peers->count = 0;
+	for (i = 0; i < size; i++) {
+		if (old[i] == NULL)
+			continue;
+		if (old[i]->lastSeen >= before) {
+			peersInsert(peers, old[i]);
+			continue;
+		}
+		printf("server: shard %d closed UDP client [@%u], idle\n", shard->id, old[i]->cid);
+		SHARD_INC(shard->idle);
+		serverHangup(old[i]);
+	}
+	free(old);
+}
+
+/* one datagram from addr: check its sequence, then decode its frames */
+static void udpDatagram(AmbleShard * shard, const struct sockaddr_storage * addr,
+		const unsigned char * buf, size_t len) {
+	AmbleClientInfo * client;
+	comHeader header;
+	size_t done;
+	int32_t gap;
+
+	if (len < COM_HEADER_SIZE)
+		return;
+	comDecodeHeader(buf, &header);
+	if (header.protocolId != PROTOCOL)
+		return;
+
+	SHARD_INC(shard->datagrams);
+	if ((client = peersFind(&shard->peers, addr)) == NULL) {
+		if ((client = serverAnswerClient(shard, -1, addr, NULL, 0)) == NULL)
+			return;
+		client->lastId = header.packageId - 1;
+		peersInsert(&shard->peers, client);
+		if (answer != NULL)
+			answer(client);
+	}
+	client->lastSeen = shardNow();
+
+	if (__atomic_load_n(&client->state, __ATOMIC_RELAXED) == SESSION_STOPPED)
+		return;
+
+	gap = (int32_t) (header.packageId - client->lastId);
+	if (gap <= 0) {
+		/* duplicate, or arrived after a later datagram */
+		SHARD_INC(shard->dups);
+		return;
+	}
+	if (gap > 1)
+		__atomic_store_n(&shard->lost, shard->lost + (unsigned long) (gap - 1), __ATOMIC_RELAXED);
+	client->lastId = header.packageId;
+
+	/* frames never span datagrams; one can be larger than the ring */
+	framerInit(&client->framer);
+	if (len > COM_HEADER_SIZE && buf[COM_HEADER_SIZE] == COM_VERSION_2)
+		done = 0;
+	else
+		done = COM_HEADER_SIZE;
+	while (done < len) {
+		done += framerPush(&client->framer, buf + done, len - done);
+		serverConsume(client);
+	}
+}
+
+/* Drain the datagram socket, UDP_BATCH datagrams per system call */
+static void udpReceive(AmbleShard * shard) {
+	struct udpBatch * b = shard->udp;
+	int n, i;
+
+	do {
+		for (i = 0; i < UDP_BATCH; i++)
+			b->msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_storage);
+
+		n = recvmmsg(shard->udpfd, b->msgs, UDP_BATCH, MSG_DONTWAIT, NULL);
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				perror("recvmmsg");
+			return;
+		}
+		for (i = 0; i < n; i++) {
+			if (b->msgs[i].msg_hdr.msg_flags & MSG_TRUNC) {
+				/* the rest is gone, and with it the frame it cut */
+				SHARD_INC(shard->truncated);
+				continue;
+			}
+			udpDatagram(shard, &b->addrs[i], b->bufs[i], b->msgs[i].msg_len);
+		}
+	} while (n == UDP_BATCH);
+}
+
+static void udpReady(reactorEvent * ev, uint32_t events) {
+	udpReceive((AmbleShard *) ev->ctx);
+}
+
+static void udpOnLine(AmbleShard * shard) {
+	struct udpBatch * b;
+	int i;
+
+	b = (struct udpBatch *) calloc(1, sizeof(struct udpBatch));
+	if (b == NULL) {
+		printf("Fail to allocate memory space\n");
+		exit(1);
+	}
+	for (i = 0; i < UDP_BATCH; i++) {
+		b->iov[i].iov_base = b->bufs[i];
+		b->iov[i].iov_len = UDP_MAX;
+		b->msgs[i].msg_hdr.msg_iov = &b->iov[i];
+		b->msgs[i].msg_hdr.msg_iovlen = 1;
+		b->msgs[i].msg_hdr.msg_name = &b->addrs[i];
+	}
+	shard->udp = b;
+
+	shard->peers.mask = 63;
+	shard->peers.slots = (AmbleClientInfo **) calloc(shard->peers.mask + 1, sizeof(AmbleClientInfo *));
+	if (shard->peers.slots == NULL) {
+		printf("Fail to allocate memory space\n");
+		exit(1);
+	}
+}
+
+/* user_data of the multishot accept, UDP and control polls; sessions use their own address */
+#define URING_LISTENER 0
+#define URING_UDP      1
+#define URING_CTL      2
+#define URING_CANCEL   3
+#define URING_TICK     4
+
+/*
+ * Bring the shard in line with the state the shell asked for. Stopping
+ * a session stops reading its socket, so the client is held back by
+ * TCP flow control instead of losing fixes.
+ */
+static void shardApply(AmbleShard * shard, AmbleClientInfo * client) {
+	bool stopped = __atomic_load_n(&client->state, __ATOMIC_RELAXED) == SESSION_STOPPED;
+
+	if (client->remotefd == -1)
+		return;		/* UDP senders and streams are filtered on receipt */
+
+	if (stopped && client->watched) {
+		client->watched = false;
+		if (shard->uring == NULL)
+			reactorDel(shard->reactor, &client->ev);
+		else if (client->armed)
+			uringCancel(shard->uring, (uint64_t) (uintptr_t) client, URING_CANCEL);
+	}
+	else if (!stopped && shard->uring == NULL) {
+		/* edge triggered: (re)adding reports data that arrived meanwhile */
+		if (client->watched)
+			reactorDel(shard->reactor, &client->ev);
+		client->watched = true;
+		if (reactorAdd(shard->reactor, &client->ev, EPOLLIN | EPOLLRDHUP | EPOLLET) == -1)
+			serverHangup(client);
+	}
+	else if (!stopped && !client->watched) {
+		/* a receive still being cancelled is re-armed when it completes */
+		client->watched = true;
+		if (!client->armed) {
+			if (uringRecvMultishot(shard->uring, client->remotefd, (uint64_t) (uintptr_t) client) == 0)
+				client->armed = true;
+			else
+				serverHangup(client);
+		}
+	}
+}
+
+static AmbleClientInfo * sessionFind(clientId cid) {
+	return (AmbleClientInfo *) registryFind(&sessionIndex, cid);
+}
+
+/* Drain the state changes queued for this shard */
+static void shardControl(AmbleShard * shard) {
+	ShardCtl ctl[SHARD_CTL_QUEUE];
+	AmbleClientInfo * client;
+	unsigned n, i;
+	uint64_t count;
+
+	if (read(shard->ctlfd, &count, sizeof count) == -1 && errno != EAGAIN)
+		perror("eventfd");
+
+	pthread_mutex_lock(&shard->ctlLock);
+	n = shard->ctlCount;
+	memcpy(ctl, shard->ctl, n * sizeof(ShardCtl));
+	shard->ctlCount = 0;
+	pthread_mutex_unlock(&shard->ctlLock);
+
+	if (__atomic_load_n(&shard->stopping, __ATOMIC_ACQUIRE))
+		pthread_exit(NULL);
+
+	for (i = 0; i < n; i++) {
+		/* only this thread frees its sessions, so the pointer stays valid */
+		pthread_rwlock_rdlock(&sessionLock);
+		client = sessionFind(ctl[i].cid);
+		pthread_rwlock_unlock(&sessionLock);
+		if (client != NULL && client->shard == shard)
+			shardApply(shard, client);
+	}
+}
+
+static void ctlReady(reactorEvent * ev, uint32_t events) {
+	shardControl((AmbleShard *) ev->ctx);
+}
+
+/* Housekeeping of a shard, every SHARD_TICK ms */
+static void shardTick(AmbleShard * shard) {
+	uint64_t expirations;
+
+	if (read(shard->tickfd, &expirations, sizeof expirations) == -1 && errno != EAGAIN)
+		perror("timerfd");
+	if (shard->udpfd != -1)
+		peersExpire(shard, shardNow() - UDP_IDLE);
+}
+
+static void tickReady(reactorEvent * ev, uint32_t events) {
+	shardTick((AmbleShard *) ev->ctx);
+}
+
+
+/*
+ * Completion for a session: the kernel filled one provided buffer,
+ * or the multishot receive ended.
+ */
+static void uringReceived(AmbleShard * shard, AmbleClientInfo * client,
+		struct io_uring_cqe * cqe) {
+	AmbleUring * ring = shard->uring;
+
+	if (cqe->res > 0 && (cqe->flags & IORING_CQE_F_BUFFER)) {
+		unsigned bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+		const unsigned char * buf = uringBuffer(ring, bid);
+		size_t done = 0;
+
+		/* the ring may hold a partial frame, so a buffer can take two pushes */
+		while (done < (size_t) cqe->res) {
+			done += framerPush(&client->framer, buf + done, (size_t) cqe->res - done);
+			serverConsume(client);
+		}
+		uringRecycle(ring, bid);
+	}
+
+	if (!(cqe->flags & IORING_CQE_F_MORE)) {
+		/* receive is no longer armed: re-arm it unless the peer is gone */
+		client->armed = false;
+		if (cqe->res == 0 || (cqe->res < 0 && cqe->res != -ENOBUFS && cqe->res != -ECANCELED)) {
+			serverHangup(client);
+			return;
+		}
+		if (__atomic_load_n(&client->state, __ATOMIC_RELAXED) == SESSION_STOPPED)
+			return;		/* parked until the session is continued */
+		if (uringRecvMultishot(ring, client->remotefd, (uint64_t) (uintptr_t) client) == 0)
+			client->armed = true;
+		else
+			serverHangup(client);
+	}
+}
+
+static void uringAccepted(AmbleShard * shard, struct io_uring_cqe * cqe) {
+	struct sockaddr_storage remoteAddr;
+	socklen_t sin_size = sizeof (remoteAddr);
+	AmbleClientInfo * client;
+
+	if (cqe->res >= 0) {
+		memset(&remoteAddr, 0, sizeof remoteAddr);
+		getpeername(cqe->res, (struct sockaddr *)&remoteAddr, &sin_size);
+		if ((client = serverAnswerClient(shard, cqe->res, &remoteAddr, NULL, 0)) != NULL) {
+			client->armed = true;
+			client->watched = true;
+			if (uringRecvMultishot(shard->uring, client->remotefd,
+					(uint64_t) (uintptr_t) client) == -1) {
+				fprintf(stderr, "server: submission queue full\n");
+				serverHangup(client);
+			}
+			else if (answer != NULL)
+				answer(client);
+		}
+	}
+	else if (cqe->res != -EINTR && cqe->res != -ECONNABORTED)
+		fprintf(stderr, "accept: %s\n", strerror(-cqe->res));
+
+	if (!(cqe->flags & IORING_CQE_F_MORE))
+		uringAcceptMultishot(shard->uring, shard->listenfd, URING_LISTENER);
+}
+
+/*
+ * Event loop of an io_uring shard. Accepts and receives stay armed in
+ * the kernel; each wakeup handles the whole batch of completions and
+ * returns all consumed buffers at once.
+ */
+static void uringRun(AmbleShard * shard) {
+	AmbleUring * ring = shard->uring;
+	struct io_uring_cqe * cqe;
+	unsigned seen;
+
+	uringAcceptMultishot(ring, shard->listenfd, URING_LISTENER);
+	uringPollMultishot(ring, shard->ctlfd, URING_CTL);
+	uringPollMultishot(ring, shard->tickfd, URING_TICK);
+	if (shard->udpfd != -1)
+		uringPollMultishot(ring, shard->udpfd, URING_UDP);
+	while (1) {
+		if (uringWait(ring) == -1) {
+			if (errno == EINTR)
+				continue;
+			perror("io_uring_enter");
+			exit(1);
+		}
+
+		seen = 0;
+		while ((cqe = uringPeek(ring, seen)) != NULL) {
+			seen++;
+			if (cqe->user_data == URING_LISTENER)
+				uringAccepted(shard, cqe);
+			else if (cqe->user_data == URING_UDP) {
+				udpReceive(shard);
+				if (!(cqe->flags & IORING_CQE_F_MORE))
+					uringPollMultishot(ring, shard->udpfd, URING_UDP);
+			}
+			else if (cqe->user_data == URING_CTL) {
+				shardControl(shard);
+				if (!(cqe->flags & IORING_CQE_F_MORE))
+					uringPollMultishot(ring, shard->ctlfd, URING_CTL);
+			}
+			else if (cqe->user_data == URING_TICK) {
+				shardTick(shard);
+				if (!(cqe->flags & IORING_CQE_F_MORE))
+					uringPollMultishot(ring, shard->tickfd, URING_TICK);
+			}
+			else if (cqe->user_data == URING_CANCEL)
+				;	/* the cancelled receive completes on its own */
+			else
+				uringReceived(shard, (AmbleClientInfo *) (uintptr_t) cqe->user_data, cqe);
+		}
+		uringAdvance(ring, seen);
+		uringPublish(ring);
+	}
+}
+
+/*
+ * Create one socket on SERVER_PORT, listening for connections when
+ * socktype is SOCK_STREAM. SO_REUSEPORT lets every shard bind its own
+ * socket; the kernel spreads connections and senders among them.
+ */
+static int serverListen(int socktype, int backlog) {
 	struct addrinfo hints, *servinfo, *p;
 	int rv;
+	int listenfd = -1;
 
 	memset(&hints, 0, sizeof hints);
 	hints.ai_family = AF_UNSPEC; // set to AF_INET to force IPv4
-	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_socktype = socktype;
 	hints.ai_flags = AI_PASSIVE; // use my IP
 	if ((rv = getaddrinfo(NULL, SERVER_PORT, &hints, &servinfo)) != 0) {
 		fprintf(stderr, "getaddrinfo: %s\n", gai_strerror(rv));
@@ -224,23 +845,25 @@ void serverOnLine(void) {
 	// loop through all the results and bind to the first we can
 	int on=1;
 	for (p = servinfo; p != NULL ; p = p->ai_next) {
-		if ((server = socket(p->ai_family, p->ai_socktype, p->ai_protocol)) == -1) {
+		/* non-blocking socket, the event loop tells us when to accept */
+		if ((listenfd = socket(p->ai_family, p->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC,
+				p->ai_protocol)) == -1) {
 			perror("listener: socket");
 			continue;
 		}
-            if (setsockopt( server, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) < 0) {
-perror("set enable address reuse");
-continue;
-}
-
-	    /* set listening socket as non-blocking */
-	    if (fcntl(server, F_SETFL, O_NONBLOCK) < 0 ) {
-	    	perror("set non-blocking socket\n" );
+		if (setsockopt( listenfd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) < 0) {
+			perror("set enable address reuse");
+			close(listenfd);
+			continue;
+		}
+		if (setsockopt( listenfd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0) {
+			perror("set enable port reuse");
+			close(listenfd);
 			continue;
 		}
 
-		if (bind(server, p->ai_addr, p->ai_addrlen) == -1) {
-			close(server);
+		if (bind(listenfd, p->ai_addr, p->ai_addrlen) == -1) {
+			close(listenfd);
 			perror("listener: bind");
 			continue;
 		}
@@ -252,19 +875,331 @@ continue;
 	}
 	freeaddrinfo(servinfo);
 
-    /* wait for connection from client with a pending queue of size 5 */
-	if (listen(server, BACKLOG) == -1) {
+	if (socktype == SOCK_STREAM && listen(listenfd, backlog) == -1) {
 		perror("listen");
 		exit(1);
 	}
+	return listenfd;
+}
+
+/*
+ * Initialize the server's listening ports, one per shard
+ */
+void serverOnLine(const ServerConfig * config) {
+	struct itimerspec tick = {
+		{ SHARD_TICK / 1000, (SHARD_TICK % 1000) * 1000000 },
+		{ SHARD_TICK / 1000, (SHARD_TICK % 1000) * 1000000 }
+	};
+	int count = config->shards;
+	int i;
+
+	if (count < 1)
+		count = 1;
+	if (count > MAX_SHARDS)
+		count = MAX_SHARDS;
+
+	printf("server: %s frame scanner\n", framerSelect(FRAMER_SCAN_AUTO));
+	printf("server: %s crc32c\n", crc32cSelect(CRC32C_AUTO));
+	registryInit(&sessionIndex, SESSION_INDEX);
+	kmlOnLine(count, config->kml, config->kmlInterval);
+	trackConfigure(config->trackDir, config->trackSegment);
+	storeOnLine(config->trackDir, config->trackSegment);
+	/* client IDs continue after the recovered history, never reuse it */
+	nextcid = persistOnLine(count, config->commitInterval, config->commitBytes);
+	printf("server: client IDs from %u\n", nextcid);
+
+	for (i = 0; i < count; i++) {
+		AmbleShard * shard = &shards[i];
+
+		memset(shard, 0, sizeof(AmbleShard));
+		shard->id = i;
+		pthread_mutex_init(&shard->ctlLock, NULL);
+		shard->ctlfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (shard->ctlfd == -1) {
+			perror("eventfd");
+			exit(1);
+		}
+		shard->tickfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+		if (shard->tickfd == -1 || timerfd_settime(shard->tickfd, 0, &tick, NULL) == -1) {
+			perror("timerfd");
+			exit(1);
+		}
+		shard->persist = persistQueue(i);
+		shard->kml = kmlQueue(i);
+		shard->listenfd = serverListen(SOCK_STREAM, config->backlog);
+		shard->udpfd = -1;
+		if (config->udp) {
+			shard->udpfd = serverListen(SOCK_DGRAM, 0);
+			udpOnLine(shard);
+		}
+
+		if (config->backend == BACKEND_URING) {
+			shard->uring = newUring(URING_ENTRIES, URING_BUFFERS, URING_BUFSIZE);
+			if (shard->uring != NULL)
+				continue;
+			if (i == 0)
+				fprintf(stderr, "server: io_uring unavailable, falling back to epoll\n");
+		}
+
+		shard->reactor = newReactor();
+		shard->listener.fd = shard->listenfd;
+		shard->listener.handler = listenerReady;
+		shard->listener.ctx = shard;
+		if (reactorAdd(shard->reactor, &shard->listener, EPOLLIN | EPOLLET) == -1) {
+			perror("epoll_ctl");
+			exit(1);
+		}
+		shard->ctlEvent.fd = shard->ctlfd;
+		shard->ctlEvent.handler = ctlReady;
+		shard->ctlEvent.ctx = shard;
+		if (reactorAdd(shard->reactor, &shard->ctlEvent, EPOLLIN) == -1) {
+			perror("epoll_ctl");
+			exit(1);
+		}
+		shard->tickEvent.fd = shard->tickfd;
+		shard->tickEvent.handler = tickReady;
+		shard->tickEvent.ctx = shard;
+		if (reactorAdd(shard->reactor, &shard->tickEvent, EPOLLIN) == -1) {
+			perror("epoll_ctl");
+			exit(1);
+		}
+		if (shard->udpfd != -1) {
+			shard->udpEvent.fd = shard->udpfd;
+			shard->udpEvent.handler = udpReady;
+			shard->udpEvent.ctx = shard;
+			if (reactorAdd(shard->reactor, &shard->udpEvent, EPOLLIN | EPOLLET) == -1) {
+				perror("epoll_ctl");
+				exit(1);
+			}
+		}
+	}
+	nshards = count;
+}
+
+static void * shardThread(void * arg) {
+	AmbleShard * shard = (AmbleShard *) arg;
+	sigset_t mask;
+
+	/* leave job control signals to the shell thread */
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGCHLD);
+	sigaddset(&mask, SIGINT);
+	sigaddset(&mask, SIGTSTP);
+	pthread_sigmask(SIG_BLOCK, &mask, NULL);
+
+	if (shard->uring != NULL)
+		uringRun(shard);
+	else
+		reactorRun(shard->reactor);
 
+	/* control should never reach here */
+	return NULL;
 }
 
 /*
- * Let server go off-line
+ * Start one thread per shard running its event loop: accept new
+ * clients and receive their fixes. answer is called from the shard
+ * thread for every accepted connection.
+ */
+void serverStart(serverAnswer onAnswer) {
+	int i;
+
+	answer = onAnswer;
+	for (i = 0; i < nshards; i++) {
+		if (pthread_create(&shards[i].thread, NULL, shardThread, &shards[i]) != 0) {
+			fprintf(stderr, "server: cannot start shard %d\n", i);
+			exit(1);
+		}
+	}
+	started = true;
+}
+
+/*
+ * Print the per-shard connection and fix counters
+ */
+void serverReport(void) {
+	int i;
+	unsigned long conns = 0, active = 0, fixes = 0, kml = 0, records = 0, dropped = 0;
+
+	for (i = 0; i < nshards; i++) {
+		unsigned long c = SHARD_GET(shards[i].connections);
+		unsigned long a = SHARD_GET(shards[i].active);
+		unsigned long f = SHARD_GET(shards[i].fixes);
+		unsigned long k = SHARD_GET(shards[i].kml->published);
+		PersistQueue * q = shards[i].persist;
+
+		printf("shard %d: %lu connections, %lu active, %lu fixes, %lu kml", i, c, a, f, k);
+		if (SHARD_GET(shards[i].backfill) != 0)
+			printf(", %lu backfilled", SHARD_GET(shards[i].backfill));
+		if (SHARD_GET(shards[i].streams) != 0)
+			printf(", %lu streams", SHARD_GET(shards[i].streams));
+		if (SHARD_GET(shards[i].kml->dropped) != 0)
+			printf(", %lu kml dropped", SHARD_GET(shards[i].kml->dropped));
+		if (SHARD_GET(shards[i].rejects) != 0)
+			printf(", %lu rejected", SHARD_GET(shards[i].rejects));
+		if (shards[i].udpfd != -1)
+			printf(", %lu datagrams, %lu lost, %lu duplicate, %lu truncated, %lu idle",
+					SHARD_GET(shards[i].datagrams), SHARD_GET(shards[i].lost),
+					SHARD_GET(shards[i].dups), SHARD_GET(shards[i].truncated),
+					SHARD_GET(shards[i].idle));
+		printf("\n");
+		printf("  track log: %lu records in %lu segments, %llu queued, durable up to %llu",
+				SHARD_GET(q->log.records), SHARD_GET(q->log.segments),
+				(unsigned long long) persistQueued(q), (unsigned long long) persistDurable(q));
+		if (SHARD_GET(q->dropped) != 0)
+			printf(", %lu dropped", SHARD_GET(q->dropped));
+		printf("\n");
+		records += SHARD_GET(q->log.records);
+		dropped += SHARD_GET(q->dropped);
+		conns += c;
+		active += a;
+		fixes += f;
+		kml += k;
+	}
+	printf("total: %lu connections, %lu active, %lu fixes, %lu kml, %lu records, %lu dropped\n",
+			conns, active, fixes, kml, records, dropped);
+}
+
+/*
+ * Print up to max open sessions (at most SESSION_PAGE), starting with
+ * the first one whose ID is at least from. The page is copied under
+ * the read lock and printed after it is released, so a long listing
+ * never holds up the shards. Returns the ID to continue from, 0 after
+ * the last session.
+ */
+clientId serverListSessions(clientId from, int max) {
+	struct {
+		clientId cid;
+		int shard;
+		int state;
+		bool udp;
+		streamId stream;
+		clientId parent;
+		unsigned long rejects;
+		char addr[INET6_ADDRSTRLEN];
+	} page[SESSION_PAGE];
+	AmbleClientInfo * client = NULL;
+	clientId cid, resume = 0;
+	int n = 0, i;
+
+	if (max > SESSION_PAGE)
+		max = SESSION_PAGE;
+
+	pthread_rwlock_rdlock(&sessionLock);
+	if (sessions != NULL && from <= sessions->cid)
+		client = sessions;
+	else
+		for (cid = from; cid < nextcid && (client = sessionFind(cid)) == NULL; cid++)
+			;
+	for (; client != NULL && n < max; client = client->next, n++) {
+		page[n].cid = client->cid;
+		page[n].shard = client->shard->id;
+		page[n].state = __atomic_load_n(&client->state, __ATOMIC_RELAXED);
+		page[n].udp = client->remotefd == -1 && client->parent == NULL;
+		page[n].stream = client->stream;
+		page[n].parent = client->parent != NULL ? client->parent->cid : 0;
+		page[n].rejects = __atomic_load_n(&client->rejects, __ATOMIC_RELAXED);
+		inet_ntop(client->remoteAddr.ss_family,
+				get_in_addr((struct sockaddr *)&client->remoteAddr),
+				page[n].addr, sizeof page[n].addr);
+	}
+	if (client != NULL)
+		resume = client->cid;
+	pthread_rwlock_unlock(&sessionLock);
+
+	for (i = 0; i < n; i++) {
+		printf("[@%u] (shard %d) ", page[i].cid, page[i].shard);
+		switch (page[i].state) {
+		case SESSION_RUNNING:
+			printf("Running ");
+			break;
+		case SESSION_FOLLOWED:
+			printf("Foreground ");
+			break;
+		case SESSION_STOPPED:
+			printf("Stopped ");
+			break;
+		}
+		if (page[i].parent != 0)
+			printf("stream %u of [@%u] %s", page[i].stream, page[i].parent, page[i].addr);
+		else
+			printf("%s client %s", page[i].udp ? "UDP" : "TCP", page[i].addr);
+		if (page[i].rejects != 0)
+			printf(", %lu rejected", page[i].rejects);
+		printf("\n");
+	}
+	return resume;
+}
+
+/*
+ * Move session cid to state; the shard owning it catches up with the
+ * change asynchronously. Returns -1 if there is no such session or its
+ * shard is busy.
+ */
+int serverSession(clientId cid, int state) {
+	AmbleClientInfo * client;
+	AmbleShard * shard;
+	uint64_t one = 1;
+	int rc = -1;
+
+	pthread_rwlock_rdlock(&sessionLock);
+	if ((client = sessionFind(cid)) != NULL) {
+		shard = client->shard;
+		pthread_mutex_lock(&shard->ctlLock);
+		if (shard->ctlCount < SHARD_CTL_QUEUE) {
+			shard->ctl[shard->ctlCount++].cid = cid;
+			__atomic_store_n(&client->state, state, __ATOMIC_RELAXED);
+			rc = 0;
+		}
+		pthread_mutex_unlock(&shard->ctlLock);
+		if (rc == 0 && write(shard->ctlfd, &one, sizeof one) == -1)
+			perror("eventfd");
+	}
+	pthread_rwlock_unlock(&sessionLock);
+	return rc;
+}
+
+/* State of session cid, -1 once it is gone */
+int serverSessionState(clientId cid) {
+	AmbleClientInfo * client;
+	int state = -1;
+
+	pthread_rwlock_rdlock(&sessionLock);
+	if ((client = sessionFind(cid)) != NULL)
+		state = __atomic_load_n(&client->state, __ATOMIC_RELAXED);
+	pthread_rwlock_unlock(&sessionLock);
+	return state;
+}
+
+/*
+ * Let server go off-line. Shard threads exit, then everything they
+ * queued is committed to the track log and their clients' last fixes are
+ * published to client-N.kml before this returns.
  */
 void serverOffLine(void) {
-	close(server);
+	uint64_t one = 1;
+	int i;
+
+	for (i = 0; i < nshards; i++) {
+		if (shards[i].reactor != NULL)
+			reactorDel(shards[i].reactor, &shards[i].listener);
+		close(shards[i].listenfd);
+		if (shards[i].udpfd != -1)
+			close(shards[i].udpfd);
+	}
+
+	if (started) {
+		for (i = 0; i < nshards; i++) {
+			__atomic_store_n(&shards[i].stopping, true, __ATOMIC_RELEASE);
+			if (write(shards[i].ctlfd, &one, sizeof one) == -1)
+				perror("eventfd");
+		}
+		for (i = 0; i < nshards; i++)
+			pthread_join(shards[i].thread, NULL);
+		started = false;
+	}
+	persistOffLine();
+	kmlOffLine();
 }
 
 
@@ -309,98 +1244,3 @@ int readline(int fd, char *str, int maxlen)
   *str='\0';       /* null-terminate the buffer */
   return (n);   /* return number of characters read */
 } /* readline() */
-
-
-typedef enum {
-	INIT, TYPE, NOFIXFOUND, GPSFOUND
-} State_t;
-
-/*                     GPS DATA              DELIMITER         TYPE         Offset */
-#define BORDER (sizeof(struct gps_package) + sizeof(uint8_t) + sizeof(uint8_t) - 1)
-
-/**
- * ReadGPSPackage()
-**/
-int ReadGPSPackage(int fd, struct gps_package * gpkg) {
-	int readcount; /* no. characters read */
-	unsigned char buff[MAX_MSG];
-	struct gps_package * marker = NULL;
-	int foundType;
-	State_t state = INIT;
-
-	readcount = (int)read(fd, buff, sizeof(buff));
-	Printf("readcound %d\n", readcount);
-	if (readcount == -1)
-		return -1;
-	else if (readcount == 0)
-		return -1;
-	else {
-		int i = 0;
-		while( i < readcount ) {
-			switch (state) {
-			int n,rc;
-			case INIT:
-				Printf("INIT 0x%X\n",buff[i]);
-
-				if (buff[i] == DELIMITER_BYTE)
-					state = TYPE;
-				++i;
-				if (i+BORDER > readcount) {
-					for (n=readcount; n<i+BORDER; n++) {
-						rc = (int)read(fd, &buff[n], 1);
-						if (rc == -1)
-							return -1;
-					}
-					readcount=i+BORDER;
-					Printf("new readcount %d\n", readcount);
-				}
-				break;
-			case TYPE:
-				Printf("TYPE 0x%02X\n",buff[i]);
-				if (buff[i] == NOFIX_BYTE) {
-					state = NOFIXFOUND;
-					foundType = NOFIXFOUND;
-				}
-				else if (buff[i] == GPS_BYTE) {
-					state = GPSFOUND;
-					foundType = GPSFOUND;
-				}
-				else
-					state = INIT;
-				++i;
-				break;
-			case NOFIXFOUND:
-				state = INIT;
-				break;
-			case GPSFOUND:
-				Printf("GPSFOUND i=%d\n",i);
-				if (foundType == GPSFOUND) {
-					if ((i + (int)sizeof(struct gps_package)) <= readcount) {
-						marker = (struct gps_package *)(buff+i);
-						Printf("marker %f, %f\n", marker->lat, marker->lon);
-						*gpkg = *marker;
-						state = INIT;
-						i += sizeof(struct gps_package);
-					}
-					else {
-						printf("Fatal: GPS Package Parsing Error\n");
-						return -1;
-					}
-				}
-				else if (foundType == NOFIXFOUND){
-					state = INIT;
-					i = readcount;
-				}
-				else
-					return -1;
-				break;
-			default:
-				fprintf(stderr, "State machine error\n");
-				exit(-1);
-			}
-
-		}
-		return readcount;
-	}
-
-} /* readline() */
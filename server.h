@@ -9,21 +9,141 @@
 #ifndef SERVER_H_
 #define SERVER_H_
 
+#include <pthread.h>
+
 #include "protocol.h"
+#include "framer.h"
+#include "kml.h"
+#include "persist.h"
+#include "reactor.h"
+#include "registry.h"
+#include "uring.h"
+
+
+#define MAX_SHARDS 256
+
+/* how a shard waits for and receives data */
+typedef enum {
+	BACKEND_EPOLL,	/* readiness notification, read() per socket */
+	BACKEND_URING	/* multishot io_uring receives into provided buffers */
+} serverBackend;
+
+/* startup configuration of the server */
+typedef struct serverConfig {
+	int shards;				/* number of shards (event loop threads) */
+	int backlog;			/* pending connection queue of each shard */
+	serverBackend backend;
+	bool udp;				/* also receive fixes as UDP datagrams */
+	kmlPublish kml;			/* how client-N.kml files are replaced */
+	unsigned kmlInterval;	/* minimum ms between two client-N.kml updates */
+	const char * trackDir;	/* where track log segments are written */
+	size_t trackSegment;	/* size of a track log segment */
+	unsigned commitInterval;	/* maximum ms between two track log commits */
+	size_t commitBytes;		/* track log bytes that force a commit */
+} ServerConfig;
+
+/* session states, the shell's view of a connected client */
+#define SESSION_RUNNING		1	/* receiving in the background */
+#define SESSION_FOLLOWED	2	/* receiving, fixes echoed to the shell */
+#define SESSION_STOPPED		3	/* not reading from the client */
+
+#define SESSION_INDEX	1024	/* initial size of the session index */
+#define SESSION_PAGE	64		/* sessions listed per page */
+
+#define SHARD_CTL_QUEUE 64
+#define SHARD_TICK		1000	/* ms between two housekeeping passes of a shard */
+#define UDP_IDLE		300000	/* ms of silence that end a UDP sender's session */
 
+/* a session whose state changed, queued for the shard that owns it */
+typedef struct shardCtl {
+	clientId cid;
+} ShardCtl;
+
+struct ambleOperator;
+struct udpBatch;
+
+/* UDP senders of a shard, keyed by source address */
+typedef struct udpPeers {
+	struct ambleOperator ** slots;
+	unsigned mask;
+	unsigned count;
+} UdpPeers;
+
+/*
+ * A shard is one worker thread with its own listening socket (bound
+ * with SO_REUSEPORT) and its own event loop. It owns the sessions it
+ * accepts end to end; its counters are only written by its thread.
+ */
+typedef struct ambleShard {
+	int id;
+	int listenfd;
+	AmbleReactor * reactor;		/* epoll backend */
+	reactorEvent listener;
+	AmbleUring * uring;			/* io_uring backend, NULL when using epoll */
+	int udpfd;					/* datagram socket, -1 without UDP */
+	reactorEvent udpEvent;
+	struct udpBatch * udp;		/* recvmmsg() buffers */
+	UdpPeers peers;
+	int ctlfd;					/* eventfd: state changes are queued */
+	reactorEvent ctlEvent;
+	int tickfd;					/* timerfd: housekeeping every SHARD_TICK ms */
+	reactorEvent tickEvent;
+	pthread_mutex_t ctlLock;
+	ShardCtl ctl[SHARD_CTL_QUEUE];
+	unsigned ctlCount;
+	bool stopping;				/* exit on the next control pass */
+	PersistQueue * persist;		/* fixes on their way to the track log */
+	KmlQueue * kml;				/* live fixes on their way to client-N.kml */
+	pthread_t thread;
+	unsigned long connections;	/* connections accepted */
+	unsigned long active;		/* sessions currently open */
+	unsigned long fixes;		/* GPS fixes received */
+	unsigned long backfill;		/* of them, sent late by their client */
+	unsigned long datagrams;	/* UDP datagrams received */
+	unsigned long lost;			/* UDP datagrams missing from the sequence */
+	unsigned long dups;			/* UDP datagrams seen before */
+	unsigned long truncated;	/* UDP datagrams longer than UDP_MAX */
+	unsigned long idle;			/* UDP senders closed after UDP_IDLE ms of silence */
+	unsigned long streams;		/* gateway streams opened as sessions */
+	unsigned long rejects;		/* v2 batches dropped for a bad CRC */
+} AmbleShard;
 
 typedef struct ambleOperator {
 	clientId cid;
-	int remotefd;
+	int state;			/* SESSION_RUNNING, SESSION_FOLLOWED or SESSION_STOPPED */
+	AmbleShard * shard;	/* shard serving this client */
+	struct ambleOperator * prev;	/* list of all sessions */
+	struct ambleOperator * next;
+	int remotefd;		/* connection, -1 for a UDP sender or a stream */
 	struct sockaddr_storage remoteAddr;
+	streamId stream;	/* of a gateway, 0 for the sender itself */
+	struct ambleOperator * parent;	/* the gateway's own session, for a stream */
+	struct ambleOperator * streams;	/* of a gateway, each its own session */
+	struct ambleOperator * sibling;
+	uint32_t lastId;	/* last UDP packageId received */
+	int64_t lastSeen;	/* ms, monotonic, a UDP sender was last heard from */
+	int64_t skew;		/* ns to add to the client's clock for ours, see serverTaken() */
+	unsigned long rejects;	/* v2 batches dropped for a bad CRC */
+	bool watched;		/* the shard is receiving from remotefd */
+	bool armed;			/* io_uring: a multishot receive is in flight */
+	reactorEvent ev;	/* readiness registration of remotefd */
+	GpsFramer framer;	/* frame reassembly across reads */
 } AmbleClientInfo;
 
-void serverOnLine(void);
+typedef void (*serverAnswer)(AmbleClientInfo * client);
+
+void serverOnLine(const ServerConfig * config);
 void serverOffLine(void);
+void serverStart(serverAnswer answer);
+void serverReport(void);
+
+clientId serverListSessions(clientId from, int max);
+int serverSession(clientId cid, int state);
+int serverSessionState(clientId cid);
 
-int serverRings(AmbleClientInfo ** pClientInfoPtr);
+int serverRings(AmbleShard * shard);
 void serverHangup(AmbleClientInfo * client);
 
-void handler(AmbleClientInfo * clientInfo);
+void handler(reactorEvent * ev, uint32_t events);
 
 #endif /* SERVER_H_ */
@@ -0,0 +1,177 @@
+/*
+ * sink.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: yiding
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/uio.h>
+
+#include "sink.h"
+
+static int64_t sinkNow(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* the consumer may take more now */
+static void sinkReady(reactorEvent * ev, uint32_t events) {
+	(void) events;
+	if (sinkFlush((Sink *) ev->ctx) == -1)
+		exit(1);
+}
+
+/*
+ * Queue output for fd, which is made non-blocking. The sink watches
+ * fd on reactor for the queue to move again; descriptors epoll does
+ * not take, regular files, never make a write wait anyway.
+ */
+void sinkInit(Sink * sink, AmbleReactor * reactor, const char * name, int fd) {
+	sink->name = name;
+	sink->ev.fd = fd;
+	sink->ev.handler = sinkReady;
+	sink->ev.ctx = sink;
+	sink->head = sink->tail = 0;
+	sink->mhead = sink->mtail = 0;
+	sink->queues = sink->writes = sink->dropped = 0;
+	sink->lagMax = 0;
+	sink->batch = 0;
+	sink->delay = 0;
+
+	sink->flags = fcntl(fd, F_GETFL);
+	if (sink->flags == -1 || fcntl(fd, F_SETFL, sink->flags | O_NONBLOCK) == -1)
+		perror(name);
+	/* edge triggered: it only matters when a full socket or tty drains */
+	if (reactorAdd(reactor, &sink->ev, EPOLLOUT | EPOLLET) == -1 && errno != EPERM)
+		perror(name);
+}
+
+/*
+ * Queue n bytes, all or nothing. Returns false if they do not fit, in
+ * which case they are dropped. Nothing is sent before sinkFlush().
+ */
+bool sinkWrite(Sink * sink, const void * data, size_t n) {
+	size_t at = (size_t) (sink->tail % SINK_BUFFER), first;
+	int64_t now;
+	SinkMark * last;
+
+	if (n > SINK_BUFFER - sinkQueued(sink)) {
+		sink->dropped++;
+		return false;
+	}
+	first = n < SINK_BUFFER - at ? n : SINK_BUFFER - at;
+	memcpy(sink->buf + at, data, first);
+	memcpy(sink->buf, (const unsigned char *) data + first, n - first);
+	sink->tail += n;
+	sink->queues++;
+
+	/* writes of the same ms, or past the last mark, share one: its age is the older */
+	now = sinkNow();
+	last = &sink->marks[(sink->mtail - 1) % SINK_MARKS];
+	if (sink->mtail != sink->mhead && (last->queued == now || sink->mtail - sink->mhead == SINK_MARKS))
+		last->end = sink->tail;
+	else {
+		last = &sink->marks[sink->mtail++ % SINK_MARKS];
+		last->end = sink->tail;
+		last->queued = now;
+	}
+	return true;
+}
+
+/*
+ * Send as much of the queue as the consumer takes. Returns 0, also
+ * when some is left for later, or -1 on a write error.
+ */
+int sinkFlush(Sink * sink) {
+	int64_t now;
+
+	while (sink->head != sink->tail) {
+		size_t at = (size_t) (sink->head % SINK_BUFFER);
+		size_t n = sinkQueued(sink);
+		struct iovec iov[2];
+		ssize_t rc;
+
+		iov[0].iov_base = sink->buf + at;
+		iov[0].iov_len = n < SINK_BUFFER - at ? n : SINK_BUFFER - at;
+		iov[1].iov_base = sink->buf;
+		iov[1].iov_len = n - iov[0].iov_len;
+		rc = writev(sink->ev.fd, iov, iov[1].iov_len ? 2 : 1);
+		if (rc == -1) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				break;
+			fprintf(stderr, "gpspipe: %s write error, %s(%d)\n", sink->name,
+					strerror(errno), errno);
+			return -1;
+		}
+		sink->head += (uint64_t) rc;
+		sink->writes++;
+	}
+
+	now = sinkNow();
+	while (sink->mhead != sink->mtail && sink->marks[sink->mhead % SINK_MARKS].end <= sink->head) {
+		int64_t lag = now - sink->marks[sink->mhead++ % SINK_MARKS].queued;
+
+		if (lag > sink->lagMax)
+			sink->lagMax = lag;
+	}
+	return 0;
+}
+
+/*
+ * Hold output back until batch bytes are queued or the oldest waited
+ * delay ms, for consumers that do better with few large writes than
+ * with many small ones, such as log files.
+ */
+void sinkPolicy(Sink * sink, size_t batch, unsigned delay) {
+	sink->batch = batch;
+	sink->delay = delay;
+}
+
+/* Flush if the policy says it is time. Returns as sinkFlush() */
+int sinkPoll(Sink * sink) {
+	if (sink->head == sink->tail
+			|| (sinkQueued(sink) < sink->batch && sinkLag(sink) < (int64_t) sink->delay))
+		return 0;
+	return sinkFlush(sink);
+}
+
+/* ms until sinkPoll() will flush, 0 if it will now, -1 if nothing is queued */
+int sinkTimeout(const Sink * sink) {
+	int64_t left;
+
+	if (sink->head == sink->tail)
+		return -1;
+	if (sinkQueued(sink) >= sink->batch)
+		return 0;
+	left = (int64_t) sink->delay - sinkLag(sink);
+	return left > 0 ? (int) left : 0;
+}
+
+/* Send everything queued, waiting for the consumer, and give fd its flags back */
+void sinkDrain(Sink * sink) {
+	if (sink->flags != -1)
+		fcntl(sink->ev.fd, F_SETFL, sink->flags);
+	sinkFlush(sink);
+}
+
+size_t sinkQueued(const Sink * sink) {
+	return (size_t) (sink->tail - sink->head);
+}
+
+/* ms the oldest write still queued has waited, 0 if none */
+int64_t sinkLag(const Sink * sink) {
+	if (sink->mhead == sink->mtail)
+		return 0;
+	return sinkNow() - sink->marks[sink->mhead % SINK_MARKS].queued;
+}
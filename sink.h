@@ -0,0 +1,63 @@
+/*
+ * sink.h
+ *
+ * Output queue of a descriptor gpspipe writes to, such as its output
+ * file or the serial port. Writes are queued and sent without
+ * blocking; a consumer that cannot keep up only fills its own queue,
+ * and once that is full new output for it is dropped, so the others
+ * and the reading from gpsd go on. The age of every queued write is
+ * kept to measure how far behind the consumer is.
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: yiding
+ */
+
+#ifndef SINK_H_
+#define SINK_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "reactor.h"
+
+#define SINK_BUFFER	65536	/* bytes waiting for a slow consumer */
+#define SINK_MARKS	256		/* queued writes whose age is tracked */
+#define SINK_BATCH	16384	/* bytes gathered before a write, with sinkPolicy() */
+#define SINK_DELAY	500		/* ms output may wait for more, with sinkPolicy() */
+
+typedef struct sinkMark {
+	uint64_t end;			/* byte count once the write is sent */
+	int64_t queued;			/* when it was queued, ms */
+} SinkMark;
+
+typedef struct sink {
+	const char * name;
+	reactorEvent ev;		/* told when a full queue can move again */
+	int flags;				/* of the descriptor before it was made non-blocking */
+	size_t batch;			/* bytes sinkPoll() waits for, 0 to write at once */
+	unsigned delay;			/* ms it waits for them at most */
+	uint64_t head;			/* bytes sent, ever */
+	uint64_t tail;			/* bytes queued, ever */
+	SinkMark marks[SINK_MARKS];
+	unsigned mhead;			/* oldest mark not sent */
+	unsigned mtail;			/* next mark */
+	unsigned long queues;	/* writes queued */
+	unsigned long writes;	/* system calls that sent something */
+	unsigned long dropped;	/* writes lost to a full queue */
+	int64_t lagMax;			/* ms a write waited to be sent, at worst */
+	unsigned char buf[SINK_BUFFER];
+} Sink;
+
+void sinkInit(Sink * sink, AmbleReactor * reactor, const char * name, int fd);
+bool sinkWrite(Sink * sink, const void * data, size_t n);
+int sinkFlush(Sink * sink);
+void sinkPolicy(Sink * sink, size_t batch, unsigned delay);
+int sinkPoll(Sink * sink);
+int sinkTimeout(const Sink * sink);
+void sinkDrain(Sink * sink);
+
+size_t sinkQueued(const Sink * sink);
+int64_t sinkLag(const Sink * sink);
+
+#endif /* SINK_H_ */
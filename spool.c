@@ -0,0 +1,180 @@
+/*
+ * spool.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: yiding
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "spool.h"
+
+static SpoolSlot * spoolSlot(const Spool * spool, uint64_t seq) {
+	return &spool->slots[seq % spool->header->capacity];
+}
+
+/* the slot holds the fix of sequence number seq */
+static int spoolWritten(const Spool * spool, uint64_t seq) {
+	const SpoolSlot * slot = spoolSlot(spool, seq);
+
+	if (spool->header->version == 1)
+		return slot->tag == (uint32_t) seq;
+	return (slot->tag & SPOOL_SEQ_MASK) == (seq & SPOOL_SEQ_MASK);
+}
+
+/*
+ * Map the queue file at path, creating it with room for capacity
+ * fixes. An existing queue keeps its own capacity and its fixes, up
+ * to the first one torn by a crash; those of a version 1 queue are
+ * taken over as stream 0. Returns 0, -1 on error.
+ */
+int spoolOpen(Spool * spool, const char * path, unsigned capacity) {
+	SpoolHeader * h;
+	struct stat st;
+	uint64_t seq;
+	void * map;
+
+	if (capacity == 0)
+		capacity = SPOOL_FIXES;
+	if (capacity > SPOOL_MAX_FIXES)
+		capacity = SPOOL_MAX_FIXES;
+	if ((spool->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644)) == -1
+			|| fstat(spool->fd, &st) == -1) {
+		perror(path);
+		return -1;
+	}
+
+	/* a file that is not a queue, or of a size that does not match, starts over */
+	if ((size_t) st.st_size >= sizeof(SpoolHeader)) {
+		SpoolHeader old;
+
+		if (pread(spool->fd, &old, sizeof old, 0) == (ssize_t) sizeof old
+				&& old.magic == SPOOL_MAGIC && (old.version == 1 || old.version == SPOOL_VERSION)
+				&& old.capacity > 0 && old.capacity <= SPOOL_MAX_FIXES
+				&& (size_t) st.st_size == sizeof old + (size_t) old.capacity * sizeof(SpoolSlot))
+			capacity = old.capacity;
+		else
+			st.st_size = 0;
+	}
+	spool->size = sizeof(SpoolHeader) + (size_t) capacity * sizeof(SpoolSlot);
+	if (st.st_size == 0 && (ftruncate(spool->fd, 0) == -1
+			|| ftruncate(spool->fd, (off_t) spool->size) == -1)) {
+		perror(path);
+		close(spool->fd);
+		return -1;
+	}
+
+	map = mmap(NULL, spool->size, PROT_READ | PROT_WRITE, MAP_SHARED, spool->fd, 0);
+	if (map == MAP_FAILED) {
+		perror(path);
+		close(spool->fd);
+		return -1;
+	}
+	spool->header = h = (SpoolHeader *) map;
+	spool->slots = (SpoolSlot *) (h + 1);
+	spool->synced = 0;
+	spool->dirty = 0;
+
+	if (st.st_size == 0) {
+		h->magic = SPOOL_MAGIC;
+		h->version = SPOOL_VERSION;
+		h->capacity = capacity;
+		h->head = h->tail = h->dropped = 0;
+		msync(map, spool->size, MS_SYNC);
+		return 0;
+	}
+
+	/* keep the fixes up to the first slot that was not written */
+	if (h->head > h->tail || h->tail - h->head > h->capacity)
+		h->head = h->tail;
+	for (seq = h->head; seq < h->tail && spoolWritten(spool, seq); seq++)
+		;
+	if (seq != h->tail)
+		fprintf(stderr, "%s: %llu fixes lost in a crash\n", path,
+				(unsigned long long) (h->tail - seq));
+	h->tail = seq;
+	if (h->version == 1) {
+		for (seq = h->head; seq < h->tail; seq++)
+			spoolSlot(spool, seq)->tag = (uint32_t) seq & SPOOL_SEQ_MASK;
+		h->version = SPOOL_VERSION;
+		msync(map, spool->size, MS_SYNC);
+	}
+	return 0;
+}
+
+void spoolClose(Spool * spool) {
+	if (spool->header == NULL)
+		return;
+	msync(spool->header, spool->size, MS_SYNC);
+	munmap(spool->header, spool->size);
+	close(spool->fd);
+	spool->header = NULL;
+}
+
+/*
+ * Queue a fix of stream (below SPOOL_STREAMS) taken at taken, ms since
+ * the epoch, dropping the oldest when full
+ */
+void spoolPush(Spool * spool, const struct gps_package * fix, streamId stream, int64_t taken) {
+	SpoolHeader * h = spool->header;
+	SpoolSlot * slot;
+
+	if (h->tail - h->head == h->capacity) {
+		/* the head moves before its slot is overwritten */
+		__atomic_store_n(&h->head, h->head + 1, __ATOMIC_RELEASE);
+		h->dropped++;
+	}
+	slot = spoolSlot(spool, h->tail);
+	slot->taken = taken;
+	slot->fix = *fix;
+	__atomic_store_n(&slot->tag, stream << SPOOL_SEQ_BITS | ((uint32_t) h->tail & SPOOL_SEQ_MASK),
+			__ATOMIC_RELEASE);
+	__atomic_store_n(&h->tail, h->tail + 1, __ATOMIC_RELEASE);
+	spool->dirty = 1;
+}
+
+/* The oldest fix queued, NULL if there is none */
+const SpoolSlot * spoolPeek(const Spool * spool) {
+	const SpoolHeader * h = spool->header;
+
+	return h->head == h->tail ? NULL : spoolSlot(spool, h->head);
+}
+
+/* The stream a queued fix came from */
+streamId spoolStream(const SpoolSlot * slot) {
+	return slot->tag >> SPOOL_SEQ_BITS;
+}
+
+/* Forget the oldest fix, once it is sent */
+void spoolPop(Spool * spool) {
+	SpoolHeader * h = spool->header;
+
+	if (h->head != h->tail) {
+		h->head++;
+		spool->dirty = 1;
+	}
+}
+
+uint64_t spoolDepth(const Spool * spool) {
+	return spool->header->tail - spool->header->head;
+}
+
+/*
+ * Start writing the queue to disk if it changed and SPOOL_SYNC_MS
+ * passed since the last time; now is in ms. The caller's loop does
+ * not wait for the disk: a crash of the process loses nothing, the
+ * pages are shared with the file, and the kernel finishes the write.
+ */
+void spoolSync(Spool * spool, int64_t now) {
+	if (!spool->dirty || now - spool->synced < SPOOL_SYNC_MS)
+		return;
+	if (sync_file_range(spool->fd, 0, 0, SYNC_FILE_RANGE_WRITE) == -1)
+		perror("spool: sync_file_range");
+	spool->synced = now;
+	spool->dirty = 0;
+}
@@ -0,0 +1,71 @@
+/*
+ * spool.h
+ *
+ * Bounded on-disk queue of the fixes taken while the uplink is down.
+ * The file is a ring of fixed-size slots mapped into memory; when it
+ * is full the oldest fix is dropped. Every slot carries the sequence
+ * number it was written with, so after a crash the queue is cut at
+ * the first slot that did not make it to disk instead of replaying
+ * garbage, and the stream of the source it came from. Once the uplink
+ * is back the fixes are sent as backfill.
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: yiding
+ */
+
+#ifndef SPOOL_H_
+#define SPOOL_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "global.h"
+
+#define SPOOL_MAGIC		0x4C4F5053	/* "SPOL" */
+#define SPOOL_VERSION	2			/* 1: the whole of a slot's tag was its sequence number */
+#define SPOOL_FIXES		86400		/* default capacity, a day at 1 Hz */
+#define SPOOL_RATE		10			/* default backfill fixes sent per second */
+#define SPOOL_SYNC_MS	1000		/* spooled fixes are written out this often */
+#define SPOOL_SEQ_BITS	24			/* of a slot's tag, the rest is its stream */
+#define SPOOL_SEQ_MASK	((1u << SPOOL_SEQ_BITS) - 1)
+#define SPOOL_MAX_FIXES	SPOOL_SEQ_MASK	/* capacity, so that no two slots share a tag */
+#define SPOOL_STREAMS	(1u << (32 - SPOOL_SEQ_BITS))	/* stream IDs a slot can hold */
+
+typedef struct spoolHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t capacity;		/* slots */
+	uint32_t reserved;
+	uint64_t head;			/* sequence number of the oldest fix */
+	uint64_t tail;			/* sequence number of the next fix */
+	uint64_t dropped;		/* fixes lost to a full queue, ever */
+	uint8_t pad[24];		/* slots start on a 64 byte boundary */
+} SpoolHeader;
+
+/* 32 bytes: a slot never straddles a page */
+typedef struct spoolSlot {
+	int64_t taken;			/* ms since the epoch */
+	uint32_t tag;			/* stream, then the low bits of the sequence number it was written with */
+	struct gps_package fix;
+} SpoolSlot;
+
+typedef struct spool {
+	int fd;
+	SpoolHeader * header;
+	SpoolSlot * slots;
+	size_t size;			/* bytes mapped */
+	int64_t synced;			/* last msync(), ms */
+	int dirty;				/* pushed since */
+} Spool;
+
+int spoolOpen(Spool * spool, const char * path, unsigned capacity);
+void spoolClose(Spool * spool);
+
+void spoolPush(Spool * spool, const struct gps_package * fix, streamId stream, int64_t taken);
+const SpoolSlot * spoolPeek(const Spool * spool);
+streamId spoolStream(const SpoolSlot * slot);
+void spoolPop(Spool * spool);
+uint64_t spoolDepth(const Spool * spool);
+void spoolSync(Spool * spool, int64_t now);
+
+#endif /* SPOOL_H_ */
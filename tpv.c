@@ -0,0 +1,319 @@
+/*
+ * tpv.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: yiding
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "tpv.h"
+
+/* exactly representable powers of ten */
+static const double tpvPow10[] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+static const char * tpvSpace(const char * p, const char * end) {
+	while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n'))
+		p++;
+	return p;
+}
+
+/* past the closing quote of the string opening at p; NULL if unterminated */
+static const char * tpvString(const char * p, const char * end) {
+	for (p++; p < end; p++) {
+		if (*p == '\\')
+			p++;
+		else if (*p == '"')
+			return p + 1;
+	}
+	return NULL;
+}
+
+/* past the value at p, nested objects and arrays included */
+static const char * tpvSkip(const char * p, const char * end) {
+	int depth = 0;
+
+	while (p < end) {
+		switch (*p) {
+		case '"':
+			if ((p = tpvString(p, end)) == NULL)
+				return NULL;
+			if (depth == 0)
+				return p;
+			continue;
+		case '{':
+		case '[':
+			depth++;
+			break;
+		case '}':
+		case ']':
+			if (depth == 0)
+				return p;
+			if (--depth == 0)
+				return p + 1;
+			break;
+		case ',':
+		case ' ':
+		case '\t':
+		case '\r':
+		case '\n':
+			if (depth == 0)
+				return p;
+			break;
+		}
+		p++;
+	}
+	return depth == 0 ? p : NULL;
+}
+
+/*
+ * Parse the JSON number at p. Up to 19 significant digits are
+ * gathered in an integer and scaled by an exact power of ten, which
+ * covers everything gpsd writes; anything longer goes to strtod().
+ * Returns the end of the number, NULL if there is none.
+ */
+static const char * tpvNumber(const char * p, const char * end, double * value) {
+	const char * start = p;
+	uint64_t mantissa = 0;
+	int digits = 0, exp10 = 0, e = 0, esign = 1;
+	bool negative = false, exact = true;
+
+	if (p < end && *p == '-') {
+		negative = true;
+		p++;
+	}
+	if (p == end || *p < '0' || *p > '9')
+		return NULL;
+	for (; p < end && *p >= '0' && *p <= '9'; p++) {
+		if (digits < 19) {
+			mantissa = mantissa * 10 + (uint64_t) (*p - '0');
+			digits += mantissa != 0;
+		}
+		else {
+			exp10++;
+			exact = false;
+		}
+	}
+	if (p < end && *p == '.') {
+		for (p++; p < end && *p >= '0' && *p <= '9'; p++)
+			if (digits < 19) {
+				mantissa = mantissa * 10 + (uint64_t) (*p - '0');
+				digits += mantissa != 0;
+				exp10--;
+			}
+			else
+				exact = false;
+	}
+	if (p < end && (*p == 'e' || *p == 'E')) {
+		p++;
+		if (p < end && (*p == '+' || *p == '-'))
+			esign = *p++ == '-' ? -1 : 1;
+		for (; p < end && *p >= '0' && *p <= '9'; p++)
+			if (e < 10000)
+				e = e * 10 + (*p - '0');
+		exp10 += esign * e;
+	}
+
+	if (exact && mantissa < (1ULL << 53) && exp10 >= -22 && exp10 <= 22)
+		*value = exp10 < 0 ? (double) mantissa / tpvPow10[-exp10]
+				: (double) mantissa * tpvPow10[exp10];
+	else {
+		char tmp[64];
+		size_t n = (size_t) (p - start);
+
+		if (n >= sizeof tmp)
+			return NULL;
+		memcpy(tmp, start, n);
+		tmp[n] = '\0';
+		*value = strtod(tmp, NULL);
+		return p;
+	}
+	if (negative)
+		*value = -*value;
+	return p;
+}
+
+/* read n digits at p */
+static int tpvDigits(const char * p, int n) {
+	int v = 0;
+
+	while (n--) {
+		if (*p < '0' || *p > '9')
+			return -1;
+		v = v * 10 + (*p++ - '0');
+	}
+	return v;
+}
+
+/*
+ * Parse a gpsd time, "YYYY-MM-DDTHH:MM:SS[.fff]Z" in UTC, between the
+ * quotes at p and end. Returns 0, -1 if it is not one.
+ */
+static int tpvTime(const char * p, const char * end, double * t) {
+	int y, m, d, hh, mm, ss, era, yoe, doy;
+	double frac = 0, scale = 0.1;
+	long days;
+
+	if (end - p < 20 || p[4] != '-' || p[7] != '-' || p[10] != 'T'
+			|| p[13] != ':' || p[16] != ':')
+		return -1;
+	y = tpvDigits(p, 4);
+	m = tpvDigits(p + 5, 2);
+	d = tpvDigits(p + 8, 2);
+	hh = tpvDigits(p + 11, 2);
+	mm = tpvDigits(p + 14, 2);
+	ss = tpvDigits(p + 17, 2);
+	if (y < 0 || m < 1 || m > 12 || d < 1 || hh < 0 || mm < 0 || ss < 0)
+		return -1;
+	for (p += 19; p < end && *p != 'Z'; p++) {
+		if (*p == '.')
+			continue;
+		if (*p < '0' || *p > '9')
+			return -1;
+		frac += (*p - '0') * scale;
+		scale /= 10;
+	}
+
+	/* days since 1970-01-01 of a proleptic Gregorian date */
+	y -= m <= 2;
+	era = (y >= 0 ? y : y - 399) / 400;
+	yoe = y - era * 400;
+	doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+	days = (long) era * 146097 + yoe * 365 + yoe / 4 - yoe / 100 + doy - 719468;
+	*t = (double) days * 86400 + hh * 3600 + mm * 60 + ss + frac;
+	return 0;
+}
+
+/* the member named by the key between p and end, 0 if not wanted */
+static unsigned tpvKey(const char * p, size_t n) {
+	switch (n) {
+	case 3:
+		if (!memcmp(p, "lat", 3))
+			return TPV_LAT;
+		if (!memcmp(p, "lon", 3))
+			return TPV_LON;
+		if (!memcmp(p, "alt", 3))
+			return TPV_ALT;
+		break;
+	case 4:
+		if (!memcmp(p, "time", 4))
+			return TPV_TIME;
+		break;
+	case 5:
+		if (!memcmp(p, "track", 5))
+			return TPV_TRACK;
+		if (!memcmp(p, "speed", 5))
+			return TPV_SPEED;
+		if (!memcmp(p, "class", 5))
+			return ~0u;
+		break;
+	case 6:
+		/* newer gpsd splits alt; MSL is what alt used to be */
+		if (!memcmp(p, "altMSL", 6))
+			return TPV_ALT << 8;
+		break;
+	}
+	return 0;
+}
+
+/*
+ * Extract the members of a gpsd TPV report from the len bytes of one
+ * line. Members that are absent or not numbers are left out of
+ * report->fields. Never allocates.
+ */
+tpvStatus tpvParse(const char * line, size_t len, TpvReport * report) {
+	const char * p = line, * end = line + len, * key, * next;
+	double altMSL = 0;
+	bool tpv = false;
+	unsigned member;
+	size_t n;
+	double v;
+
+	report->fields = 0;
+	p = tpvSpace(p, end);
+	if (p == end || *p++ != '{')
+		return TPV_MALFORMED;
+
+	for (p = tpvSpace(p, end); p < end && *p != '}'; ) {
+		if (*p != '"' || (next = tpvString(p, end)) == NULL)
+			return TPV_MALFORMED;
+		/* keys we want have no escapes */
+		key = p + 1;
+		n = (size_t) (next - 1 - key);
+		member = memchr(key, '\\', n) ? 0 : tpvKey(key, n);
+		p = tpvSpace(next, end);
+		if (p == end || *p++ != ':')
+			return TPV_MALFORMED;
+		p = tpvSpace(p, end);
+		if (p == end)
+			return TPV_MALFORMED;
+
+		if (member == ~0u) {
+			if (*p != '"' || (next = tpvString(p, end)) == NULL)
+				return TPV_MALFORMED;
+			if (next - p != 5 || memcmp(p, "\"TPV\"", 5))
+				return TPV_OTHER;
+			tpv = true;
+			p = next;
+		}
+		else if (member == TPV_TIME && *p == '"') {
+			if ((next = tpvString(p, end)) == NULL)
+				return TPV_MALFORMED;
+			if (tpvTime(p + 1, next - 1, &report->time) == 0)
+				report->fields |= TPV_TIME;
+			p = next;
+		}
+		else if (member != 0 && (next = tpvNumber(p, end, &v)) != NULL) {
+			switch (member) {
+			case TPV_LAT:	report->lat = v;	break;
+			case TPV_LON:	report->lon = v;	break;
+			case TPV_ALT:	report->alt = v;	break;
+			case TPV_TRACK:	report->track = v;	break;
+			case TPV_SPEED:	report->speed = v;	break;
+			case TPV_TIME:	report->time = v;	break;
+			default:		altMSL = v;			break;
+			}
+			report->fields |= member;
+			p = next;
+		}
+		else if ((p = tpvSkip(p, end)) == NULL)
+			return TPV_MALFORMED;
+
+		p = tpvSpace(p, end);
+		if (p < end && *p == ',')
+			p = tpvSpace(p + 1, end);
+		else if (p == end || *p != '}')
+			return TPV_MALFORMED;
+	}
+	if (p == end)
+		return TPV_MALFORMED;
+	if (!tpv)
+		return TPV_OTHER;
+
+	if ((report->fields & (TPV_ALT << 8)) && !(report->fields & TPV_ALT)) {
+		report->alt = altMSL;
+		report->fields |= TPV_ALT;
+	}
+	report->fields &= TPV_FIX | TPV_TIME;
+	return TPV_OK;
+}
+
+/*
+ * Fill a package from a report holding a whole fix. Returns SUCCESS,
+ * or ERROR if a member is missing.
+ */
+int tpvFix(const TpvReport * report, struct gps_package * fix) {
+	if ((report->fields & TPV_FIX) != TPV_FIX)
+		return ERROR;
+	fix->lat = (float) report->lat;
+	fix->lon = (float) report->lon;
+	fix->alt = (float) report->alt;
+	fix->speed = (float) report->speed;
+	fix->heading = (float) report->track;
+	return SUCCESS;
+}
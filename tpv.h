@@ -0,0 +1,52 @@
+/*
+ * tpv.h
+ *
+ * Single-pass extractor for gpsd JSON reports. It reads the members
+ * of a TPV report straight out of the line buffer, in whatever order
+ * gpsd writes them, without building a tree or allocating anything.
+ * Reports of any other class are rejected as soon as their class is
+ * seen, which in gpsd output is the first member.
+ *
+ * Only top-level members are looked at; nested objects and arrays are
+ * skipped over.
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: yiding
+ */
+
+#ifndef TPV_H_
+#define TPV_H_
+
+#include <stddef.h>
+
+#include "global.h"
+
+/* members of a TPV report found by tpvParse() */
+#define TPV_LAT		0x01
+#define TPV_LON		0x02
+#define TPV_ALT		0x04
+#define TPV_TRACK	0x08
+#define TPV_SPEED	0x10
+#define TPV_TIME	0x20
+#define TPV_FIX		(TPV_LAT | TPV_LON | TPV_ALT | TPV_TRACK | TPV_SPEED)
+
+typedef enum {
+	TPV_OK,				/* a TPV report, see fields for what it holds */
+	TPV_OTHER,			/* a report of another class */
+	TPV_MALFORMED		/* not a JSON object */
+} tpvStatus;
+
+typedef struct tpvReport {
+	unsigned fields;	/* TPV_* of the members found */
+	double lat;
+	double lon;
+	double alt;
+	double track;
+	double speed;
+	double time;		/* seconds since the epoch */
+} TpvReport;
+
+tpvStatus tpvParse(const char * line, size_t len, TpvReport * report);
+int tpvFix(const TpvReport * report, struct gps_package * fix);
+
+#endif /* TPV_H_ */
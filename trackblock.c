@@ -0,0 +1,251 @@
+/*
+ * trackblock.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: yiding
+ */
+
+#include <string.h>
+#include <math.h>
+
+#include "trackblock.h"
+
+#define SCALE_DEG		1e7		/* lat, lon */
+#define SCALE_CM		1e2		/* alt, speed */
+#define SCALE_HEADING	1e2
+#define HEADING_TURN	36000	/* a full circle in heading units */
+
+/* a fix in fixed point */
+typedef struct quantFix {
+	int64_t time;		/* ms */
+	int32_t lat, lon, alt, speed, heading;
+} QuantFix;
+
+static int32_t quantize(float v, double scale) {
+	double q = (double) v * scale;
+
+	if (!isfinite(q))
+		return 0;
+	if (q >= INT32_MAX)
+		return INT32_MAX;
+	if (q <= INT32_MIN)
+		return INT32_MIN;
+	return (int32_t) lrint(q);
+}
+
+static void quantizeRecord(const TrackRecord * rec, QuantFix * q) {
+	int32_t h;
+
+	q->time = rec->received / 1000000;
+	q->lat = quantize(rec->fix.lat, SCALE_DEG);
+	q->lon = quantize(rec->fix.lon, SCALE_DEG);
+	q->alt = quantize(rec->fix.alt, SCALE_CM);
+	q->speed = quantize(rec->fix.speed, SCALE_CM);
+	h = quantize(rec->fix.heading, SCALE_HEADING) % HEADING_TURN;
+	q->heading = h < 0 ? h + HEADING_TURN : h;
+}
+
+/* heading deltas take the short way round, so 359 -> 1 costs 2 degrees */
+static int32_t headingDelta(int32_t from, int32_t to) {
+	int32_t d = to - from;
+
+	if (d >= HEADING_TURN / 2)
+		d -= HEADING_TURN;
+	else if (d < -HEADING_TURN / 2)
+		d += HEADING_TURN;
+	return d;
+}
+
+static inline uint64_t zigzag(int64_t v) {
+	return ((uint64_t) v << 1) ^ (uint64_t) (v >> 63);
+}
+
+static inline int64_t unzigzag(uint64_t v) {
+	return (int64_t) (v >> 1) ^ -(int64_t) (v & 1);
+}
+
+static inline unsigned char * putVarint(unsigned char * p, uint64_t v) {
+	while (v >= 0x80) {
+		*p++ = (unsigned char) (v | 0x80);
+		v >>= 7;
+	}
+	*p++ = (unsigned char) v;
+	return p;
+}
+
+/* NULL if the varint runs past end or is longer than 10 bytes */
+static inline const unsigned char * getVarint(const unsigned char * p,
+		const unsigned char * end, uint64_t * v) {
+	uint64_t x;
+	unsigned shift;
+
+	if (p < end && *p < 0x80) {		/* most deltas fit one byte */
+		*v = *p;
+		return p + 1;
+	}
+	for (x = 0, shift = 0; p < end && shift < 64; shift += 7) {
+		unsigned char c = *p++;
+		x |= (uint64_t) (c & 0x7F) << shift;
+		if (c < 0x80) {
+			*v = x;
+			return p;
+		}
+	}
+	return NULL;
+}
+
+static void put16(unsigned char * p, uint16_t v) {
+	p[0] = (unsigned char) v;
+	p[1] = (unsigned char) (v >> 8);
+}
+
+static void put32(unsigned char * p, uint32_t v) {
+	put16(p, (uint16_t) v);
+	put16(p + 2, (uint16_t) (v >> 16));
+}
+
+static void put64(unsigned char * p, uint64_t v) {
+	put32(p, (uint32_t) v);
+	put32(p + 4, (uint32_t) (v >> 32));
+}
+
+static uint16_t get16(const unsigned char * p) {
+	return (uint16_t) (p[0] | p[1] << 8);
+}
+
+static uint32_t get32(const unsigned char * p) {
+	return get16(p) | (uint32_t) get16(p + 2) << 16;
+}
+
+static uint64_t get64(const unsigned char * p) {
+	return get32(p) | (uint64_t) get32(p + 4) << 32;
+}
+
+/*
+ * Encode n fixes of one client (n <= TRACK_BLOCK_FIXES, in time order)
+ * into out. Returns the size of the block, 0 if it needs more than cap
+ * bytes; TRACK_BLOCK_BOUND(n) is always enough.
+ */
+size_t trackBlockEncode(const TrackRecord * recs, unsigned n, unsigned char * out, size_t cap) {
+	unsigned char * p = out + TRACK_BLOCK_HEADER;
+	unsigned char * end = out + cap;
+	QuantFix prev, cur;
+	unsigned i;
+
+	if (n == 0 || n > TRACK_BLOCK_FIXES || cap < TRACK_BLOCK_HEADER + 10)
+		return 0;
+
+	quantizeRecord(&recs[0], &prev);
+	put16(out, TRACK_BLOCK_MAGIC);
+	out[2] = TRACK_BLOCK_VERSION;
+	out[3] = 0;
+	put16(out + 4, (uint16_t) n);
+	put16(out + 6, 0);
+	put32(out + 8, recs[0].cid);
+	put64(out + 16, (uint64_t) prev.time);
+	put32(out + 24, (uint32_t) prev.lat);
+	put32(out + 28, (uint32_t) prev.lon);
+	put32(out + 32, (uint32_t) prev.alt);
+	put32(out + 36, (uint32_t) prev.speed);
+	put16(out + 40, (uint16_t) prev.heading);
+	put16(out + 42, 0);
+	p = putVarint(p, recs[0].flags);
+
+	for (i = 1; i < n; i++) {
+		/* seven varints of at most 10 bytes each */
+		if (end - p < 70)
+			return 0;
+		quantizeRecord(&recs[i], &cur);
+		if (recs[i].flags == recs[i - 1].flags)
+			p = putVarint(p, zigzag(cur.time - prev.time) << 1);
+		else {
+			p = putVarint(p, zigzag(cur.time - prev.time) << 1 | 1);
+			p = putVarint(p, recs[i].flags);
+		}
+		p = putVarint(p, zigzag((int64_t) cur.lat - prev.lat));
+		p = putVarint(p, zigzag((int64_t) cur.lon - prev.lon));
+		p = putVarint(p, zigzag((int64_t) cur.alt - prev.alt));
+		p = putVarint(p, zigzag((int64_t) cur.speed - prev.speed));
+		p = putVarint(p, zigzag(headingDelta(prev.heading, cur.heading)));
+		prev = cur;
+	}
+
+	put32(out + 12, (uint32_t) (p - out - TRACK_BLOCK_HEADER));
+	return (size_t) (p - out);
+}
+
+/* Read the header of the block at in; -1 if it is not a whole block */
+int trackBlockInfo(const unsigned char * in, size_t len, TrackBlockInfo * info) {
+	if (len < TRACK_BLOCK_HEADER || get16(in) != TRACK_BLOCK_MAGIC
+			|| in[2] < 1 || in[2] > TRACK_BLOCK_VERSION || get16(in + 4) == 0)
+		return -1;
+	info->cid = get32(in + 8);
+	info->count = get16(in + 4);
+	info->size = TRACK_BLOCK_HEADER + (size_t) get32(in + 12);
+	info->first = (int64_t) get64(in + 16) * 1000000;
+	return info->size <= len ? 0 : -1;
+}
+
+/*
+ * Decode the block at in into out. Returns the number of fixes, -1 if
+ * the block is malformed or holds more than max fixes.
+ */
+int trackBlockDecode(const unsigned char * in, size_t len, TrackRecord * out, unsigned max) {
+	const unsigned char * p = in + TRACK_BLOCK_HEADER;
+	const unsigned char * end;
+	TrackBlockInfo info;
+	int64_t time;
+	int32_t lat, lon, alt, speed, heading;
+	uint64_t d[6], flags = 0;
+	unsigned i, k;
+
+	if (trackBlockInfo(in, len, &info) == -1 || info.count > max)
+		return -1;
+	end = in + info.size;
+	if (in[2] > 1 && (p = getVarint(p, end, &flags)) == NULL)
+		return -1;
+
+	time = (int64_t) get64(in + 16);
+	lat = (int32_t) get32(in + 24);
+	lon = (int32_t) get32(in + 28);
+	alt = (int32_t) get32(in + 32);
+	speed = (int32_t) get32(in + 36);
+	heading = get16(in + 40);
+
+	for (i = 0; ; ) {
+		out[i].cid = info.cid;
+		out[i].flags = (uint32_t) flags;
+		out[i].received = time * 1000000;
+		out[i].fix.lat = (float) (lat * (1 / SCALE_DEG));
+		out[i].fix.lon = (float) (lon * (1 / SCALE_DEG));
+		out[i].fix.alt = (float) (alt * (1 / SCALE_CM));
+		out[i].fix.speed = (float) (speed * (1 / SCALE_CM));
+		out[i].fix.heading = (float) (heading * (1 / SCALE_HEADING));
+		out[i].pad = 0;
+		if (++i == info.count)
+			break;
+
+		if ((p = getVarint(p, end, &d[0])) == NULL)
+			return -1;
+		if (in[2] > 1) {
+			/* low bit: new flags follow */
+			if ((d[0] & 1) && (p = getVarint(p, end, &flags)) == NULL)
+				return -1;
+			d[0] >>= 1;
+		}
+		for (k = 1; k < 6; k++)
+			if ((p = getVarint(p, end, &d[k])) == NULL)
+				return -1;
+		time += unzigzag(d[0]);
+		lat += (int32_t) unzigzag(d[1]);
+		lon += (int32_t) unzigzag(d[2]);
+		alt += (int32_t) unzigzag(d[3]);
+		speed += (int32_t) unzigzag(d[4]);
+		heading += (int32_t) unzigzag(d[5]);
+		if (heading >= HEADING_TURN)
+			heading -= HEADING_TURN;
+		else if (heading < 0)
+			heading += HEADING_TURN;
+	}
+	return p == end ? (int) info.count : -1;
+}
@@ -0,0 +1,55 @@
+/*
+ * trackblock.h
+ *
+ * Compressed blocks of one client's track. Fixes are quantized to
+ * fixed point (1e-7 degree, centimetre, cm/s, 1/100 degree, ms),
+ * the first one is stored whole in the block header and every next
+ * one as zigzag varint deltas from its predecessor. A block carries
+ * everything needed to decode it, so blocks can be skipped or decoded
+ * in parallel.
+ *
+ * Header, little endian:
+ *     0  u16 magic      2  u8 version   3  u8 reserved
+ *     4  u16 count      6  u16 reserved
+ *     8  u32 client ID 12  u32 payload bytes after the header
+ *    16  i64 time of the first fix, ms since the epoch
+ *    24  i32 lat       28  i32 lon      32  i32 alt      36  i32 speed
+ *    40  u16 heading   42  u16 reserved
+ * Payload: the flags of the first fix, then per fix after the first
+ * dtime dlat dlon dalt dspeed dheading, where dtime is shifted left by
+ * one and its low bit set if the fix's flags, following as one more
+ * varint, differ from its predecessor's. Version 1 blocks carry no
+ * flags and still decode, with flags 0.
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: yiding
+ */
+
+#ifndef TRACKBLOCK_H_
+#define TRACKBLOCK_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "tracklog.h"
+
+#define TRACK_BLOCK_MAGIC	0x4254	/* "TB" */
+#define TRACK_BLOCK_VERSION	2
+#define TRACK_BLOCK_HEADER	44
+#define TRACK_BLOCK_FIXES	1024	/* most fixes in one block */
+
+/* worst case size of a block of n fixes */
+#define TRACK_BLOCK_BOUND(n) (TRACK_BLOCK_HEADER + (size_t) (n) * 7 * 10)
+
+typedef struct trackBlockInfo {
+	clientId cid;
+	unsigned count;			/* fixes in the block */
+	size_t size;			/* bytes of the block, header included */
+	int64_t first;			/* time of the first fix, ns since the epoch */
+} TrackBlockInfo;
+
+size_t trackBlockEncode(const TrackRecord * recs, unsigned n, unsigned char * out, size_t cap);
+int trackBlockInfo(const unsigned char * in, size_t len, TrackBlockInfo * info);
+int trackBlockDecode(const unsigned char * in, size_t len, TrackRecord * out, unsigned max);
+
+#endif /* TRACKBLOCK_H_ */
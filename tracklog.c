@@ -0,0 +1,289 @@
+/*
+ * tracklog.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: yiding
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <dirent.h>
+#include <time.h>
+
+#include "tracklog.h"
+
+static char trackDir[TRACK_PATH] = ".";
+static size_t trackSegmentSize = TRACK_SEGMENT;
+
+/*
+ * Set the directory segments are written to and the size at which a
+ * segment is sealed and the next one started. Call before any append.
+ */
+void trackConfigure(const char * dir, size_t segmentSize) {
+	if (dir != NULL)
+		snprintf(trackDir, sizeof trackDir, "%s", dir);
+	if (segmentSize >= sizeof(TrackSegmentHeader) + sizeof(TrackRecord))
+		trackSegmentSize = segmentSize;
+}
+
+static void trackPath(char * path, size_t n, int shard, uint32_t segment) {
+	snprintf(path, n, "%s/track-%03d-%08u.log", trackDir, shard, segment);
+}
+
+/* first sequence number not used by an existing segment of the shard */
+static uint32_t trackNextSegment(int shard) {
+	char prefix[32];
+	struct dirent * de;
+	unsigned seg;
+	uint32_t next = 0;
+	DIR * dir;
+
+	if ((dir = opendir(trackDir)) == NULL)
+		return 0;
+	snprintf(prefix, sizeof prefix, "track-%03d-%%8u.log", shard);
+	while ((de = readdir(dir)) != NULL)
+		if (sscanf(de->d_name, prefix, &seg) == 1 && seg >= next)
+			next = seg + 1;
+	closedir(dir);
+	return next;
+}
+
+void trackInit(TrackLog * log, int shard) {
+	log->shard = shard;
+	log->fd = -1;
+	log->segment = 0;
+	log->size = 0;
+	log->fill = 0;
+	log->records = 0;
+	log->segments = 0;
+	log->buf = (unsigned char *) malloc(TRACK_BUFFER);
+	if (log->buf == NULL) {
+		printf("Fail to allocate memory space\n");
+		exit(1);
+	}
+}
+
+/*
+ * Write out the buffered records. What the file did not take stays
+ * buffered for the next flush, so size keeps matching the segment.
+ */
+int trackFlush(TrackLog * log) {
+	unsigned char * p = log->buf;
+	size_t n = log->fill;
+	ssize_t rc;
+
+	while (n > 0) {
+		rc = write(log->fd, p, n);
+		if (rc == -1) {
+			if (errno == EINTR)
+				continue;
+			perror("track log");
+			memmove(log->buf, p, n);
+			log->fill = n;
+			return -1;
+		}
+		p += rc;
+		n -= (size_t) rc;
+	}
+	log->fill = 0;
+	return 0;
+}
+
+/* Write out the buffered records and wait until they are on disk */
+int trackSync(TrackLog * log) {
+	if (log->fd == -1)
+		return 0;
+	if (trackFlush(log) == -1)
+		return -1;
+	if (fdatasync(log->fd) == -1) {
+		perror("track log");
+		return -1;
+	}
+	return 0;
+}
+
+/* seal the open segment, if any, and start the next one */
+static int trackRoll(TrackLog * log) {
+	char path[TRACK_PATH + 32];
+	TrackSegmentHeader header;
+	struct timespec now;
+
+	if (log->fd != -1) {
+		/* never seal a segment short of records it was counted with */
+		if (trackSync(log) == -1)
+			return -1;
+		close(log->fd);
+		log->segment++;
+	}
+	else
+		log->segment = trackNextSegment(log->shard);
+
+	trackPath(path, sizeof path, log->shard, log->segment);
+	log->fd = open(path, O_WRONLY | O_CREAT | O_EXCL | O_APPEND | O_CLOEXEC, 0644);
+	if (log->fd == -1) {
+		perror(path);
+		return -1;
+	}
+
+	clock_gettime(CLOCK_REALTIME, &now);
+	memset(&header, 0, sizeof header);
+	header.magic = TRACK_MAGIC;
+	header.version = TRACK_VERSION;
+	header.recordSize = sizeof(TrackRecord);
+	header.shard = (uint32_t) log->shard;
+	header.segment = log->segment;
+	header.created = (int64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+	memcpy(log->buf, &header, sizeof header);
+	log->fill = sizeof header;
+	log->size = sizeof header;
+	__atomic_store_n(&log->segments, log->segments + 1, __ATOMIC_RELAXED);
+	return 0;
+}
+
+/*
+ * Append one record. Records never span segments: a segment that has
+ * no room for another record is sealed first. Returns -1, the record
+ * not taken, if the buffer is full and cannot be written out.
+ */
+int trackAppend(TrackLog * log, const TrackRecord * rec) {
+	if (log->fd == -1 || log->size + sizeof *rec > trackSegmentSize)
+		if (trackRoll(log) == -1)
+			return -1;
+	if (log->fill + sizeof *rec > TRACK_BUFFER && trackFlush(log) == -1)
+		return -1;
+
+	memcpy(log->buf + log->fill, rec, sizeof *rec);
+	log->fill += sizeof *rec;
+	log->size += sizeof *rec;
+	__atomic_store_n(&log->records, log->records + 1, __ATOMIC_RELAXED);
+	return 0;
+}
+
+void trackClose(TrackLog * log) {
+	if (log->fd != -1) {
+		trackSync(log);
+		close(log->fd);
+		log->fd = -1;
+	}
+	free(log->buf);
+	log->buf = NULL;
+}
+
+/*
+ * Stream the records of one segment file from byte offset on (0 for
+ * all of them) to visit, TRACK_BUFFER bytes per read. Returns 0 at
+ * the end of the segment, -1 if it cannot be read, or the first
+ * non-zero value visit returned. A torn record at the end of the file
+ * is ignored.
+ */
+int trackScan(const char * path, uint64_t offset, trackVisitor visit, void * ctx) {
+	TrackSegmentHeader header;
+	unsigned char * buf;
+	size_t have = 0, i;
+	ssize_t rc;
+	int fd, stop = 0;
+
+	if ((fd = open(path, O_RDONLY | O_CLOEXEC)) == -1)
+		return -1;
+	if (read(fd, &header, sizeof header) != (ssize_t) sizeof header
+			|| header.magic != TRACK_MAGIC || header.version != TRACK_VERSION
+			|| header.recordSize != sizeof(TrackRecord)) {
+		close(fd);
+		return -1;
+	}
+	if (offset > sizeof header && lseek(fd, (off_t) offset, SEEK_SET) == -1) {
+		close(fd);
+		return -1;
+	}
+	posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+	if ((buf = (unsigned char *) malloc(TRACK_BUFFER)) == NULL) {
+		printf("Fail to allocate memory space\n");
+		exit(1);
+	}
+	while (!stop) {
+		rc = read(fd, buf + have, TRACK_BUFFER - have);
+		if (rc == -1 && errno == EINTR)
+			continue;
+		if (rc <= 0) {
+			if (rc == -1)
+				stop = -1;
+			break;
+		}
+		have += (size_t) rc;
+		for (i = 0; i + sizeof(TrackRecord) <= have && !stop; i += sizeof(TrackRecord)) {
+			TrackRecord rec;
+
+			memcpy(&rec, buf + i, sizeof rec);
+			stop = visit(&rec, ctx);
+		}
+		memmove(buf, buf + i, have - i);
+		have -= i;
+	}
+	free(buf);
+	close(fd);
+	return stop;
+}
+
+static int trackPosCompare(const void * a, const void * b) {
+	const TrackLogPos * x = (const TrackLogPos *) a;
+	const TrackLogPos * y = (const TrackLogPos *) b;
+
+	if (x->reserved != y->reserved)
+		return x->reserved < y->reserved ? -1 : 1;
+	return x->segment < y->segment ? -1 : x->segment > y->segment;
+}
+
+/*
+ * Replay the log tail of every shard: the records at or after pos[shard]
+ * (an array of TRACK_SHARDS), in segment order per shard. On return
+ * pos[shard] is the start of the segment the shard's writer will open
+ * next. Returns 0, or the first non-zero value of visit or trackScan().
+ */
+int trackReplay(TrackLogPos * pos, trackVisitor visit, void * ctx) {
+	char path[TRACK_PATH + 32];
+	TrackLogPos * found = NULL;
+	size_t nfound = 0, cap = 0, i;
+	struct dirent * de;
+	unsigned shard, seg;
+	int rc = 0;
+	DIR * dir;
+
+	if ((dir = opendir(trackDir)) == NULL)
+		return 0;
+	while ((de = readdir(dir)) != NULL) {
+		if (sscanf(de->d_name, "track-%3u-%8u.log", &shard, &seg) != 2
+				|| shard >= TRACK_SHARDS || seg < pos[shard].segment)
+			continue;
+		if (nfound == cap) {
+			cap = cap ? cap * 2 : 64;
+			if ((found = (TrackLogPos *) realloc(found, cap * sizeof(TrackLogPos))) == NULL) {
+				printf("Fail to allocate memory space\n");
+				exit(1);
+			}
+		}
+		found[nfound].segment = seg;
+		found[nfound].reserved = shard;		/* sort key */
+		found[nfound].offset = seg == pos[shard].segment ? pos[shard].offset : 0;
+		nfound++;
+	}
+	closedir(dir);
+
+	qsort(found, nfound, sizeof(TrackLogPos), trackPosCompare);
+	for (i = 0; i < nfound && rc == 0; i++) {
+		shard = found[i].reserved;
+		trackPath(path, sizeof path, (int) shard, found[i].segment);
+		if ((rc = trackScan(path, found[i].offset, visit, ctx)) == -1) {
+			fprintf(stderr, "%s: unreadable, skipped\n", path);
+			rc = 0;
+		}
+		pos[shard].segment = found[i].segment + 1;
+		pos[shard].offset = 0;
+	}
+	free(found);
+	return rc;
+}
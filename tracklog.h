@@ -0,0 +1,86 @@
+/*
+ * tracklog.h
+ *
+ * Append-only binary track log shared by all sessions. Every fix is
+ * stored as one fixed-size record (client ID, receive time and the
+ * whole gps_package) in rolling segment files. Each shard has one
+ * writer with its own series of segments, so appends never take a
+ * lock; records are buffered and reach the file in large writes.
+ * A writer is only used by one thread at a time.
+ *
+ * A segment is a TrackSegmentHeader followed by records, named
+ * track-SSS-NNNNNNNN.log after its shard and sequence number.
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: yiding
+ */
+
+#ifndef TRACKLOG_H_
+#define TRACKLOG_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "protocol.h"
+
+#define TRACK_MAGIC		0x4B525441	/* "ATRK" */
+#define TRACK_VERSION	1
+#define TRACK_BUFFER	(64 * 1024)			/* bytes buffered per writer */
+#define TRACK_SEGMENT	(64 * 1024 * 1024)	/* default segment size */
+#define TRACK_PATH		256
+#define TRACK_SHARDS	256		/* shard numbers a log directory may hold */
+
+typedef struct trackSegmentHeader {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t recordSize;
+	uint32_t shard;
+	uint32_t segment;		/* sequence number within the shard */
+	int64_t created;		/* ns since the epoch */
+	uint8_t reserved[8];
+} TrackSegmentHeader;
+
+typedef struct trackRecord {
+	uint32_t cid;
+	uint32_t flags;			/* TRACK_* */
+	int64_t received;		/* receive time, ns since the epoch */
+	struct gps_package fix;
+	uint32_t pad;
+} TrackRecord;
+
+/* record flags */
+#define TRACK_BACKFILL	0x1		/* sent late by the client, received is when it was taken */
+
+/* a place in the log of one shard: a segment and a byte offset in it */
+typedef struct trackLogPos {
+	uint32_t segment;
+	uint32_t reserved;
+	uint64_t offset;		/* 0 is the first record */
+} TrackLogPos;
+
+typedef struct trackLog {
+	int shard;
+	int fd;					/* open segment, -1 before the first append */
+	uint32_t segment;		/* sequence number of the open segment */
+	size_t size;			/* bytes in the open segment, buffered ones included */
+	size_t fill;			/* bytes buffered */
+	unsigned long records;	/* records appended, may be read by other threads */
+	unsigned long segments;	/* segments opened, likewise */
+	unsigned char * buf;
+} TrackLog;
+
+/* called for each record of a scanned segment; non-zero stops the scan */
+typedef int (*trackVisitor)(const TrackRecord * rec, void * ctx);
+
+void trackConfigure(const char * dir, size_t segmentSize);
+
+void trackInit(TrackLog * log, int shard);
+int trackAppend(TrackLog * log, const TrackRecord * rec);
+int trackFlush(TrackLog * log);
+int trackSync(TrackLog * log);
+void trackClose(TrackLog * log);
+
+int trackScan(const char * path, uint64_t offset, trackVisitor visit, void * ctx);
+int trackReplay(TrackLogPos * pos, trackVisitor visit, void * ctx);
+
+#endif /* TRACKLOG_H_ */
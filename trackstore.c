@@ -0,0 +1,920 @@
+/*
+ * trackstore.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: yiding
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <time.h>
+#include <stdbool.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "registry.h"
+#include "trackstore.h"
+
+#define STORE_PATH		256
+#define STORE_CLIENTS	1024	/* initial size of the client index */
+
+/* a time as blocks keep it, in whole ms: index entries must match decoded fixes */
+#define STORE_TIME(t)	((t) / 1000000 * 1000000)
+
+/* fixes of a client not stored yet, in time order */
+typedef struct openBlock {
+	TrackRecord * recs;
+	unsigned n;
+	unsigned cap;
+	int64_t opened;			/* when the first one came in, ns since the epoch */
+} OpenBlock;
+
+#define STORE_LIVE	0		/* open block of fixes arriving in time order */
+#define STORE_LATE	1		/* and of backfilled ones, older than the latest */
+
+/* the history of one client */
+typedef struct clientTrack {
+	clientId cid;
+	StoreRef * refs;		/* its blocks in the open segment, by first fix */
+	unsigned nrefs;
+	unsigned refCap;
+	OpenBlock open[2];
+	TrackRecord latest;		/* newest fix received */
+	struct clientTrack * next;	/* list of all clients */
+} ClientTrack;
+
+/* a segment with an index footer, mapped read-only */
+typedef struct sealedSegment {
+	uint32_t segment;
+	uint32_t count;
+	int64_t first;
+	int64_t last;
+	int64_t reach;			/* latest last of this segment and all those before it */
+	const StoreRef * refs;	/* sorted by client, then time */
+	void * map;
+	size_t mapLen;
+} SealedSegment;
+
+static char storeDir[STORE_PATH] = ".";
+static size_t storeSegmentSize = STORE_SEGMENT;
+
+/* writers hold the lock for writing, queries for reading */
+static pthread_rwlock_t storeLock = PTHREAD_RWLOCK_INITIALIZER;
+static AmbleRegistry clients;
+static ClientTrack * tracks;
+static clientId maxcid;			/* highest client ID with a history */
+static int storeFd = -1;		/* open segment */
+static uint32_t storeSegment;
+static uint64_t storeSize;		/* bytes in the open segment */
+static StoreRef * segRefs;		/* index of the open segment, in write order */
+static unsigned nsegRefs, segRefCap;
+static SealedSegment * sealed;	/* by first fix, so queries binary search them */
+static unsigned nsealed, sealedCap;
+static unsigned char * scratch;	/* one encoded block */
+
+static void * storeAlloc(void * ptr, size_t size) {
+	if ((ptr = realloc(ptr, size)) == NULL) {
+		printf("Fail to allocate memory space\n");
+		exit(1);
+	}
+	return ptr;
+}
+
+static void storePath(char * path, size_t n, uint32_t segment) {
+	snprintf(path, n, "%s/store-%08u.blk", storeDir, segment);
+}
+
+static int u32Compare(const void * a, const void * b) {
+	uint32_t x = *(const uint32_t *) a, y = *(const uint32_t *) b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* sequence numbers of the existing segments, in order */
+static uint32_t * storeList(unsigned * count) {
+	uint32_t * segs = NULL;
+	unsigned n = 0, cap = 0, seg;
+	struct dirent * de;
+	DIR * dir;
+
+	*count = 0;
+	if ((dir = opendir(storeDir)) == NULL)
+		return NULL;
+	while ((de = readdir(dir)) != NULL) {
+		if (sscanf(de->d_name, "store-%8u.blk", &seg) != 1)
+			continue;
+		if (n == cap) {
+			cap = cap ? cap * 2 : 64;
+			segs = (uint32_t *) storeAlloc(segs, cap * sizeof(uint32_t));
+		}
+		segs[n++] = seg;
+	}
+	closedir(dir);
+	qsort(segs, n, sizeof(uint32_t), u32Compare);
+	*count = n;
+	return segs;
+}
+
+static int storeRefCompare(const void * a, const void * b) {
+	const StoreRef * x = (const StoreRef *) a;
+	const StoreRef * y = (const StoreRef *) b;
+
+	if (x->cid != y->cid)
+		return x->cid < y->cid ? -1 : 1;
+	return x->first < y->first ? -1 : x->first > y->first;
+}
+
+/* map the footer of a sealed segment; -1 if it has none */
+static int storeMapFooter(uint32_t segment, SealedSegment * s) {
+	char path[STORE_PATH + 32];
+	StoreTrailer trailer;
+	off_t end, base;
+	int fd;
+
+	storePath(path, sizeof path, segment);
+	if ((fd = open(path, O_RDONLY | O_CLOEXEC)) == -1)
+		return -1;
+	end = lseek(fd, 0, SEEK_END);
+	if (end < (off_t) (sizeof(TrackSegmentHeader) + sizeof trailer)
+			|| pread(fd, &trailer, sizeof trailer, end - (off_t) sizeof trailer) != (ssize_t) sizeof trailer
+			|| trailer.magic != STORE_FOOTER
+			|| trailer.footer + (uint64_t) trailer.count * sizeof(StoreRef) + sizeof trailer != (uint64_t) end) {
+		close(fd);
+		return -1;
+	}
+
+	s->segment = segment;
+	s->count = trailer.count;
+	s->first = trailer.first;
+	s->last = trailer.last;
+	s->refs = NULL;
+	s->map = NULL;
+	s->mapLen = 0;
+	if (trailer.count > 0) {
+		base = (off_t) trailer.footer & ~((off_t) sysconf(_SC_PAGESIZE) - 1);
+		s->mapLen = (size_t) (end - base);
+		s->map = mmap(NULL, s->mapLen, PROT_READ, MAP_SHARED, fd, base);
+		if (s->map == MAP_FAILED) {
+			perror(path);
+			close(fd);
+			return -1;
+		}
+		s->refs = (const StoreRef *) ((const char *) s->map + (trailer.footer - (uint64_t) base));
+	}
+	close(fd);
+	return 0;
+}
+
+/* write the footer and trailer of a segment holding size bytes of blocks */
+static int storeWriteFooter(int fd, uint64_t size, StoreRef * refs, unsigned n) {
+	StoreTrailer trailer;
+	size_t len = n * sizeof(StoreRef);
+	unsigned i;
+
+	memset(&trailer, 0, sizeof trailer);
+	trailer.magic = STORE_FOOTER;
+	trailer.count = n;
+	trailer.footer = size;
+	for (i = 0; i < n; i++) {
+		if (i == 0 || refs[i].first < trailer.first)
+			trailer.first = refs[i].first;
+		if (i == 0 || refs[i].last > trailer.last)
+			trailer.last = refs[i].last;
+	}
+	qsort(refs, n, sizeof(StoreRef), storeRefCompare);
+	if (pwrite(fd, refs, len, (off_t) size) != (ssize_t) len
+			|| pwrite(fd, &trailer, sizeof trailer, (off_t) (size + len)) != (ssize_t) sizeof trailer
+			|| ftruncate(fd, (off_t) (size + len + sizeof trailer)) == -1
+			|| fdatasync(fd) == -1) {
+		perror("track store");
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Add a segment to the time ordered list. Segments mostly arrive in
+ * time order; backfill can put one's first fix earlier than its
+ * predecessors', and then it moves in among them.
+ */
+static void storeAddSealed(const SealedSegment * s) {
+	unsigned i;
+
+	if (nsealed == sealedCap) {
+		sealedCap = sealedCap ? sealedCap * 2 : 64;
+		sealed = (SealedSegment *) storeAlloc(sealed, sealedCap * sizeof(SealedSegment));
+	}
+	for (i = nsealed; i > 0 && sealed[i - 1].first > s->first; i--)
+		;
+	memmove(sealed + i + 1, sealed + i, (nsealed - i) * sizeof(SealedSegment));
+	sealed[i] = *s;
+	for (nsealed++; i < nsealed; i++)
+		sealed[i].reach = i > 0 && sealed[i - 1].reach > sealed[i].last
+				? sealed[i - 1].reach : sealed[i].last;
+}
+
+/* first sealed segment that may reach from: all before it end earlier */
+static unsigned storeSeekSealed(int64_t from) {
+	unsigned lo = 0, hi = nsealed;
+
+	while (lo < hi) {
+		unsigned mid = (lo + hi) / 2;
+		if (sealed[mid].reach < from)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/*
+ * A segment that lost its footer: walk its blocks, write the footer
+ * and map it. Anything after the last whole block is cut off.
+ */
+static int storeRebuildFooter(uint32_t segment, SealedSegment * s) {
+	char path[STORE_PATH + 32];
+	unsigned char block[TRACK_BLOCK_BOUND(STORE_FIXES)];
+	TrackRecord fixes[STORE_FIXES];
+	TrackBlockInfo info;
+	StoreRef * refs = NULL;
+	unsigned n = 0, cap = 0;
+	uint64_t off = sizeof(TrackSegmentHeader);
+	ssize_t got;
+	int fd, rc, count;
+
+	storePath(path, sizeof path, segment);
+	if ((fd = open(path, O_RDWR | O_CLOEXEC)) == -1)
+		return -1;
+	while ((got = pread(fd, block, sizeof block, (off_t) off)) > 0
+			&& trackBlockInfo(block, (size_t) got, &info) == 0
+			&& (count = trackBlockDecode(block, info.size, fixes, STORE_FIXES)) > 0) {
+		if (n == cap) {
+			cap = cap ? cap * 2 : 256;
+			refs = (StoreRef *) storeAlloc(refs, cap * sizeof(StoreRef));
+		}
+		refs[n].cid = info.cid;
+		refs[n].size = (uint32_t) info.size;
+		refs[n].offset = off;
+		refs[n].first = fixes[0].received;
+		refs[n].last = fixes[count - 1].received;
+		n++;
+		off += info.size;
+	}
+	rc = storeWriteFooter(fd, off, refs, n);
+	close(fd);
+	free(refs);
+	if (rc == -1)
+		return -1;
+	fprintf(stderr, "%s: index footer rebuilt, %u blocks\n", path, n);
+	return storeMapFooter(segment, s);
+}
+
+/*
+ * Seal the open segment, if any, and start the next one. A segment
+ * whose footer cannot be written stays open, its blocks indexed in
+ * memory, and the next roll tries again.
+ */
+static int storeRoll(void) {
+	char path[STORE_PATH + 32];
+	TrackSegmentHeader header;
+	SealedSegment s;
+	struct timespec now;
+	ClientTrack * t;
+
+	if (storeFd != -1) {
+		if (storeWriteFooter(storeFd, storeSize, segRefs, nsegRefs) == -1)
+			return -1;
+		close(storeFd);
+		storeFd = -1;
+		if (storeMapFooter(storeSegment, &s) == 0)
+			storeAddSealed(&s);
+		nsegRefs = 0;
+		for (t = tracks; t != NULL; t = t->next)
+			t->nrefs = 0;
+		storeSegment++;
+	}
+	else {
+		unsigned n;
+		uint32_t * segs = storeList(&n);
+
+		storeSegment = n > 0 ? segs[n - 1] + 1 : 0;
+		free(segs);
+	}
+
+	storePath(path, sizeof path, storeSegment);
+	storeFd = open(path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+	if (storeFd == -1) {
+		perror(path);
+		return -1;
+	}
+
+	clock_gettime(CLOCK_REALTIME, &now);
+	memset(&header, 0, sizeof header);
+	header.magic = STORE_MAGIC;
+	header.version = STORE_VERSION;
+	header.segment = storeSegment;
+	header.created = (int64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+	if (pwrite(storeFd, &header, sizeof header, 0) != (ssize_t) sizeof header) {
+		perror(path);
+		close(storeFd);
+		storeFd = -1;
+		unlink(path);		/* the next roll reuses the number */
+		return -1;
+	}
+	storeSize = sizeof header;
+	return 0;
+}
+
+/*
+ * Set the directory and segment size of the store. Call before
+ * storeRecover() and before the persistence thread starts appending.
+ */
+void storeOnLine(const char * dir, size_t segmentSize) {
+	if (dir != NULL)
+		snprintf(storeDir, sizeof storeDir, "%s", dir);
+	if (segmentSize >= sizeof(TrackSegmentHeader) + TRACK_BLOCK_BOUND(STORE_FIXES))
+		storeSegmentSize = segmentSize;
+	registryInit(&clients, STORE_CLIENTS);
+	scratch = (unsigned char *) storeAlloc(NULL, TRACK_BLOCK_BOUND(STORE_FIXES));
+}
+
+static ClientTrack * storeClient(clientId cid) {
+	ClientTrack * t = (ClientTrack *) registryFind(&clients, cid);
+
+	if (t == NULL) {
+		t = (ClientTrack *) storeAlloc(NULL, sizeof(ClientTrack));
+		memset(t, 0, sizeof(ClientTrack));
+		t->cid = cid;
+		t->next = tracks;
+		tracks = t;
+		registryInsert(&clients, cid, t);
+		if (cid > maxcid)
+			maxcid = cid;
+	}
+	return t;
+}
+
+/* index a block of the open segment */
+static void storeIndex(ClientTrack * t, const StoreRef * ref) {
+	unsigned i;
+
+	if (t->nrefs == t->refCap) {
+		t->refCap = t->refCap ? t->refCap * 2 : 16;
+		t->refs = (StoreRef *) storeAlloc(t->refs, t->refCap * sizeof(StoreRef));
+	}
+	/* by first fix; only backfilled blocks land before the end */
+	for (i = t->nrefs; i > 0 && t->refs[i - 1].first > ref->first; i--)
+		t->refs[i] = t->refs[i - 1];
+	t->refs[i] = *ref;
+	t->nrefs++;
+	if (nsegRefs == segRefCap) {
+		segRefCap = segRefCap ? segRefCap * 2 : 1024;
+		segRefs = (StoreRef *) storeAlloc(segRefs, segRefCap * sizeof(StoreRef));
+	}
+	segRefs[nsegRefs++] = *ref;
+}
+
+/*
+ * Write the oldest STORE_FIXES fixes, at most, of an open block of a
+ * client and index them; the rest stay open. Called with the lock
+ * held for writing; the block is in the file before its entry is
+ * visible to queries. Returns -1, the fixes left open to be tried
+ * again later, if nothing could be written.
+ */
+static int storeSeal(ClientTrack * t, OpenBlock * o) {
+	StoreRef ref;
+	unsigned n = o->n < STORE_FIXES ? o->n : STORE_FIXES;
+	size_t size;
+
+	if (n == 0)
+		return -1;
+	/* fewer fixes if they do not fit the bound, down to one */
+	while ((size = trackBlockEncode(o->recs, n, scratch, TRACK_BLOCK_BOUND(STORE_FIXES))) == 0
+			&& n > 1)
+		n /= 2;
+	if (size == 0) {
+		fprintf(stderr, "track store: client %u: fix does not encode\n", t->cid);
+		return -1;
+	}
+	if (storeFd == -1 || storeSize + size + (nsegRefs + 1) * sizeof(StoreRef)
+			+ sizeof(StoreTrailer) > storeSegmentSize)
+		if (storeRoll() == -1)
+			return -1;
+	if (pwrite(storeFd, scratch, size, (off_t) storeSize) != (ssize_t) size) {
+		perror("track store");
+		return -1;
+	}
+
+	ref.cid = t->cid;
+	ref.size = (uint32_t) size;
+	ref.offset = storeSize;
+	ref.first = STORE_TIME(o->recs[0].received);
+	ref.last = STORE_TIME(o->recs[n - 1].received);
+	storeIndex(t, &ref);
+	storeSize += size;
+	o->n -= n;
+	memmove(o->recs, o->recs + n, o->n * sizeof(TrackRecord));
+	return 0;
+}
+
+/* seal all of an open block; -1 if some of it stays open */
+static int storeSealAll(ClientTrack * t, OpenBlock * o) {
+	while (o->n > 0)
+		if (storeSeal(t, o) == -1)
+			return -1;
+	return 0;
+}
+
+/* put a fix in an open block, keeping it in time order */
+static void storeOpen(OpenBlock * o, const TrackRecord * rec) {
+	struct timespec now;
+	unsigned i;
+
+	if (o->n == o->cap) {
+		/* grows up to STORE_FIXES; a stalled seal keeps collecting */
+		o->cap = o->cap ? o->cap * 2 : 4;
+		o->recs = (TrackRecord *) storeAlloc(o->recs, o->cap * sizeof(TrackRecord));
+	}
+	if (o->n == 0) {
+		clock_gettime(CLOCK_REALTIME, &now);
+		o->opened = (int64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+	}
+	for (i = o->n; i > 0 && o->recs[i - 1].received > rec->received; i--)
+		o->recs[i] = o->recs[i - 1];
+	o->recs[i] = *rec;
+	o->n++;
+}
+
+/*
+ * Add fixes to the open blocks of their clients. Fixes older than the
+ * newest one of their client, backfilled ones, collect in a second
+ * open block so that neither breaks the other's run. A block never
+ * spans STORE_AGE or more, which bounds how far a query looks back.
+ * Persistence thread only.
+ */
+void storeAppend(const TrackRecord * recs, unsigned n) {
+	const TrackRecord * rec;
+	ClientTrack * t;
+	OpenBlock * o;
+	unsigned i;
+
+	pthread_rwlock_wrlock(&storeLock);
+	for (i = 0; i < n; i++) {
+		rec = &recs[i];
+		t = storeClient(rec->cid);
+		if (t->latest.cid != rec->cid || rec->received >= t->latest.received) {
+			o = &t->open[STORE_LIVE];
+			t->latest = *rec;
+		}
+		else
+			o = &t->open[STORE_LATE];
+		while (o->n > 0 && (o->n >= STORE_FIXES
+				|| rec->received - o->recs[0].received >= STORE_AGE
+				|| o->recs[o->n - 1].received - rec->received >= STORE_AGE))
+			if (storeSeal(t, o) == -1)
+				break;
+		storeOpen(o, rec);
+	}
+	pthread_rwlock_unlock(&storeLock);
+}
+
+/* Seal every open block that has been waiting STORE_AGE at now */
+void storeSweep(int64_t now) {
+	ClientTrack * t;
+	int k;
+
+	pthread_rwlock_wrlock(&storeLock);
+	for (t = tracks; t != NULL; t = t->next)
+		for (k = STORE_LIVE; k <= STORE_LATE; k++)
+			if (t->open[k].n > 0 && now - t->open[k].opened >= STORE_AGE)
+				storeSealAll(t, &t->open[k]);
+	pthread_rwlock_unlock(&storeLock);
+}
+
+/* Make the stored blocks durable */
+int storeSync(void) {
+	if (storeFd != -1 && fdatasync(storeFd) == -1) {
+		perror("track store");
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Seal every open block and write a checkpoint saying that the store
+ * holds the track log of each shard up to pos[shard] (TRACK_SHARDS
+ * entries). The checkpoint replaces the previous one atomically; none
+ * is written while a block cannot be sealed.
+ */
+int storeCheckpoint(const TrackLogPos * pos) {
+	char path[STORE_PATH + 32], tmp[STORE_PATH + 32];
+	StoreCheckpoint ck;
+	struct timespec now;
+	ClientTrack * t;
+	unsigned char * buf, * p;
+	size_t len;
+	int fd, rc = -1;
+
+	pthread_rwlock_wrlock(&storeLock);
+	/* fixes left open are not in the store: the log still has to hold them */
+	for (t = tracks; t != NULL; t = t->next)
+		if (storeSealAll(t, &t->open[STORE_LIVE]) == -1
+				|| storeSealAll(t, &t->open[STORE_LATE]) == -1) {
+			pthread_rwlock_unlock(&storeLock);
+			return -1;
+		}
+	if (storeFd == -1 && storeRoll() == -1) {
+		pthread_rwlock_unlock(&storeLock);
+		return -1;
+	}
+	storeSync();
+
+	memset(&ck, 0, sizeof ck);
+	ck.magic = STORE_CHECKPOINT;
+	ck.version = STORE_VERSION;
+	ck.segment = storeSegment;
+	ck.size = storeSize;
+	ck.refs = nsegRefs;
+	ck.nextcid = maxcid + 1;
+	for (t = tracks; t != NULL; t = t->next)
+		ck.clients++;
+	clock_gettime(CLOCK_REALTIME, &now);
+	ck.created = (int64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+
+	len = TRACK_SHARDS * sizeof(TrackLogPos) + ck.clients * sizeof(TrackRecord)
+			+ ck.refs * sizeof(StoreRef);
+	p = buf = (unsigned char *) storeAlloc(NULL, len);
+	memcpy(p, pos, TRACK_SHARDS * sizeof(TrackLogPos));
+	p += TRACK_SHARDS * sizeof(TrackLogPos);
+	for (t = tracks; t != NULL; t = t->next) {
+		memcpy(p, &t->latest, sizeof(TrackRecord));
+		p += sizeof(TrackRecord);
+	}
+	memcpy(p, segRefs, ck.refs * sizeof(StoreRef));
+	pthread_rwlock_unlock(&storeLock);
+
+	ck.checksum = ChecksumCalculator(buf, len);
+	snprintf(path, sizeof path, "%s/checkpoint.amb", storeDir);
+	snprintf(tmp, sizeof tmp, "%s/checkpoint.tmp", storeDir);
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd != -1 && write(fd, &ck, sizeof ck) == (ssize_t) sizeof ck
+			&& write(fd, buf, len) == (ssize_t) len && fsync(fd) == 0
+			&& rename(tmp, path) == 0)
+		rc = 0;
+	else
+		perror(tmp);
+	if (fd != -1)
+		close(fd);
+	free(buf);
+
+	/* the rename itself must survive a crash */
+	if (rc == 0 && (fd = open(storeDir, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) != -1) {
+		fsync(fd);
+		close(fd);
+	}
+	return rc;
+}
+
+/* Write a last checkpoint and close the store */
+void storeOffLine(const TrackLogPos * pos) {
+	storeCheckpoint(pos);
+	pthread_rwlock_wrlock(&storeLock);
+	if (storeFd != -1) {
+		close(storeFd);
+		storeFd = -1;
+	}
+	pthread_rwlock_unlock(&storeLock);
+}
+
+/* the byte sum version 1 checkpoints were written with */
+static CheckSum_t storeSumV1(const void * buf, size_t n) {
+	const uint8_t * p = (const uint8_t *) buf;
+	CheckSum_t sum = 0;
+
+	while (n--)
+		sum += *p++;
+	return sum;
+}
+
+/* map checkpoint.amb; NULL if there is no valid one */
+static const StoreCheckpoint * storeMapCheckpoint(size_t * len) {
+	char path[STORE_PATH + 32];
+	const StoreCheckpoint * ck;
+	struct stat st;
+	void * map;
+	int fd;
+
+	snprintf(path, sizeof path, "%s/checkpoint.amb", storeDir);
+	if ((fd = open(path, O_RDONLY | O_CLOEXEC)) == -1)
+		return NULL;
+	if (fstat(fd, &st) == -1 || st.st_size < (off_t) (sizeof(StoreCheckpoint)
+			+ TRACK_SHARDS * sizeof(TrackLogPos))) {
+		close(fd);
+		return NULL;
+	}
+	map = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return NULL;
+
+	ck = (const StoreCheckpoint *) map;
+	*len = (size_t) st.st_size;
+	/* a checkpoint of the previous version is still good, the next one is written anew */
+	if (ck->magic != STORE_CHECKPOINT
+			|| (ck->version != STORE_VERSION && ck->version != 1)
+			|| *len != sizeof *ck + TRACK_SHARDS * sizeof(TrackLogPos)
+				+ (size_t) ck->clients * sizeof(TrackRecord) + (size_t) ck->refs * sizeof(StoreRef)
+			|| ck->checksum != (ck->version == 1 ? storeSumV1(ck + 1, *len - sizeof *ck)
+				: ChecksumCalculator(ck + 1, *len - sizeof *ck))) {
+		fprintf(stderr, "%s: invalid, ignored\n", path);
+		munmap(map, *len);
+		return NULL;
+	}
+	return ck;
+}
+
+/*
+ * Bring the store back to the last checkpoint at startup: map the
+ * footers of the sealed segments, cut the open segment back to the
+ * checkpoint and drop segments written after it, then load the latest
+ * fixes and the open segment's index. pos (TRACK_SHARDS entries) is
+ * set to where the track log must be replayed from. Without a
+ * checkpoint the store starts empty and the whole log is replayed.
+ * Persistence thread not started yet.
+ */
+int storeRecover(TrackLogPos * pos) {
+	char path[STORE_PATH + 32];
+	const StoreCheckpoint * ck;
+	const TrackLogPos * ckPos;
+	const TrackRecord * latest;
+	const StoreRef * refs;
+	SealedSegment s;
+	uint32_t * segs;
+	unsigned n, i;
+	size_t len = 0;
+	int fd;
+
+	memset(pos, 0, TRACK_SHARDS * sizeof(TrackLogPos));
+	ck = storeMapCheckpoint(&len);
+	segs = storeList(&n);
+
+	for (i = 0; i < n; i++) {
+		storePath(path, sizeof path, segs[i]);
+		if (ck != NULL && segs[i] < ck->segment) {
+			if (storeMapFooter(segs[i], &s) == 0 || storeRebuildFooter(segs[i], &s) == 0)
+				storeAddSealed(&s);
+			else
+				fprintf(stderr, "%s: unreadable, skipped\n", path);
+		}
+		else if (ck != NULL && segs[i] == ck->segment
+				&& (fd = open(path, O_RDWR | O_CLOEXEC)) != -1) {
+			if (ftruncate(fd, (off_t) ck->size) == -1) {
+				perror(path);
+				close(fd);
+				continue;
+			}
+			storeFd = fd;
+			storeSegment = segs[i];
+			storeSize = ck->size;
+		}
+		else if (unlink(path) == -1)	/* newer than the checkpoint, rebuilt from the log */
+			perror(path);
+	}
+	free(segs);
+	if (ck == NULL)
+		return 0;
+
+	ckPos = (const TrackLogPos *) (ck + 1);
+	latest = (const TrackRecord *) (ckPos + TRACK_SHARDS);
+	refs = (const StoreRef *) (latest + ck->clients);
+	memcpy(pos, ckPos, TRACK_SHARDS * sizeof(TrackLogPos));
+	for (i = 0; i < ck->clients; i++)
+		storeClient(latest[i].cid)->latest = latest[i];
+	if (storeFd != -1)
+		for (i = 0; i < ck->refs; i++)
+			storeIndex(storeClient(refs[i].cid), &refs[i]);
+	if (ck->nextcid > maxcid + 1)
+		maxcid = ck->nextcid - 1;
+	munmap((void *) ck, len);
+	return 0;
+}
+
+/* First client ID that has no history */
+clientId storeNextClient(void) {
+	clientId cid;
+
+	pthread_rwlock_rdlock(&storeLock);
+	cid = maxcid + 1;
+	pthread_rwlock_unlock(&storeLock);
+	return cid;
+}
+
+/* Copy the last fix received from cid; -1 if there is none */
+int storeLatest(clientId cid, TrackRecord * rec) {
+	const ClientTrack * t;
+	int rc = -1;
+
+	pthread_rwlock_rdlock(&storeLock);
+	if ((t = (const ClientTrack *) registryFind(&clients, cid)) != NULL && t->latest.cid == cid) {
+		*rec = t->latest;
+		rc = 0;
+	}
+	pthread_rwlock_unlock(&storeLock);
+	return rc;
+}
+
+/* a block a query reads */
+typedef struct storeHit {
+	StoreRef ref;
+	uint32_t segment;
+} StoreHit;
+
+/* first entry of a footer at or after (cid, starting at or after from) */
+static unsigned storeSeekFooter(const SealedSegment * s, clientId cid, int64_t from) {
+	unsigned lo = 0, hi = s->count;
+
+	while (lo < hi) {
+		unsigned mid = (lo + hi) / 2;
+		if (s->refs[mid].cid < cid || (s->refs[mid].cid == cid && s->refs[mid].first < from))
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/* index of the first open segment block of t that starts at or after from */
+static unsigned storeSeek(const ClientTrack * t, int64_t from) {
+	unsigned lo = 0, hi = t->nrefs;
+
+	while (lo < hi) {
+		unsigned mid = (lo + hi) / 2;
+		if (t->refs[mid].first < from)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+static void storeHit(StoreHit ** hits, unsigned * n, unsigned * cap, const StoreRef * ref,
+		uint32_t segment) {
+	if (*n == *cap) {
+		*cap = *cap ? *cap * 2 : 64;
+		*hits = (StoreHit *) storeAlloc(*hits, *cap * sizeof(StoreHit));
+	}
+	(*hits)[*n].ref = *ref;
+	(*hits)[(*n)++].segment = segment;
+}
+
+static int storeHitCompare(const void * a, const void * b) {
+	const StoreHit * x = (const StoreHit *) a;
+	const StoreHit * y = (const StoreHit *) b;
+
+	return x->ref.first < y->ref.first ? -1 : x->ref.first > y->ref.first;
+}
+
+/*
+ * The blocks of cid overlapping [from, to], by first fix. No block
+ * spans STORE_AGE, so none starting earlier than that before from can
+ * reach it. Called with the lock held.
+ */
+static StoreHit * storeCollect(clientId cid, int64_t from, int64_t to, unsigned * count) {
+	const ClientTrack * t;
+	StoreHit * hits = NULL;
+	int64_t low = from - STORE_AGE;
+	unsigned n = 0, cap = 0, i, j;
+
+	for (i = storeSeekSealed(from); i < nsealed && sealed[i].first <= to; i++) {
+		const SealedSegment * s = &sealed[i];
+
+		if (s->last < from)
+			continue;
+		for (j = storeSeekFooter(s, cid, low); j < s->count && s->refs[j].cid == cid
+				&& s->refs[j].first <= to; j++)
+			if (s->refs[j].last >= from)
+				storeHit(&hits, &n, &cap, &s->refs[j], s->segment);
+	}
+	if ((t = (const ClientTrack *) registryFind(&clients, cid)) != NULL)
+		for (j = storeSeek(t, low); j < t->nrefs && t->refs[j].first <= to; j++)
+			if (t->refs[j].last >= from)
+				storeHit(&hits, &n, &cap, &t->refs[j], storeSegment);
+
+	/* segments are in write order; backfill makes that differ from time order */
+	qsort(hits, n, sizeof(StoreHit), storeHitCompare);
+	*count = n;
+	return hits;
+}
+
+/* time order; fixes of the same time by content, so every query orders them alike */
+static int storeFixCompare(const void * a, const void * b) {
+	const TrackRecord * x = (const TrackRecord *) a;
+	const TrackRecord * y = (const TrackRecord *) b;
+
+	if (x->received != y->received)
+		return x->received < y->received ? -1 : 1;
+	return memcmp(&x->fix, &y->fix, sizeof x->fix);
+}
+
+/* read and decode one stored block, keeping the fixes within [from, to] */
+static int storeLoad(const StoreRef * ref, uint32_t segment, int * fd, uint32_t * fdSegment,
+		int64_t from, int64_t to, TrackRecord * out, int max) {
+	TrackRecord fixes[STORE_FIXES];
+	unsigned char block[TRACK_BLOCK_BOUND(STORE_FIXES)];
+	char path[STORE_PATH + 32];
+	int n, i, got = 0;
+
+	if (*fd == -1 || *fdSegment != segment) {
+		if (*fd != -1)
+			close(*fd);
+		storePath(path, sizeof path, segment);
+		if ((*fd = open(path, O_RDONLY | O_CLOEXEC)) == -1) {
+			perror(path);
+			return -1;
+		}
+		*fdSegment = segment;
+	}
+	if (ref->size > sizeof block
+			|| pread(*fd, block, ref->size, (off_t) ref->offset) != (ssize_t) ref->size
+			|| (n = trackBlockDecode(block, ref->size, fixes, STORE_FIXES)) == -1)
+		return -1;
+	for (i = 0; i < n && got < max; i++)
+		if (fixes[i].received >= from && fixes[i].received <= to)
+			out[got++] = fixes[i];
+	return got;
+}
+
+/*
+ * Copy up to max fixes of client cid received within [from, to], ns
+ * since the epoch, to out in time order. Returns the number of fixes,
+ * -1 if stored blocks could not be read. The cost depends on the
+ * blocks overlapping the range, not on the length of the history.
+ */
+int storeQuery(clientId cid, int64_t from, int64_t to, TrackRecord * out, int max) {
+	const ClientTrack * t;
+	StoreHit * hits;
+	TrackRecord * acc, * tail = NULL;
+	uint32_t fdSegment = 0;
+	unsigned nhits, ntail = 0, i, k;
+	int fd = -1, got = 0, n;
+	int64_t next;
+
+	if (max <= 0)
+		return 0;
+
+	/* the index and the open blocks in one locked pass; reading never holds the lock */
+	pthread_rwlock_rdlock(&storeLock);
+	hits = storeCollect(cid, from, to, &nhits);
+	if ((t = (const ClientTrack *) registryFind(&clients, cid)) != NULL) {
+		tail = (TrackRecord *) storeAlloc(NULL, (t->open[STORE_LIVE].n + t->open[STORE_LATE].n + 1)
+				* sizeof(TrackRecord));
+		for (k = STORE_LIVE; k <= STORE_LATE; k++)
+			for (i = 0; i < t->open[k].n; i++)
+				if (t->open[k].recs[i].received >= from && t->open[k].recs[i].received <= to)
+					tail[ntail++] = t->open[k].recs[i];
+	}
+	pthread_rwlock_unlock(&storeLock);
+
+	/*
+	 * Blocks may overlap in time. Keep the max earliest fixes read so
+	 * far; once the last of them is earlier than the next block's first
+	 * fix, no block left can change them.
+	 */
+	acc = (TrackRecord *) storeAlloc(NULL, ((size_t) max + STORE_FIXES + ntail) * sizeof(TrackRecord));
+	for (i = 0; i < nhits; i++) {
+		if ((n = storeLoad(&hits[i].ref, hits[i].segment, &fd, &fdSegment, from, to,
+				acc + got, STORE_FIXES)) == -1) {
+			got = -1;
+			break;
+		}
+		got += n;
+		if (got >= max) {
+			qsort(acc, (size_t) got, sizeof(TrackRecord), storeFixCompare);
+			got = max;
+			next = i + 1 < nhits ? hits[i + 1].ref.first : INT64_MAX;
+			if (acc[max - 1].received < next)
+				break;
+		}
+	}
+	if (fd != -1)
+		close(fd);
+
+	if (got != -1) {
+		memcpy(acc + got, tail, ntail * sizeof(TrackRecord));
+		got += (int) ntail;
+		qsort(acc, (size_t) got, sizeof(TrackRecord), storeFixCompare);
+		if (got > max)
+			got = max;
+		memcpy(out, acc, (size_t) got * sizeof(TrackRecord));
+	}
+	free(acc);
+	free(tail);
+	free(hits);
+	return got;
+}
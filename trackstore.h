@@ -0,0 +1,96 @@
+/*
+ * trackstore.h
+ *
+ * Per-client history of received fixes, stored as compressed track
+ * blocks (trackblock.h) in store-NNNNNNNN.blk segment files, with a
+ * two level sparse index mapping (client ID, time) to blocks:
+ *
+ *  - blocks of the open segment are indexed per client in memory,
+ *    one entry per block, appended as the block is written;
+ *  - a sealed segment ends with an index footer, its entries sorted
+ *    by client and time, and a trailer with the segment's time span.
+ *    Footers are mapped, not read, so sealed history costs no memory
+ *    and no startup time.
+ *
+ * A time range query visits only the segments overlapping the range
+ * and binary searches their footers, so its latency does not depend
+ * on how much history is stored.
+ *
+ * Fixes of a client collect in an open block until it is full or old
+ * enough; queries see open blocks too. Backfilled fixes, older than
+ * the client's newest, collect in a block of their own, so blocks of
+ * a client may overlap in time. Only the persistence thread appends;
+ * any thread may query.
+ *
+ * A checkpoint (checkpoint.amb) records the latest fix of every
+ * client, the index of the open segment and the point of each shard's
+ * track log it covers. At startup it is mapped, the store is cut back
+ * to it, and only the log written after it has to be replayed.
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: yiding
+ */
+
+#ifndef TRACKSTORE_H_
+#define TRACKSTORE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "trackblock.h"
+
+#define STORE_MAGIC		0x4B4C4241	/* "ABLK" */
+#define STORE_FOOTER	0x52544641	/* "AFTR" */
+#define STORE_CHECKPOINT 0x504B4341	/* "ACKP" */
+#define STORE_VERSION	2				/* 1: checkpoints summed their bytes, still read */
+#define STORE_FIXES		64				/* fixes per stored block */
+#define STORE_AGE		(300LL * 1000000000)	/* ns an open block may wait */
+#define STORE_SEGMENT	(64 * 1024 * 1024)	/* default segment size */
+
+/* a stored block of a client: entry of footers and checkpoints */
+typedef struct storeRef {
+	uint32_t cid;
+	uint32_t size;
+	uint64_t offset;
+	int64_t first;			/* time of its first fix, ns since the epoch */
+	int64_t last;			/* time of its last fix */
+} StoreRef;
+
+/* last bytes of a sealed segment */
+typedef struct storeTrailer {
+	uint32_t magic;
+	uint32_t count;			/* footer entries */
+	uint64_t footer;		/* offset of the first one */
+	int64_t first;			/* time span of the segment */
+	int64_t last;
+} StoreTrailer;
+
+/* checkpoint.amb: followed by TRACK_SHARDS TrackLogPos, the latest fixes and the refs */
+typedef struct storeCheckpoint {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t segment;		/* open store segment */
+	uint32_t clients;		/* latest fix entries */
+	uint64_t size;			/* bytes of the open segment covered */
+	uint32_t refs;			/* index entries of the open segment */
+	CheckSum_t checksum;	/* CRC-32C of everything after the header */
+	uint32_t nextcid;		/* client IDs below it may have a history */
+	uint32_t reserved;
+	int64_t created;
+} StoreCheckpoint;
+
+void storeOnLine(const char * dir, size_t segmentSize);
+void storeOffLine(const TrackLogPos * pos);
+
+int storeRecover(TrackLogPos * pos);
+clientId storeNextClient(void);
+int storeCheckpoint(const TrackLogPos * pos);
+
+void storeAppend(const TrackRecord * recs, unsigned n);
+void storeSweep(int64_t now);
+int storeSync(void);
+
+int storeQuery(clientId cid, int64_t from, int64_t to, TrackRecord * out, int max);
+int storeLatest(clientId cid, TrackRecord * rec);
+
+#endif /* TRACKSTORE_H_ */
@@ -13,14 +13,19 @@
 #include <sys/wait.h>
 #include <errno.h>
 #include <pthread.h>
+#include <time.h>
+#include <stdint.h>
 
 #include "server.h"
 
 /* Misc manifest constants */
 #define MAXLINE    1024   /* max line size */
 #define MAXARGS     128   /* max args on a command line */
-#define MAXJOBS      16   /* max jobs at any point in time */
+#define MAXJOBS      16   /* initial size of the job indexes */
 #define MAXJID    1<<16   /* max job ID */
+#define JOBCHUNK     64   /* job structs allocated at a time */
+#define JOBPAGE      64   /* jobs listed per page */
+#define FIXPAGE      64   /* fixes listed per page of history */
 
 /* Job states */
 #define UNDEF 0 /* undefined */
@@ -43,6 +48,7 @@ extern char **environ;      /* defined in libc */
 char prompt[] = "sh> ";    /* command line prompt (DO NOT CHANGE) */
 int verbose = 0;            /* if true, print additional output */
 int nextjid = 1;            /* next job ID to allocate */
+volatile sig_atomic_t session_sig = 0; /* ctrl-c/ctrl-z aimed at a followed session */
 char sbuf[MAXLINE];         /* for composing sprintf messages */
 
 struct job_t {              /* The job struct */
@@ -50,8 +56,22 @@ struct job_t {              /* The job struct */
 	int jid;                /* job ID [1, 2, ...] */
 	int state;              /* UNDEF, BG, FG, or ST */
 	char cmdline[MAXLINE];  /* command line */
+	struct job_t *next;     /* free list */
 };
-struct job_t jobs[MAXJOBS]; /* The job list */
+
+/*
+ * The job list: job structs indexed by PID and by job ID. Jobs are
+ * added with the job control signals blocked, so only addjob() ever
+ * allocates; sigchld_handler() may delete a job at any time, which
+ * only tombstones index slots and pushes the struct on the free list.
+ */
+struct joblist_t {
+	AmbleRegistry bypid;
+	AmbleRegistry byjid;
+	struct job_t *free;     /* cleared job structs */
+	struct job_t *fg;       /* the FG job, NULL if none */
+};
+struct joblist_t jobs;      /* The job list */
 /* End global variables */
 
 
@@ -69,7 +89,13 @@ void Setpgid(pid_t pid, pid_t gpid);
 void eval(char *cmdline);
 int builtin_cmd(char **argv);
 void do_bgfg(char **argv);
+void do_session(char **argv);
+void do_jobs(char **argv);
+void do_history(char **argv);
+void do_where(char **argv);
+int parsetime(const char *arg, int64_t *t);
 void waitfg(pid_t pid);
+void waitsession(clientId cid);
 
 void sigchld_handler(int sig);
 void sigtstp_handler(int sig);
@@ -80,15 +106,16 @@ int parseline(const char *cmdline, char **argv);
 void sigquit_handler(int sig);
 
 void clearjob(struct job_t *job);
-void initjobs(struct job_t *jobs);
-int maxjid(struct job_t *jobs);
-int addjob(struct job_t *jobs, pid_t pid, int state, char *cmdline);
-int deletejob(struct job_t *jobs, pid_t pid);
-pid_t fgpid(struct job_t *jobs);
-struct job_t *getjobpid(struct job_t *jobs, pid_t pid);
-struct job_t *getjobjid(struct job_t *jobs, int jid);
+void initjobs(struct joblist_t *jobs);
+int maxjid(struct joblist_t *jobs);
+int addjob(struct joblist_t *jobs, pid_t pid, int state, char *cmdline);
+int deletejob(struct joblist_t *jobs, pid_t pid);
+void setjobstate(struct joblist_t *jobs, struct job_t *job, int state);
+pid_t fgpid(struct joblist_t *jobs);
+struct job_t *getjobpid(struct joblist_t *jobs, pid_t pid);
+struct job_t *getjobjid(struct joblist_t *jobs, int jid);
 int pid2jid(pid_t pid);
-void listjobs(struct job_t *jobs);
+int listjobs(struct joblist_t *jobs, int from, int max);
 
 void usage(void);
 void unix_error(const char *msg);
@@ -96,7 +123,6 @@ void app_error(const char *msg);
 typedef void handler_t(int);
 handler_t *Signal(int signum, handler_t *handler);
 
-void * serverThread(void *);
 void pickUp(AmbleClientInfo * client);
 
 /*
@@ -107,14 +133,19 @@ int main(int argc, char **argv)
 	char c;
 	char cmdline[MAXLINE];
 	int emit_prompt = 1; /* emit prompt (default) */
-	pthread_t thread;   /* thread variable */
+	ServerConfig config = { 1, BACKLOG, BACKEND_EPOLL, false, KML_RENAME, KML_INTERVAL,
+			".", TRACK_SEGMENT, PERSIST_INTERVAL, PERSIST_BYTES };
+
+	/* one shard per core by default */
+	if ((config.shards = (int) sysconf(_SC_NPROCESSORS_ONLN)) < 1)
+		config.shards = 1;
 
 	/* Redirect stderr to stdout (so that driver will get all output
 	 * on the pipe connected to stdout) */
 	dup2(1, 2);
 
 	/* Parse the command line */
-	while ((c = getopt(argc, argv, "hvp")) != EOF) {
+	while ((c = getopt(argc, argv, "hvpuUKn:b:k:d:s:c:C:")) != EOF) {
 		switch (c) {
 		case 'h':             /* print help message */
 			usage();
@@ -125,6 +156,36 @@ int main(int argc, char **argv)
 		case 'p':             /* don't print a prompt */
 			emit_prompt = 0;  /* handy for automatic testing */
 			break;
+		case 'u':             /* receive with io_uring */
+			config.backend = BACKEND_URING;
+			break;
+		case 'U':             /* also receive UDP datagrams */
+			config.udp = true;
+			break;
+		case 'n':             /* number of server shards */
+			config.shards = atoi(optarg);
+			break;
+		case 'b':             /* listen backlog of each shard */
+			config.backlog = atoi(optarg);
+			break;
+		case 'k':             /* minimum ms between KML updates */
+			config.kmlInterval = (unsigned) atoi(optarg);
+			break;
+		case 'K':             /* overwrite KML files in place */
+			config.kml = KML_OVERWRITE;
+			break;
+		case 'd':             /* track log directory */
+			config.trackDir = optarg;
+			break;
+		case 's':             /* track log segment size in MB */
+			config.trackSegment = (size_t) atoi(optarg) << 20;
+			break;
+		case 'c':             /* maximum ms between track log commits */
+			config.commitInterval = (unsigned) atoi(optarg);
+			break;
+		case 'C':             /* track log KB that force a commit */
+			config.commitBytes = (size_t) atoi(optarg) << 10;
+			break;
 		default:
 			usage();
 			break;
@@ -142,12 +203,11 @@ int main(int argc, char **argv)
 	Signal(SIGQUIT, sigquit_handler);
 
 	/* Initialize the job list */
-	initjobs(jobs);
+	initjobs(&jobs);
 
 	/* Initialize the server */
-	serverOnLine();
-
-	pthread_create(&thread, 0, &serverThread, NULL);
+	serverOnLine(&config);
+	serverStart(pickUp);
 
 	/* Execute the shell's read/eval loop */
 	while (1) {
@@ -174,56 +234,17 @@ int main(int argc, char **argv)
 }
 
 /*
- * pickUp - picks up the incoming transmission and forks into
- * a new process
+ * pickUp - picks up the incoming transmission. The connection
+ * itself is served by the event loop of the accepting shard
  */
 void pickUp(AmbleClientInfo * client)
 {
-	pid_t pid;
-	sigset_t mask;
-	char cmdline[MAXLINE] = "New client connection\n";
-
-	Sigemptyset(&mask); /* create empty mask */
-	Sigaddset(&mask, SIGCHLD); /* add SIGCHLD to mask */
-	Sigaddset(&mask, SIGINT); /* add SIGINT to mask */
-	Sigaddset(&mask, SIGTSTP); /* add SIGTSTP to mask */
-	Sigprocmask(SIG_BLOCK, &mask, NULL ); /* block SIGCHLD */
-
-	if ((pid = Fork()) == 0) { /* child runs user job */
-		Sigprocmask(SIG_UNBLOCK, &mask, NULL ); /* unblock SIGCHLD */
-		Setpgid(0, 0); /* Set group id of child */
-		serverOffLine(); /* Child doesn't need to listen */
-		client->cid = nextjid;
-		handler(client);
-		exit(0);
-	}
-
-	/* background job */
-	addjob(jobs, pid, BG, cmdline); /* add child to job list */
-	Sigprocmask(SIG_UNBLOCK, &mask, NULL ); /* unblock SIGCHLD */
-	printf("[%d] (%d) %s", pid2jid(pid), pid, cmdline);
+	printf("[%u] New client connection\n", client->cid);
+	fflush(stdout);
 
 	return;
 }
 
-/*
- * serverThread - The thread that create a socket to listen
- * and fork into connections with clients
- */
-void * serverThread(void * null) {
-	AmbleClientInfo * newClient;
-
-	while (1) {
-		/* Check if there is incoming connection */
-		if (serverRings(&newClient)) {
-			pickUp(newClient);
-		}
-	}
-
-	/* control should never reach here */
-	return NULL;
-}
-
 /*
  * eval - Evaluate the command line that the user has just typed in
  * 
@@ -264,12 +285,12 @@ void eval(char *cmdline)
 		}
 
 		if (!bg) {									/* foreground job */
-			addjob(jobs, pid, FG, cmdline);			/* add child to job list */
+			addjob(&jobs, pid, FG, cmdline);			/* add child to job list */
 			Sigprocmask(SIG_UNBLOCK, &mask, NULL);	/* unblock SIGCHLD */
 			waitfg(pid);
 		}
 		else {										/* background job */
-			addjob(jobs, pid, BG, cmdline);			/* add child to job list */
+			addjob(&jobs, pid, BG, cmdline);			/* add child to job list */
 			Sigprocmask(SIG_UNBLOCK, &mask, NULL);	/* unblock SIGCHLD */
 			printf("[%d] (%d) %s", pid2jid(pid), pid, cmdline);
 		}
@@ -351,7 +372,22 @@ int builtin_cmd(char **argv)
 		return 1;
 	
 	if (!strcmp(argv[0], "jobs")) {	/* jobs command */		
-		listjobs (jobs);
+		do_jobs(argv);
+		return 1;
+	}
+	
+	if (!strcmp(argv[0], "history")) {	/* history command */
+		do_history(argv);
+		return 1;
+	}
+	
+	if (!strcmp(argv[0], "where")) {	/* where command */
+		do_where(argv);
+		return 1;
+	}
+	
+	if (!strcmp(argv[0], "shards")) {	/* shards command */
+		serverReport();
 		return 1;
 	}
 	
@@ -378,14 +414,19 @@ void do_bgfg(char **argv)
 	int retval;
 	
 	if (argv[1] == NULL) {				/* empty pid/jid argument */
-		printf ("%s command requires PID or %%jobid argument\n",argv[0]);
+		printf ("%s command requires PID, %%jobid or @session argument\n",argv[0]);
+		return;
+	}
+
+	if (*argv[1] == '@') {				/* a client session */
+		do_session(argv);
 		return;
 	}
 	
 	if (*argv[1] == '%') {				/* read in jid */
 		retval = sscanf(argv[1],"%%%d",&jid);
 		if (retval == 1) {				/* read success */
-			job = getjobjid(jobs, jid);
+			job = getjobjid(&jobs, jid);
 			if (job == NULL) {
 				printf ("%%%d: No such job\n",jid);
 				return;
@@ -399,7 +440,7 @@ void do_bgfg(char **argv)
 	else {								/* read in pid */
 		retval = sscanf(argv[1],"%d",&pid);
 		if (retval == 1) {				/* read success */
-			job = getjobpid(jobs, pid);
+			job = getjobpid(&jobs, pid);
 			if (job == NULL) {
 				printf ("%d: No such process\n",pid);
 				return;
@@ -413,7 +454,7 @@ void do_bgfg(char **argv)
 	
 	if (!strcmp(argv[0], "bg")) {
 		if (job->state == ST) {
-			job->state = BG;
+			setjobstate(&jobs, job, BG);
 			kill (0-job->pid, SIGCONT);
 			printf("[%d] (%d) %s", jid, job->pid, job->cmdline);
 			return;
@@ -422,13 +463,13 @@ void do_bgfg(char **argv)
 	
 	if (!strcmp(argv[0], "fg")) {		
 		if (job->state == ST) {
-			job->state = FG;
+			setjobstate(&jobs, job, FG);
 			kill (0-job->pid, SIGCONT);
 			waitfg(job->pid);			/* blocked until pid process exits */
 			return;
 		}		
 		else if (job->state == BG) {
-			job->state = ST;
+			setjobstate(&jobs, job, ST);
 			kill (0-job->pid, SIGTSTP);
 			printf("Job [%d] (%d) stopped by signal %d\n", job->jid, job->pid, SIGTSTP);
 			return;
@@ -438,6 +479,221 @@ void do_bgfg(char **argv)
 	return;
 }
 
+/*
+ * do_session - Execute the builtin bg and fg commands on a client session.
+ *    bg resumes a stopped session, fg echoes a session's fixes until
+ *    ctrl-c sends it back to the background or ctrl-z stops it.
+ */
+void do_session(char **argv)
+{
+	unsigned cid;
+	int state;
+
+	if (sscanf(argv[1], "@%u", &cid) != 1) {
+		printf ("%s: argument must be a PID, %%jobid or @session\n", argv[0]);
+		return;
+	}
+	if ((state = serverSessionState(cid)) == -1) {
+		printf ("@%u: No such session\n", cid);
+		return;
+	}
+
+	if (!strcmp(argv[0], "bg")) {
+		if (state == SESSION_STOPPED && serverSession(cid, SESSION_RUNNING) == 0)
+			printf("[@%u] resumed\n", cid);
+		return;
+	}
+
+	if (!strcmp(argv[0], "fg")) {
+		if (serverSession(cid, SESSION_FOLLOWED) == 0)
+			waitsession(cid);
+		return;
+	}
+}
+
+/*
+ * do_jobs - Execute the builtin jobs command. Prints a page of jobs
+ *    and a page of client sessions; "jobs %jobid" and "jobs @session"
+ *    continue a listing from the given ID.
+ */
+void do_jobs(char **argv)
+{
+	int jid = 1, more;
+	unsigned cid = 1;
+	clientId next;
+
+	if (argv[1] != NULL && *argv[1] == '%') {
+		if (sscanf(argv[1], "%%%d", &jid) != 1) {
+			printf ("%s: argument must be a %%jobid or @session\n", argv[0]);
+			return;
+		}
+		cid = 0;
+	}
+	else if (argv[1] != NULL && *argv[1] == '@') {
+		if (sscanf(argv[1], "@%u", &cid) != 1) {
+			printf ("%s: argument must be a %%jobid or @session\n", argv[0]);
+			return;
+		}
+		jid = 0;
+	}
+	else if (argv[1] != NULL) {
+		printf ("%s: argument must be a %%jobid or @session\n", argv[0]);
+		return;
+	}
+
+	if (jid > 0 && (more = listjobs(&jobs, jid, JOBPAGE)) != 0)
+		printf("-- more: jobs %%%d --\n", more);
+	if (cid > 0 && (next = serverListSessions(cid, SESSION_PAGE)) != 0)
+		printf("-- more: jobs @%u --\n", next);
+}
+
+/*
+ * parsetime - Parse a time of today as HH:MM[:SS], or seconds since
+ *    the epoch with an optional fraction, into ns since the epoch.
+ *    Returns 0 on success, -1 if arg is neither.
+ */
+int parsetime(const char *arg, int64_t *t)
+{
+	struct tm tm;
+	time_t now = time(NULL);
+	long long sec;
+	char frac[10] = "";
+	int h, m, s = 0, i, len;
+	int64_t ns = 0;
+
+	if (strchr(arg, ':') != NULL) {
+		if (sscanf(arg, "%d:%d:%d", &h, &m, &s) < 2)
+			return -1;
+		localtime_r(&now, &tm);
+		tm.tm_hour = h;
+		tm.tm_min = m;
+		tm.tm_sec = s;
+		tm.tm_isdst = -1;
+		*t = (int64_t) mktime(&tm) * 1000000000;
+		return 0;
+	}
+	if (sscanf(arg, "%lld.%9[0-9]", &sec, frac) < 1)
+		return -1;
+	for (i = 0, len = (int) strlen(frac); i < 9; i++)
+		ns = ns * 10 + (i < len ? frac[i] - '0' : 0);
+	*t = (int64_t) sec * 1000000000 + ns;
+	return 0;
+}
+
+/*
+ * do_history - Execute the builtin history command: print a page of
+ *    the fixes of a client received between two times, by default
+ *    its whole history. The last line tells how to continue: from the
+ *    time of the page's last fix, past the fixes of that time already
+ *    listed, as several may share it.
+ */
+void do_history(char **argv)
+{
+	TrackRecord * fixes;
+	int64_t from = 0, to = INT64_MAX;
+	unsigned cid;
+	char when[16], start[64], * plus;
+	struct tm tm;
+	time_t sec;
+	int skip = 0, n, i, same;
+
+	start[0] = '\0';
+	if (argv[1] != NULL && argv[2] != NULL) {
+		snprintf(start, sizeof start, "%s", argv[2]);
+		if ((plus = strchr(start, '+')) != NULL) {
+			*plus = '\0';
+			skip = atoi(plus + 1);
+		}
+	}
+	if (argv[1] == NULL || sscanf(argv[1], "@%u", &cid) != 1 || skip < 0
+			|| (argv[2] != NULL && parsetime(start, &from) == -1)
+			|| (argv[2] != NULL && argv[3] != NULL && parsetime(argv[3], &to) == -1)) {
+		printf ("%s: usage: history @session [from[+skip] [to]], times as HH:MM[:SS] or epoch seconds\n",
+				argv[0]);
+		return;
+	}
+
+	if ((fixes = (TrackRecord *) malloc((size_t) (skip + FIXPAGE) * sizeof(TrackRecord))) == NULL) {
+		printf("Fail to allocate memory space\n");
+		exit(1);
+	}
+	if ((n = storeQuery(cid, from, to, fixes, skip + FIXPAGE)) == -1) {
+		printf ("@%u: cannot read the track store\n", cid);
+		free(fixes);
+		return;
+	}
+	for (i = skip; i < n; i++) {
+		sec = (time_t) (fixes[i].received / 1000000000);
+		localtime_r(&sec, &tm);
+		strftime(when, sizeof when, "%H:%M:%S", &tm);
+		printf("[@%u] %s %f, %f, %f, %f, %f\n", cid, when, fixes[i].fix.lat, fixes[i].fix.lon,
+				fixes[i].fix.alt, fixes[i].fix.speed, fixes[i].fix.heading);
+	}
+	if (n == skip + FIXPAGE) {
+		int64_t next = fixes[n - 1].received;
+
+		/* the fixes of the last time listed, on this page and before */
+		for (same = 0; same < n && fixes[n - 1 - same].received == next; same++)
+			;
+		printf("-- more: history @%u %lld.%09lld+%d", cid,
+				(long long) (next / 1000000000), (long long) (next % 1000000000), same);
+		if (to != INT64_MAX)
+			printf(" %lld.%09lld", (long long) (to / 1000000000), (long long) (to % 1000000000));
+		printf(" --\n");
+	}
+	free(fixes);
+}
+
+/*
+ * do_where - Execute the builtin where command: print the last fix
+ *    received from a client, connected or not
+ */
+void do_where(char **argv)
+{
+	TrackRecord fix;
+	unsigned cid;
+	char when[32];
+	struct tm tm;
+	time_t sec;
+
+	if (argv[1] == NULL || sscanf(argv[1], "@%u", &cid) != 1) {
+		printf ("%s: usage: where @session\n", argv[0]);
+		return;
+	}
+	if (storeLatest(cid, &fix) == -1) {
+		printf ("@%u: no fix received\n", cid);
+		return;
+	}
+	sec = (time_t) (fix.received / 1000000000);
+	localtime_r(&sec, &tm);
+	strftime(when, sizeof when, "%Y-%m-%d %H:%M:%S", &tm);
+	printf("[@%u] %s %f, %f, %f, %f, %f\n", cid, when, fix.fix.lat, fix.fix.lon,
+			fix.fix.alt, fix.fix.speed, fix.fix.heading);
+}
+
+/*
+ * waitsession - Block while session cid is followed in the foreground
+ */
+void waitsession(clientId cid)
+{
+	session_sig = 0;
+	while (serverSessionState(cid) == SESSION_FOLLOWED) {
+		if (session_sig == SIGINT) {
+			serverSession(cid, SESSION_RUNNING);
+			printf("Session [@%u] sent to background\n", cid);
+			break;
+		}
+		if (session_sig == SIGTSTP) {
+			serverSession(cid, SESSION_STOPPED);
+			printf("Session [@%u] stopped by signal %d\n", cid, SIGTSTP);
+			break;
+		}
+		sleep(1);		/* a signal cuts the nap short */
+	}
+	session_sig = 0;
+	return;
+}
+
 /*
  * waitfg - Block until process pid is no longer the foreground process
  */
@@ -445,7 +701,7 @@ void waitfg(pid_t pid)
 {
 	struct job_t * job;
 	
-	while ((job = getjobpid(jobs, pid)) != NULL) {
+	while ((job = getjobpid(&jobs, pid)) != NULL) {
 		if (job->state == FG)
 			sleep(1);
 		else
@@ -470,7 +726,7 @@ void sigchld_handler(int sig)
 {
 	pid_t pid;
 	while ((pid = waitpid(-1, NULL, WNOHANG)) > 0)	/* find zombies */
-		deletejob(jobs, pid);		/* delete the zombie process in job list */
+		deletejob(&jobs, pid);		/* delete the zombie process in job list */
 	return;
 }
 
@@ -482,15 +738,14 @@ void sigchld_handler(int sig)
 void sigint_handler(int sig)
 {
 	//printf("SIGINT signal caught\n");		/* just for test */
-	int i;
+	struct job_t *job = jobs.fg;
 	
-	for (i = 0; i < MAXJOBS; i++) {
-		if (jobs[i].state == FG) {			/* find the foreground process */
-			kill (0-jobs[i].pid, sig);
-			printf("Job [%d] (%d) terminated by signal %d\n", jobs[i].jid, jobs[i].pid, sig);
-			return;
-		}
+	if (job != NULL) {						/* the foreground process */
+		kill (0-job->pid, sig);
+		printf("Job [%d] (%d) terminated by signal %d\n", job->jid, job->pid, sig);
+		return;
 	}
+	session_sig = sig;		/* maybe a followed session, see waitsession() */
 	return;
 }
 
@@ -502,16 +757,15 @@ void sigint_handler(int sig)
 void sigtstp_handler(int sig)
 {
 	//printf("SIGTSTP signal caught\n");		/* just for test */
-	int i;
+	struct job_t *job = jobs.fg;
 	
-	for (i = 0; i < MAXJOBS; i++) {
-		if (jobs[i].state == FG) {			/* find the foreground process */
-			jobs[i].state = ST;
-			kill (0-jobs[i].pid, sig);
-			printf("Job [%d] (%d) stopped by signal %d\n", jobs[i].jid, jobs[i].pid, sig);
-			return;
-		}
+	if (job != NULL) {						/* the foreground process */
+		setjobstate(&jobs, job, ST);
+		kill (0-job->pid, sig);
+		printf("Job [%d] (%d) stopped by signal %d\n", job->jid, job->pid, sig);
+		return;
 	}
+	session_sig = sig;		/* maybe a followed session, see waitsession() */
 	return;
 }
 
@@ -532,143 +786,152 @@ void clearjob(struct job_t *job) {
 }
 
 /* initjobs - Initialize the job list */
-void initjobs(struct job_t *jobs) {
-	int i;
-
-	for (i = 0; i < MAXJOBS; i++)
-		clearjob(&jobs[i]);
+void initjobs(struct joblist_t *jobs) {
+	registryInit(&jobs->bypid, MAXJOBS);
+	registryInit(&jobs->byjid, MAXJOBS);
+	jobs->free = NULL;
+	jobs->fg = NULL;
 }
 
 /* maxjid - Returns largest allocated job ID */
-int maxjid(struct job_t *jobs)
+int maxjid(struct joblist_t *jobs)
 {
-	int i, max=0;
-
-	for (i = 0; i < MAXJOBS; i++)
-		if (jobs[i].jid > max)
-			max = jobs[i].jid;
-	return max;
+	return nextjid - 1;
 }
 
 /* addjob - Add a job to the job list */
-int addjob(struct job_t *jobs, pid_t pid, int state, char *cmdline)
+int addjob(struct joblist_t *jobs, pid_t pid, int state, char *cmdline)
 {
+	struct job_t *job;
 	int i;
 
 	if (pid < 1)
 		return 0;
+	if (nextjid > MAXJID) {
+		printf("Tried to create too many jobs\n");
+		return 0;
+	}
 
-	for (i = 0; i < MAXJOBS; i++) {
-		if (jobs[i].pid == 0) {
-			jobs[i].pid = pid;
-			jobs[i].state = state;
-			jobs[i].jid = nextjid++;
-			if (nextjid > MAXJOBS)
-				nextjid = 1;
-			strcpy(jobs[i].cmdline, cmdline);
-			if(verbose){
-				printf("Added job [%d] %d %s\n", jobs[i].jid, jobs[i].pid, jobs[i].cmdline);
-			}
-			return 1;
+	if (jobs->free == NULL) {
+		if ((job = malloc(JOBCHUNK * sizeof(struct job_t))) == NULL)
+			unix_error("malloc error");
+		for (i = 0; i < JOBCHUNK; i++) {
+			clearjob(&job[i]);
+			job[i].next = jobs->free;
+			jobs->free = &job[i];
 		}
 	}
-	printf("Tried to create too many jobs\n");
-	return 0;
+	job = jobs->free;
+	jobs->free = job->next;
+
+	job->pid = pid;
+	job->jid = nextjid++;
+	strcpy(job->cmdline, cmdline);
+	registryInsert(&jobs->bypid, job->pid, job);
+	registryInsert(&jobs->byjid, job->jid, job);
+	setjobstate(jobs, job, state);
+	if(verbose){
+		printf("Added job [%d] %d %s\n", job->jid, job->pid, job->cmdline);
+	}
+	return 1;
 }
 
 /* deletejob - Delete a job whose PID=pid from the job list */
-int deletejob(struct job_t *jobs, pid_t pid)
+int deletejob(struct joblist_t *jobs, pid_t pid)
 {
-	int i;
+	struct job_t *job;
 
 	if (pid < 1)
 		return 0;
+	if ((job = registryRemove(&jobs->bypid, pid)) == NULL)
+		return 0;
 
-	for (i = 0; i < MAXJOBS; i++) {
-		if (jobs[i].pid == pid) {
-			clearjob(&jobs[i]);
-			nextjid = maxjid(jobs)+1;
-			return 1;
-		}
-	}
-	return 0;
+	registryRemove(&jobs->byjid, job->jid);
+	if (jobs->fg == job)
+		jobs->fg = NULL;
+	clearjob(job);
+	job->next = jobs->free;
+	jobs->free = job;
+
+	/* keep nextjid at maxjid()+1 without scanning the list */
+	while (nextjid > 1 && getjobjid(jobs, nextjid - 1) == NULL)
+		nextjid--;
+	return 1;
+}
+
+/* setjobstate - Change the state of a job, tracking the FG job */
+void setjobstate(struct joblist_t *jobs, struct job_t *job, int state)
+{
+	job->state = state;
+	if (state == FG)
+		jobs->fg = job;
+	else if (jobs->fg == job)
+		jobs->fg = NULL;
 }
 
 /* fgpid - Return PID of current foreground job, 0 if no such job */
-pid_t fgpid(struct job_t *jobs) {
-	int i;
+pid_t fgpid(struct joblist_t *jobs) {
+	struct job_t *job = jobs->fg;
 
-	for (i = 0; i < MAXJOBS; i++)
-		if (jobs[i].state == FG)
-			return jobs[i].pid;
-	return 0;
+	return job == NULL ? 0 : job->pid;
 }
 
 /* getjobpid  - Find a job (by PID) on the job list */
-struct job_t *getjobpid(struct job_t *jobs, pid_t pid) {
-	int i;
-
+struct job_t *getjobpid(struct joblist_t *jobs, pid_t pid) {
 	if (pid < 1)
 		return NULL;
-	for (i = 0; i < MAXJOBS; i++)
-		if (jobs[i].pid == pid)
-			return &jobs[i];
-	return NULL;
+	return registryFind(&jobs->bypid, pid);
 }
 
 /* getjobjid  - Find a job (by JID) on the job list */
-struct job_t *getjobjid(struct job_t *jobs, int jid)
+struct job_t *getjobjid(struct joblist_t *jobs, int jid)
 {
-	int i;
-
 	if (jid < 1)
 		return NULL;
-	for (i = 0; i < MAXJOBS; i++)
-		if (jobs[i].jid == jid)
-			return &jobs[i];
-	return NULL;
+	return registryFind(&jobs->byjid, jid);
 }
 
 /* pid2jid - Map process ID to job ID */
 int pid2jid(pid_t pid)
 {
-	int i;
+	struct job_t *job = getjobpid(&jobs, pid);
 
-	if (pid < 1)
-		return 0;
-	for (i = 0; i < MAXJOBS; i++)
-		if (jobs[i].pid == pid) {
-			return jobs[i].jid;
-		}
-	return 0;
+	return job == NULL ? 0 : job->jid;
 }
 
-/* listjobs - Print the job list */
-void listjobs(struct job_t *jobs)
+/*
+ * listjobs - Print up to max jobs, starting with job ID from.
+ *    Returns the job ID to continue from, 0 after the last job.
+ */
+int listjobs(struct joblist_t *jobs, int from, int max)
 {
-	int i;
-
-	for (i = 0; i < MAXJOBS; i++) {
-		if (jobs[i].pid != 0) {
-			printf("[%d] (%d) ", jobs[i].jid, jobs[i].pid);
-			switch (jobs[i].state) {
-			case BG:
-				printf("Running ");
-				break;
-			case FG:
-				printf("Foreground ");
-				break;
-			case ST:
-				printf("Stopped ");
-				break;
-			default:
-				printf("listjobs: Internal error: job[%d].state=%d ",
-				       i, jobs[i].state);
-				break;
-			}
-			printf("%s", jobs[i].cmdline);
+	struct job_t *job;
+	int jid, n = 0;
+
+	for (jid = from < 1 ? 1 : from; jid < nextjid; jid++) {
+		if ((job = getjobjid(jobs, jid)) == NULL)
+			continue;
+		if (n++ == max)
+			return jid;
+		printf("[%d] (%d) ", job->jid, job->pid);
+		switch (job->state) {
+		case BG:
+			printf("Running ");
+			break;
+		case FG:
+			printf("Foreground ");
+			break;
+		case ST:
+			printf("Stopped ");
+			break;
+		default:
+			printf("listjobs: Internal error: job[%d].state=%d ",
+			       jid, job->state);
+			break;
 		}
+		printf("%s", job->cmdline);
 	}
+	return 0;
 }
 /******************************
  * end job list helper routines
@@ -684,10 +947,21 @@ void listjobs(struct job_t *jobs)
  */
 void usage(void)
 {
-	printf("Usage: shell [-hvp]\n");
+	printf("Usage: shell [-hvpuUK] [-n shards] [-b backlog] [-k ms] [-d dir] [-s MB]\n");
+	printf("             [-c ms] [-C KB]\n");
 	printf("   -h   print this message\n");
 	printf("   -v   print additional diagnostic information\n");
 	printf("   -p   do not emit a command prompt\n");
+	printf("   -u   receive with io_uring (falls back to epoll if unsupported)\n");
+	printf("   -U   also receive fixes as UDP datagrams\n");
+	printf("   -n   number of server shards (event loop threads), default one per core\n");
+	printf("   -b   pending connection queue of each shard\n");
+	printf("   -k   minimum milliseconds between two updates of a client's KML file\n");
+	printf("   -K   overwrite KML files in place instead of replacing them\n");
+	printf("   -d   directory of the track log segments, default the current one\n");
+	printf("   -s   size of a track log segment in MB, default 64\n");
+	printf("   -c   maximum milliseconds between two fsyncs of the track log, default 1000\n");
+	printf("   -C   KB written to the track log that force an fsync, default 1024\n");
 	exit(1);
 }
 
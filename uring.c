@@ -0,0 +1,280 @@
+/*
+ * uring.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: yiding
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/utsname.h>
+
+#include "uring.h"
+
+static int sysSetup(unsigned entries, struct io_uring_params * p) {
+	return (int) syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sysEnter(int fd, unsigned submit, unsigned wait, unsigned flags) {
+	return (int) syscall(__NR_io_uring_enter, fd, submit, wait, flags, NULL, 0);
+}
+
+static int sysRegister(int fd, unsigned op, void * arg, unsigned n) {
+	return (int) syscall(__NR_io_uring_register, fd, op, arg, n);
+}
+
+/* multishot receive needs Linux 6.0 */
+static int kernelSupported(void) {
+	struct utsname u;
+	int major = 0, minor = 0;
+
+	if (uname(&u) == -1 || sscanf(u.release, "%d.%d", &major, &minor) != 2)
+		return 0;
+	return major >= 6;
+}
+
+/*
+ * Set up a ring with room for entries SQEs and bufCount provided
+ * buffers of bufSize bytes each (bufCount must be a power of 2).
+ * Returns NULL if the kernel lacks the needed io_uring features.
+ */
+AmbleUring * newUring(unsigned entries, unsigned bufCount, unsigned bufSize) {
+	struct io_uring_params p;
+	struct io_uring_buf_reg reg;
+	AmbleUring * ring;
+	unsigned i;
+
+	if (!kernelSupported())
+		return NULL;
+
+	ring = (AmbleUring *) calloc(1, sizeof(AmbleUring));
+	if (ring == NULL) {
+		printf("Fail to allocate memory space\n");
+		exit(1);
+	}
+
+	memset(&p, 0, sizeof p);
+	ring->fd = sysSetup(entries, &p);
+	if (ring->fd == -1) {
+		free(ring);
+		return NULL;
+	}
+	if (!(p.features & IORING_FEAT_SINGLE_MMAP)) {
+		close(ring->fd);
+		free(ring);
+		return NULL;
+	}
+
+	/* the SQ and CQ rings share one mapping */
+	ring->sqLen = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	if (p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe) > ring->sqLen)
+		ring->sqLen = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	ring->sqPtr = mmap(NULL, ring->sqLen, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+	if (ring->sqPtr == MAP_FAILED) {
+		close(ring->fd);
+		free(ring);
+		return NULL;
+	}
+	ring->cqPtr = ring->sqPtr;
+
+	ring->sqesLen = p.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes = (struct io_uring_sqe *) mmap(NULL, ring->sqesLen,
+			PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+	if (ring->sqes == MAP_FAILED) {
+		munmap(ring->sqPtr, ring->sqLen);
+		close(ring->fd);
+		free(ring);
+		return NULL;
+	}
+
+	ring->sqHead = (unsigned *) ((char *) ring->sqPtr + p.sq_off.head);
+	ring->sqTail = (unsigned *) ((char *) ring->sqPtr + p.sq_off.tail);
+	ring->sqArray = (unsigned *) ((char *) ring->sqPtr + p.sq_off.array);
+	ring->sqMask = *(unsigned *) ((char *) ring->sqPtr + p.sq_off.ring_mask);
+	ring->sqEntries = p.sq_entries;
+
+	ring->cqHead = (unsigned *) ((char *) ring->cqPtr + p.cq_off.head);
+	ring->cqTail = (unsigned *) ((char *) ring->cqPtr + p.cq_off.tail);
+	ring->cqMask = *(unsigned *) ((char *) ring->cqPtr + p.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *) ((char *) ring->cqPtr + p.cq_off.cqes);
+
+	/* provided buffers: one ring of descriptors plus one pool of memory */
+	ring->bufCount = bufCount;
+	ring->bufSize = bufSize;
+	ring->bufMask = bufCount - 1;
+	ring->bufRingLen = bufCount * sizeof(struct io_uring_buf);
+	ring->bufRing = (struct io_uring_buf_ring *) mmap(NULL, ring->bufRingLen,
+			PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	ring->bufs = (unsigned char *) malloc((size_t) bufCount * bufSize);
+	if (ring->bufRing == MAP_FAILED || ring->bufs == NULL) {
+		printf("Fail to allocate memory space\n");
+		exit(1);
+	}
+
+	memset(&reg, 0, sizeof reg);
+	reg.ring_addr = (uint64_t) (uintptr_t) ring->bufRing;
+	reg.ring_entries = bufCount;
+	reg.bgid = URING_BGID;
+	if (sysRegister(ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) == -1) {
+		uringClose(ring);
+		return NULL;
+	}
+
+	for (i = 0; i < bufCount; i++)
+		uringRecycle(ring, i);
+	uringPublish(ring);
+
+	return ring;
+}
+
+void uringClose(AmbleUring * ring) {
+	close(ring->fd);
+	munmap(ring->sqes, ring->sqesLen);
+	munmap(ring->sqPtr, ring->sqLen);
+	munmap(ring->bufRing, ring->bufRingLen);
+	free(ring->bufs);
+	free(ring);
+}
+
+static struct io_uring_sqe * uringGetSqe(AmbleUring * ring) {
+	unsigned head = __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE);
+	unsigned tail = *ring->sqTail;
+	struct io_uring_sqe * sqe;
+
+	if (tail - head >= ring->sqEntries) {
+		/* ring is full, hand what we have to the kernel */
+		if (sysEnter(ring->fd, ring->sqPending, 0, 0) == -1)
+			return NULL;
+		ring->sqPending = 0;
+		head = __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE);
+		if (tail - head >= ring->sqEntries)
+			return NULL;
+	}
+
+	sqe = &ring->sqes[tail & ring->sqMask];
+	memset(sqe, 0, sizeof(struct io_uring_sqe));
+	ring->sqArray[tail & ring->sqMask] = tail & ring->sqMask;
+	__atomic_store_n(ring->sqTail, tail + 1, __ATOMIC_RELEASE);
+	ring->sqPending++;
+	return sqe;
+}
+
+/*
+ * Keep accepting on the listening socket fd; every new connection
+ * completes with its descriptor in cqe->res.
+ */
+int uringAcceptMultishot(AmbleUring * ring, int fd, uint64_t data) {
+	struct io_uring_sqe * sqe = uringGetSqe(ring);
+
+	if (sqe == NULL)
+		return -1;
+	sqe->opcode = IORING_OP_ACCEPT;
+	sqe->fd = fd;
+	sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+	sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+	sqe->user_data = data;
+	return 0;
+}
+
+/*
+ * Keep receiving on fd into provided buffers; every completion names
+ * the buffer it filled in cqe->flags.
+ */
+int uringRecvMultishot(AmbleUring * ring, int fd, uint64_t data) {
+	struct io_uring_sqe * sqe = uringGetSqe(ring);
+
+	if (sqe == NULL)
+		return -1;
+	sqe->opcode = IORING_OP_RECV;
+	sqe->fd = fd;
+	sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = URING_BGID;
+	sqe->user_data = data;
+	return 0;
+}
+
+/*
+ * Keep watching fd for readability; completes on every wakeup, the
+ * caller does the reads itself.
+ */
+int uringPollMultishot(AmbleUring * ring, int fd, uint64_t data) {
+	struct io_uring_sqe * sqe = uringGetSqe(ring);
+
+	if (sqe == NULL)
+		return -1;
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = fd;
+	sqe->len = IORING_POLL_ADD_MULTI;
+	sqe->poll32_events = POLLIN;
+	sqe->user_data = data;
+	return 0;
+}
+
+/* Cancel the request submitted with user_data target */
+int uringCancel(AmbleUring * ring, uint64_t target, uint64_t data) {
+	struct io_uring_sqe * sqe = uringGetSqe(ring);
+
+	if (sqe == NULL)
+		return -1;
+	sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	sqe->fd = -1;
+	sqe->addr = target;
+	sqe->user_data = data;
+	return 0;
+}
+
+/*
+ * Submit all queued SQEs and wait for at least one completion.
+ */
+int uringWait(AmbleUring * ring) {
+	int rc = sysEnter(ring->fd, ring->sqPending, 1, IORING_ENTER_GETEVENTS);
+
+	if (rc == -1)
+		return -1;
+	ring->sqPending -= (unsigned) rc;
+	return 0;
+}
+
+/*
+ * Return the completion after the first seen ones, or NULL if the
+ * kernel has not posted it yet.
+ */
+struct io_uring_cqe * uringPeek(AmbleUring * ring, unsigned seen) {
+	unsigned head = *ring->cqHead + seen;
+
+	if (head == __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE))
+		return NULL;
+	return &ring->cqes[head & ring->cqMask];
+}
+
+/* Release a batch of seen completions back to the kernel */
+void uringAdvance(AmbleUring * ring, unsigned seen) {
+	__atomic_store_n(ring->cqHead, *ring->cqHead + seen, __ATOMIC_RELEASE);
+}
+
+unsigned char * uringBuffer(AmbleUring * ring, unsigned bid) {
+	return ring->bufs + (size_t) bid * ring->bufSize;
+}
+
+/* Queue buffer bid for reuse; it is handed back on uringPublish() */
+void uringRecycle(AmbleUring * ring, unsigned bid) {
+	struct io_uring_buf * buf = &ring->bufRing->bufs[ring->bufTail & ring->bufMask];
+
+	buf->addr = (uint64_t) (uintptr_t) uringBuffer(ring, bid);
+	buf->len = ring->bufSize;
+	buf->bid = (uint16_t) bid;
+	ring->bufTail++;
+}
+
+void uringPublish(AmbleUring * ring) {
+	__atomic_store_n(&ring->bufRing->tail, ring->bufTail, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,70 @@
+/*
+ * uring.h
+ *
+ * A minimal io_uring wrapper on top of the raw system calls: one
+ * submission/completion ring plus one ring of provided receive
+ * buffers, enough to keep multishot accepts and receives armed.
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: yiding
+ */
+
+#ifndef URING_H_
+#define URING_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <linux/io_uring.h>
+
+#define URING_BGID 1	/* buffer group of the provided receive buffers */
+
+typedef struct ambleUring {
+	int fd;
+
+	/* submission queue */
+	unsigned * sqHead;
+	unsigned * sqTail;
+	unsigned * sqArray;
+	unsigned sqMask;
+	unsigned sqEntries;
+	unsigned sqPending;		/* SQEs queued but not yet submitted */
+	struct io_uring_sqe * sqes;
+
+	/* completion queue */
+	unsigned * cqHead;
+	unsigned * cqTail;
+	unsigned cqMask;
+	struct io_uring_cqe * cqes;
+
+	/* provided buffer ring */
+	struct io_uring_buf_ring * bufRing;
+	unsigned bufMask;
+	uint16_t bufTail;
+	unsigned char * bufs;
+	unsigned bufSize;
+	unsigned bufCount;
+
+	void * sqPtr;
+	size_t sqLen;
+	void * cqPtr;		/* aliases sqPtr (IORING_FEAT_SINGLE_MMAP) */
+	size_t sqesLen;
+	size_t bufRingLen;
+} AmbleUring;
+
+AmbleUring * newUring(unsigned entries, unsigned bufCount, unsigned bufSize);
+void uringClose(AmbleUring * ring);
+
+int uringAcceptMultishot(AmbleUring * ring, int fd, uint64_t data);
+int uringRecvMultishot(AmbleUring * ring, int fd, uint64_t data);
+int uringPollMultishot(AmbleUring * ring, int fd, uint64_t data);
+int uringCancel(AmbleUring * ring, uint64_t target, uint64_t data);
+
+int uringWait(AmbleUring * ring);
+struct io_uring_cqe * uringPeek(AmbleUring * ring, unsigned seen);
+void uringAdvance(AmbleUring * ring, unsigned seen);
+
+unsigned char * uringBuffer(AmbleUring * ring, unsigned bid);
+void uringRecycle(AmbleUring * ring, unsigned bid);
+void uringPublish(AmbleUring * ring);
+
+#endif /* URING_H_ */